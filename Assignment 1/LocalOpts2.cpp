@@ -7,267 +7,1534 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Transforms/Utils/LocalOpts2.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/PatternMatch.h"
 #include "llvm/ADT/APInt.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/ScopedHashTable.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/Local.h"
 
-#include <stack>
+// InstructionWorklist usa LLVM_DEBUG nell'header, quindi DEBUG_TYPE va definito prima di includerlo
+#define DEBUG_TYPE "localopts2"
+#include "llvm/Transforms/Utils/InstructionWorklist.h"
+
+#include <algorithm>
+#include <memory>
 
 using namespace llvm;
+using namespace llvm::PatternMatch;
 
-bool runOnBasicBlock2(BasicBlock &B) {
-    LLVMContext &context = B.getContext();
-    IRBuilder<> Builder(context);
+// Contatori delle trasformazioni, visibili con -stats
+STATISTIC(NumAlgebraicIdentity, "Numero di identità algebriche applicate");
+STATISTIC(NumStrengthReduction, "Numero di strength reduction applicate");
+STATISTIC(NumDivisionByConstant, "Numero di divisioni per costante ridotte");
+STATISTIC(NumMultiInstruction, "Numero di ottimizzazioni multi-istruzione applicate");
+STATISTIC(NumReassociation, "Numero di catene riassociate");
+STATISTIC(NumDeadErased, "Numero di istruzioni morte eliminate");
+STATISTIC(NumRedundantExpr, "Numero di espressioni ridondanti eliminate dal value numbering");
 
-    // Lo stack serve per memorizzare le istruzioni da ELIMINARE
-    std::stack<Instruction*> delStack;
+// ---------------------------------------------------------------------------
+// DIVISIONE PER COSTANTE (Granlund-Montgomery / Hacker's Delight, cap. 10)
+// Una divisione per una costante d viene sostituita da una moltiplicazione
+// "high" per un numero magico seguita da uno shift, più eventuali correzioni
+// di segno. Il resto si ottiene come x - (x / d) * d.
+// ---------------------------------------------------------------------------
 
-    // Le variabili seguenti servono come indice di controllo
-    int strength_reduction_count = 0;
-    int algebraic_identity_count = 0;
-    int multi_instr_opt_count = 0;
+// Numero magico per la divisione con segno
+struct SignedMagic {
+    APInt Magic;
+    unsigned Shift;
+};
 
-    outs() << "---Iterazione su tutte le istruzioni nel Basic Block:---\n";
-    for (Instruction &instIter : B) {
-        Instruction *I = &instIter;
-        outs() << "Istruzione: " << instIter << "\n";
+// Numero magico per la divisione senza segno. Se IsAdd è vero il moltiplicatore
+// reale è 2^W + Magic e serve la sequenza di correzione con add/shift
+struct UnsignedMagic {
+    APInt Magic;
+    unsigned Shift;
+    bool IsAdd;
+};
 
-        // Controllo se sia una operazione binaria
-        if (auto *binOp = dyn_cast<BinaryOperator>(I)) {
-            Value *op1 = binOp->getOperand(0);
-            Value *op2 = binOp->getOperand(1);
+// Funzione di supporto che calcola il numero magico per la divisione con segno per d
+// (d != 0, d != 1, d != -1)
+static SignedMagic computeSignedMagic(const APInt &D) {
+    unsigned W = D.getBitWidth();
+    APInt signedMin = APInt::getSignedMinValue(W);
+
+    APInt AD = D.abs();
+    APInt T = signedMin + D.lshr(W - 1);
+    APInt ANC = T - 1 - T.urem(AD); // Valore assoluto di nc
+    unsigned P = W - 1;
+
+    APInt Q1 = signedMin.udiv(ANC); // Q1 = 2^p / |nc|
+    APInt R1 = signedMin - Q1 * ANC; // R1 = resto(2^p, |nc|)
+    APInt Q2 = signedMin.udiv(AD); // Q2 = 2^p / |d|
+    APInt R2 = signedMin - Q2 * AD; // R2 = resto(2^p, |d|)
+    APInt Delta;
+
+    do {
+        P++;
+        Q1 <<= 1;
+        R1 <<= 1;
+        if (R1.uge(ANC)) {
+            ++Q1;
+            R1 -= ANC;
+        }
+        Q2 <<= 1;
+        R2 <<= 1;
+        if (R2.uge(AD)) {
+            ++Q2;
+            R2 -= AD;
+        }
+        Delta = AD - R2;
+    } while (Q1.ult(Delta) || (Q1 == Delta && R1 == 0));
+
+    SignedMagic Result;
+    Result.Magic = Q2 + 1;
+    if (D.isNegative())
+        Result.Magic = -Result.Magic;
+    Result.Shift = P - W;
+    return Result;
+}
+
+// Funzione di supporto che calcola il numero magico per la divisione senza segno per d,
+// sapendo che i LeadingZeros bit più significativi del dividendo sono nulli
+static UnsignedMagic computeUnsignedMagic(const APInt &D, unsigned LeadingZeros = 0) {
+    unsigned W = D.getBitWidth();
+    APInt allOnes = APInt::getAllOnes(W).lshr(LeadingZeros);
+    APInt signedMin = APInt::getSignedMinValue(W);
+    APInt signedMax = APInt::getSignedMaxValue(W);
+
+    bool IsAdd = false;
+    APInt NC = allOnes - (allOnes - D).urem(D);
+    unsigned P = W - 1;
+
+    APInt Q1 = signedMin.udiv(NC); // Q1 = 2^p / nc
+    APInt R1 = signedMin - Q1 * NC; // R1 = resto(2^p, nc)
+    APInt Q2 = signedMax.udiv(D); // Q2 = (2^p - 1) / d
+    APInt R2 = signedMax - Q2 * D; // R2 = resto(2^p - 1, d)
+    APInt Delta;
+
+    do {
+        P++;
+        if (R1.uge(NC - R1)) {
+            Q1 = Q1 + Q1 + 1;
+            R1 = R1 + R1 - NC;
+        } else {
+            Q1 = Q1 + Q1;
+            R1 = R1 + R1;
+        }
+        if ((R2 + 1).uge(D - R2)) {
+            if (Q2.uge(signedMax))
+                IsAdd = true;
+            Q2 = Q2 + Q2 + 1;
+            R2 = R2 + R2 + 1 - D;
+        } else {
+            if (Q2.uge(signedMin))
+                IsAdd = true;
+            Q2 = Q2 + Q2;
+            R2 = R2 + R2 + 1;
+        }
+        Delta = D - 1 - R2;
+    } while (P < W * 2 && (Q1.ult(Delta) || (Q1 == Delta && R1 == 0)));
+
+    UnsignedMagic Result;
+    Result.Magic = Q2 + 1;
+    Result.Shift = P - W;
+    Result.IsAdd = IsAdd;
+    return Result;
+}
+
+// Funzione di supporto che calcola l'inverso moltiplicativo modulo 2^W di un valore dispari
+// (metodo di Newton: ogni iterazione raddoppia i bit corretti)
+static APInt multiplicativeInverseOdd(const APInt &D) {
+    APInt Inv = D;
+    while (D * Inv != 1)
+        Inv *= APInt(D.getBitWidth(), 2) - D * Inv;
+    return Inv;
+}
+
+// Funzione di supporto che estrae i valori per corsia di una costante intera: un solo valore per
+// gli scalari e gli splat, uno per corsia per i vettori. Ritorna false se V non è una costante
+// intera nota in ogni corsia (ad esempio se contiene undef)
+static bool getConstantLanes(Value *V, SmallVectorImpl<APInt> &Lanes) {
+    auto *C = dyn_cast<Constant>(V);
+    if (!C)
+        return false;
+
+    if (auto *CI = dyn_cast<ConstantInt>(C)) {
+        Lanes.push_back(CI->getValue());
+        return true;
+    }
+    if (auto *Splat = dyn_cast_or_null<ConstantInt>(C->getSplatValue())) {
+        Lanes.push_back(Splat->getValue());
+        return true;
+    }
+
+    auto *VecTy = dyn_cast<FixedVectorType>(C->getType());
+    if (!VecTy || !VecTy->getElementType()->isIntegerTy())
+        return false;
+    for (unsigned Idx = 0; Idx < VecTy->getNumElements(); ++Idx) {
+        auto *Elt = dyn_cast_or_null<ConstantInt>(C->getAggregateElement(Idx));
+        if (!Elt)
+            return false;
+        Lanes.push_back(Elt->getValue());
+    }
+    return true;
+}
+
+// Funzione di supporto che stabilisce se tutte le corsie hanno lo stesso valore
+static bool isUniform(ArrayRef<APInt> Lanes) {
+    for (const APInt &Lane : Lanes)
+        if (Lane != Lanes.front())
+            return false;
+    return true;
+}
+
+// Funzione di supporto che costruisce una costante di tipo Ty (intero o vettore di interi) con i valori
+// per corsia Lanes. Un solo valore, o tutti uguali, danno uno scalare o uno splat
+static Constant *getLanesConstant(Type *Ty, ArrayRef<APInt> Lanes) {
+    if (isUniform(Lanes))
+        return ConstantInt::get(Ty, Lanes.front());
+
+    SmallVector<Constant*, 8> Elts;
+    for (const APInt &Lane : Lanes)
+        Elts.push_back(ConstantInt::get(Ty->getScalarType(), Lane));
+    return ConstantVector::get(Elts);
+}
+
+// Funzione di supporto che genera la parte alta (W bit) del prodotto X * Magic su 2W bit, corsia per corsia
+static Value *createMulHigh(IRBuilderBase &Builder, Value *X, ArrayRef<APInt> Magic, bool IsSigned) {
+    Type *Ty = X->getType();
+    unsigned W = Ty->getScalarSizeInBits();
+    Type *WideTy = Ty->getWithNewBitWidth(W * 2);
+
+    SmallVector<APInt, 8> WideMagic;
+    for (const APInt &Lane : Magic)
+        WideMagic.push_back(IsSigned ? Lane.sext(W * 2) : Lane.zext(W * 2));
+
+    Value *WideX = IsSigned ? Builder.CreateSExt(X, WideTy) : Builder.CreateZExt(X, WideTy);
+    Value *Product = Builder.CreateMul(WideX, getLanesConstant(WideTy, WideMagic));
+    return Builder.CreateTrunc(Builder.CreateLShr(Product, W), Ty);
+}
+
+// Funzione di supporto che genera il quoziente senza segno X / D (D > 1)
+static Value *createUDivByConstant(IRBuilderBase &Builder, Value *X, const APInt &D, bool IsExact) {
+    unsigned W = D.getBitWidth();
+
+    // D potenza di 2: x / 2^k = x >> k
+    if (D.isPowerOf2())
+        return Builder.CreateLShr(X, D.logBase2(), "", IsExact);
+
+    // D divisore "grande" (bit più significativo a 1): il quoziente può valere solo 0 o 1
+    if (D.isNegative())
+        return Builder.CreateZExt(Builder.CreateICmpUGE(X, ConstantInt::get(X->getType(), D)), X->getType());
+
+    // Divisione esatta: x / (d' * 2^k) = (x >> k) * inv(d')
+    if (IsExact) {
+        unsigned TZ = D.countr_zero();
+        Value *Shifted = TZ ? Builder.CreateLShr(X, TZ, "", true) : X;
+        return Builder.CreateMul(Shifted, ConstantInt::get(X->getType(), multiplicativeInverseOdd(D.lshr(TZ))));
+    }
+
+    UnsignedMagic Mag = computeUnsignedMagic(D);
+    unsigned PreShift = 0;
+
+    // Se serve la correzione con add e il divisore è pari, conviene prima dividere per 2^k
+    // e ricalcolare il numero magico sapendo che i k bit alti del dividendo sono nulli
+    if (Mag.IsAdd && !D[0]) {
+        PreShift = D.countr_zero();
+        Mag = computeUnsignedMagic(D.lshr(PreShift), PreShift);
+        assert(!Mag.IsAdd && "Il pre-shift deve eliminare la correzione con add");
+    }
+
+    Value *Dividend = PreShift ? Builder.CreateLShr(X, PreShift) : X;
+    Value *Q = createMulHigh(Builder, Dividend, Mag.Magic, /*IsSigned=*/false);
+
+    if (!Mag.IsAdd)
+        return Mag.Shift ? Builder.CreateLShr(Q, Mag.Shift) : Q;
+
+    // q = (((x - t) >> 1) + t) >> (s - 1), con t = mulhu(x, magic)
+    assert(Mag.Shift > 0 && W > 1 && "Shift non valido per la correzione con add");
+    Value *NPQ = Builder.CreateLShr(Builder.CreateSub(X, Q), 1);
+    NPQ = Builder.CreateAdd(NPQ, Q);
+    return Mag.Shift > 1 ? Builder.CreateLShr(NPQ, Mag.Shift - 1) : NPQ;
+}
+
+// Funzione di supporto che genera il quoziente con segno X / D (|D| > 1), troncato verso zero
+static Value *createSDivByConstant(IRBuilderBase &Builder, Value *X, const APInt &D, bool IsExact) {
+    unsigned W = D.getBitWidth();
+    Type *Ty = X->getType();
+
+    // D = INT_MIN: il quoziente è 1 solo se anche x vale INT_MIN
+    if (D.isMinSignedValue())
+        return Builder.CreateZExt(Builder.CreateICmpEQ(X, ConstantInt::get(Ty, D)), Ty);
+
+    APInt AD = D.abs();
+
+    // Divisione esatta: x / (d' * 2^k) = (x >>s k) * inv(d')
+    if (IsExact) {
+        unsigned TZ = AD.countr_zero();
+        Value *Shifted = TZ ? Builder.CreateAShr(X, TZ, "", true) : X;
+        return Builder.CreateMul(Shifted, ConstantInt::get(Ty, multiplicativeInverseOdd(D.ashr(TZ))));
+    }
+
+    // |D| potenza di 2: lo shift aritmetico arrotonda verso -inf, quindi ai dividendi negativi
+    // va prima sommato 2^k - 1 (bias ottenuto dal bit di segno)
+    if (AD.isPowerOf2()) {
+        unsigned K = AD.logBase2();
+        Value *Sign = Builder.CreateAShr(X, K - 1);
+        Value *Bias = Builder.CreateLShr(Sign, W - K);
+        Value *Q = Builder.CreateAShr(Builder.CreateAdd(X, Bias), K);
+        return D.isNegative() ? Builder.CreateNeg(Q) : Q;
+    }
+
+    SignedMagic Mag = computeSignedMagic(D);
+    Value *Q = createMulHigh(Builder, X, Mag.Magic, /*IsSigned=*/true);
+
+    // Correzione quando il numero magico ha segno opposto al divisore
+    if (D.isStrictlyPositive() && Mag.Magic.isNegative())
+        Q = Builder.CreateAdd(Q, X);
+    else if (D.isNegative() && Mag.Magic.isStrictlyPositive())
+        Q = Builder.CreateSub(Q, X);
+
+    if (Mag.Shift)
+        Q = Builder.CreateAShr(Q, Mag.Shift);
+
+    // Se il quoziente è negativo si aggiunge 1 per arrotondare verso zero
+    return Builder.CreateAdd(Q, Builder.CreateLShr(Q, W - 1));
+}
+
+// Funzione di supporto che genera il quoziente senza segno X / D con un divisore diverso per ogni
+// corsia (D[i] > 1). Ritorna nullptr se le corsie richiedono sequenze di forma diversa
+static Value *createUDivByConstantLanes(IRBuilderBase &Builder, Value *X, ArrayRef<APInt> D) {
+    Type *Ty = X->getType();
+    unsigned W = D.front().getBitWidth();
+    SmallVector<APInt, 8> Magic, Shift;
+    bool AllPowerOf2 = true;
+    for (const APInt &Lane : D)
+        AllPowerOf2 &= Lane.isPowerOf2();
+
+    // Tutte potenze di 2: uno shift per corsia
+    if (AllPowerOf2) {
+        for (const APInt &Lane : D)
+            Shift.push_back(APInt(W, Lane.logBase2()));
+        return Builder.CreateLShr(X, getLanesConstant(Ty, Shift));
+    }
+
+    bool IsAdd = false;
+    for (const APInt &Lane : D) {
+        // Divisori "grandi" e correzioni con add diverse tra le corsie non sono gestiti
+        if (Lane.isNegative())
+            return nullptr;
+        UnsignedMagic Mag = computeUnsignedMagic(Lane);
+        if (&Lane != D.begin() && Mag.IsAdd != IsAdd)
+            return nullptr;
+        IsAdd = Mag.IsAdd;
+        Magic.push_back(Mag.Magic);
+        Shift.push_back(APInt(W, IsAdd ? Mag.Shift - 1 : Mag.Shift));
+    }
+
+    Value *Q = createMulHigh(Builder, X, Magic, /*IsSigned=*/false);
+    if (IsAdd) {
+        Value *NPQ = Builder.CreateLShr(Builder.CreateSub(X, Q), 1);
+        Q = Builder.CreateAdd(NPQ, Q);
+    }
+    return Builder.CreateLShr(Q, getLanesConstant(Ty, Shift));
+}
+
+// Funzione di supporto che genera il quoziente con segno X / D con un divisore diverso per ogni
+// corsia (|D[i]| > 1, D[i] != INT_MIN)
+static Value *createSDivByConstantLanes(IRBuilderBase &Builder, Value *X, ArrayRef<APInt> D) {
+    Type *Ty = X->getType();
+    unsigned W = D.front().getBitWidth();
+    SmallVector<APInt, 8> Magic, Shift, Factor;
+
+    for (const APInt &Lane : D) {
+        SignedMagic Mag = computeSignedMagic(Lane);
+        Magic.push_back(Mag.Magic);
+        Shift.push_back(APInt(W, Mag.Shift));
 
-            // Controllo se uno dei due operandi è COSTANTE
-            ConstantInt *x = dyn_cast<ConstantInt>(op1);
-            ConstantInt *y = dyn_cast<ConstantInt>(op2);
+        // Correzione quando il numero magico ha segno opposto al divisore: +x, -x oppure nulla
+        if (Lane.isStrictlyPositive() && Mag.Magic.isNegative())
+            Factor.push_back(APInt(W, 1));
+        else if (Lane.isNegative() && Mag.Magic.isStrictlyPositive())
+            Factor.push_back(APInt::getAllOnes(W));
+        else
+            Factor.push_back(APInt(W, 0));
+    }
+
+    Value *Q = createMulHigh(Builder, X, Magic, /*IsSigned=*/true);
+    if (isUniform(Factor)) {
+        if (Factor.front().isOne())
+            Q = Builder.CreateAdd(Q, X);
+        else if (Factor.front().isAllOnes())
+            Q = Builder.CreateSub(Q, X);
+    } else {
+        // Correzioni diverse tra le corsie: q += x * <1, 0, -1, ...>
+        Q = Builder.CreateAdd(Q, Builder.CreateMul(X, getLanesConstant(Ty, Factor)));
+    }
+
+    Q = Builder.CreateAShr(Q, getLanesConstant(Ty, Shift));
+    return Builder.CreateAdd(Q, Builder.CreateLShr(Q, W - 1));
+}
+
+// Funzione di supporto che espande una sdiv/udiv/srem/urem per la costante D (un valore per corsia,
+// oppure uno solo per scalari e splat) in una sequenza senza divisioni.
+// Ritorna nullptr se la trasformazione non è applicabile
+static Value *expandDivisionByConstant(BinaryOperator *binOp, ArrayRef<APInt> D, IRBuilderBase &Builder) {
+    Value *X = binOp->getOperand(0);
+    Type *Ty = X->getType();
+    unsigned Opcode = binOp->getOpcode();
+    bool IsSigned = Opcode == Instruction::SDiv || Opcode == Instruction::SRem;
+    bool IsRem = Opcode == Instruction::SRem || Opcode == Instruction::URem;
+
+    // La divisione per 0 è UB: la lasciamo com'è. Per i1 non c'è nulla da guadagnare
+    if (!Ty->isIntOrIntVectorTy() || D.empty() || D.front().getBitWidth() < 2)
+        return nullptr;
+    for (const APInt &Lane : D)
+        if (Lane.isZero())
+            return nullptr;
+
+    Value *Q = nullptr;
+    if (isUniform(D)) {
+        const APInt &Divisor = D.front();
+
+        // Algebraic identity: x / 1 = x e x % 1 = 0
+        if (Divisor.isOne())
+            return IsRem ? Constant::getNullValue(Ty) : X;
+
+        // Con segno: x / -1 = -x e x % -1 = 0
+        if (IsSigned && Divisor.isAllOnes())
+            return IsRem ? Constant::getNullValue(Ty) : Builder.CreateNeg(X);
+
+        bool IsExact = !IsRem && binOp->isExact();
+        Q = IsSigned ? createSDivByConstant(Builder, X, Divisor, IsExact)
+                     : createUDivByConstant(Builder, X, Divisor, IsExact);
+    } else {
+        // Divisori diversi tra le corsie: i casi particolari (1, -1, INT_MIN) restano alla divisione
+        for (const APInt &Lane : D) {
+            if (Lane.isOne() || (IsSigned && (Lane.isAllOnes() || Lane.isMinSignedValue())))
+                return nullptr;
+        }
+        Q = IsSigned ? createSDivByConstantLanes(Builder, X, D) : createUDivByConstantLanes(Builder, X, D);
+        if (!Q)
+            return nullptr;
+    }
+
+    if (!IsRem)
+        return Q;
+
+    // Resto: r = x - q * d
+    return Builder.CreateSub(X, Builder.CreateMul(Q, getLanesConstant(Ty, D)));
+}
+
+// ---------------------------------------------------------------------------
+// MOLTIPLICAZIONE PER COSTANTE
+// x * C viene scomposta in una sequenza di shift/add/sub cercando la più
+// economica tra la forma NAF (canonical signed digit) di C, la rimozione dei
+// fattori 2^k e le fattorizzazioni C = (2^k +- 1) * C', che riusano il
+// prodotto parziale x * C'. La sequenza sostituisce la mul solo se costa meno
+// secondo la tabella dei costi del target.
+// ---------------------------------------------------------------------------
+
+// Costi (approssimativamente in cicli di latenza) delle operazioni di un target
+struct MulCostModel {
+    const char *ArchPrefix;  // Prefisso dell'architettura nel target triple
+    unsigned MulCost;        // Costo di una mul
+    unsigned VecMulCost;     // Costo di una mul vettoriale (es. pmulld su x86)
+    unsigned AddCost;        // Costo di una add/sub
+    unsigned ShiftCost;      // Costo di uno shift
+    unsigned MaxFusedShift;  // Shift massimo "gratuito" su un operando di una add (lea, add con shift)
+    bool FusedShiftSub;      // Lo shift gratuito vale anche per la sub
+};
+
+// Tabella dei costi per target, l'ultima riga è quella di default
+static const MulCostModel MulCostTable[] = {
+    {"x86_64",  3, 10, 1, 1, 3, false},  // lea (x + y * {2,4,8})
+    {"i686",    3, 10, 1, 1, 3, false},
+    {"i386",    3, 10, 1, 1, 3, false},
+    {"aarch64", 3, 4, 1, 1, 63, true},   // add/sub con operando shiftato
+    {"arm64",   3, 4, 1, 1, 63, true},
+    {"arm",     2, 4, 1, 1, 31, true},
+    {"thumb",   2, 4, 1, 1, 31, true},
+    {"riscv",   4, 4, 1, 1, 0, false},
+    {"",        3, 4, 1, 1, 0, false},
+};
+
+// Funzione di supporto che sceglie la riga della tabella dei costi in base al target triple del modulo
+static const MulCostModel &getMulCostModel(const Module *M) {
+    StringRef Arch = M ? StringRef(M->getTargetTriple()).split('-').first : StringRef();
+    for (const MulCostModel &Model : MulCostTable) {
+        StringRef Prefix(Model.ArchPrefix);
+        if (Arch.take_front(Prefix.size()) == Prefix)
+            return Model;
+    }
+    llvm_unreachable("La tabella dei costi deve terminare con la riga di default");
+}
+
+// Passo di una sequenza di moltiplicazione. I valori sono numerati: 0 è x, il passo i produce il valore i + 1.
+//   Shl: v[LHS] << LShift
+//   Add: (v[LHS] << LShift) + (v[RHS] << RShift)
+//   Sub: (v[LHS] << LShift) - (v[RHS] << RShift), con LHS = -1 per indicare lo zero (negazione)
+struct MulStep {
+    unsigned Opcode;
+    int LHS;
+    int RHS;
+    unsigned LShift;
+    unsigned RShift;
+};
+
+struct MulRecipe {
+    SmallVector<MulStep, 8> Steps;
+    unsigned Cost = 0;
+    bool Valid = false;
+};
+
+class MulSynthesizer {
+public:
+    explicit MulSynthesizer(const MulCostModel &Model) : Model(Model) {}
+
+    // Ritorna la sequenza più economica per C, se costa meno di una mul (scalare o vettoriale).
+    // Le istruzioni vettoriali costano per il modello quanto le scalari: cambia solo il costo della mul
+    const MulRecipe *getRecipe(const APInt &C, bool IsVector) {
+        const MulRecipe &Best = findBest(C, /*Depth=*/2);
+        if (!Best.Valid || Best.Cost >= (IsVector ? Model.VecMulCost : Model.MulCost))
+            return nullptr;
+        return &Best;
+    }
+
+    // Genera le istruzioni della sequenza prima del punto di inserimento del Builder
+    static Value *emit(const MulRecipe &Recipe, Value *X, IRBuilderBase &Builder) {
+        SmallVector<Value*, 8> Values;
+        Values.push_back(X);
+
+        auto shifted = [&](int Index, unsigned Shift) -> Value* {
+            Value *V = Index < 0 ? Constant::getNullValue(X->getType()) : Values[Index];
+            return Shift ? Builder.CreateShl(V, Shift) : V;
+        };
+
+        for (const MulStep &Step : Recipe.Steps) {
+            Value *LHS = shifted(Step.LHS, Step.LShift);
+            if (Step.Opcode == Instruction::Shl)
+                Values.push_back(LHS);
+            else if (Step.Opcode == Instruction::Add)
+                Values.push_back(Builder.CreateAdd(LHS, shifted(Step.RHS, Step.RShift)));
+            else
+                Values.push_back(Builder.CreateSub(LHS, shifted(Step.RHS, Step.RShift)));
+        }
+        return Values.back();
+    }
+
+private:
+    const MulCostModel &Model;
+    DenseMap<APInt, MulRecipe> Cache;
+
+    // Costo di un passo, tenendo conto dello shift che il target può fondere con la add/sub
+    unsigned stepCost(const MulStep &Step) const {
+        if (Step.Opcode == Instruction::Shl)
+            return Model.ShiftCost;
+
+        unsigned Cost = Model.AddCost;
+        unsigned Shifts[] = {Step.LHS >= 0 ? Step.LShift : 0, Step.RShift};
+        bool Fused = false;
+        for (unsigned Shift : Shifts) {
+            if (!Shift)
+                continue;
+            bool CanFuse = Shift <= Model.MaxFusedShift &&
+                           (Step.Opcode == Instruction::Add || Model.FusedShiftSub);
+            if (CanFuse && !Fused)
+                Fused = true;
+            else
+                Cost += Model.ShiftCost;
+        }
+        return Cost;
+    }
 
-            // Se entrambe le costanti sono nulle, ignora l'istruzione
-            if (!x && !y) {
+    void append(MulRecipe &Recipe, MulStep Step) {
+        Recipe.Cost += stepCost(Step);
+        Recipe.Steps.push_back(Step);
+    }
+
+    static bool isBetter(const MulRecipe &Candidate, const MulRecipe &Best) {
+        if (!Candidate.Valid)
+            return false;
+        if (!Best.Valid || Candidate.Cost < Best.Cost)
+            return true;
+        return Candidate.Cost == Best.Cost && Candidate.Steps.size() < Best.Steps.size();
+    }
+
+    // Sequenza ottenuta dalla rappresentazione NAF di C (cifre in {-1, 0, 1}, mai due non nulle adiacenti)
+    MulRecipe buildNAF(const APInt &C) {
+        unsigned W = C.getBitWidth();
+        SmallVector<std::pair<unsigned, bool>, 16> Terms; // (posizione, negativo)
+
+        // Le cifre in posizione >= W spariscono perché si lavora modulo 2^W
+        APInt Rest = C.zext(W + 1);
+        for (unsigned Pos = 0; Pos < W && !Rest.isZero(); ++Pos, Rest.lshrInPlace(1)) {
+            if (!Rest[0])
                 continue;
+            bool Negative = Rest[1]; // ...11 -> cifra -1 con riporto
+            Terms.push_back({Pos, Negative});
+            if (Negative)
+                Rest += 1;
+            else
+                Rest -= 1;
+        }
+
+        MulRecipe Recipe;
+        if (Terms.empty())
+            return Recipe;
+
+        // Si parte da un termine positivo, se esiste, per evitare una negazione iniziale
+        auto First = std::find_if(Terms.rbegin(), Terms.rend(),
+                                  [](const std::pair<unsigned, bool> &T) { return !T.second; });
+        int Acc = 0;
+        if (First == Terms.rend()) {
+            append(Recipe, {Instruction::Sub, -1, 0, 0, Terms.back().first});
+            Terms.pop_back();
+        } else {
+            unsigned Pos = First->first;
+            Terms.erase(std::next(First).base());
+            if (Terms.empty()) {
+                if (Pos)
+                    append(Recipe, {Instruction::Shl, 0, -1, Pos, 0});
+                Recipe.Valid = true;
+                return Recipe;
             }
+            // Il primo termine viene fuso nel primo passo di add/sub
+            auto Next = Terms.back();
+            Terms.pop_back();
+            append(Recipe, {Next.second ? Instruction::Sub : Instruction::Add, 0, 0, Pos, Next.first});
+        }
+        Acc = Recipe.Steps.size();
 
-            if (binOp->getOpcode() == Instruction::Mul) { // L'istruzione è una MOLTIPIPLICAZIONE
-                if (x != nullptr) {
-                    outs() << "L'operando " << *x << " è costante\n";
-
-                    // PASSO 1.2 - SLIDE 05
-                    // Controllo se il valore costante è pari a 1 -> algebraic identity
-                    if (x->isOne()){
-                        outs() <<"L'operando "<< *x <<" vale 1\n";
-                        I->replaceAllUsesWith(op2);
-                        delStack.push(I);
-
-                        outs() << "Applicata algebraic identity\n";
-                        algebraic_identity_count++;
-                    }
-                    else{ // Caso della strength reduction
-                        APInt val = x->getValue();
-
-                        // Se il valore della costante x è una potenza di 2, allora è candidata per lo shift
-                        if (val.isPowerOf2()) {
-                            // Creo una nuova costante per definire di quanto sarà lo shift (log base 2 di val)
-                            ConstantInt *constantShift = ConstantInt::get(Type::getInt32Ty(context), val.logBase2());
-
-                            outs() <<"L'operaando "<< *x <<" è una potenza di 2\n";
-
-                            // Creo la nuova istruzione di shift
-                            Instruction *newInst = BinaryOperator::Create(Instruction::Shl, op2, constantShift);
-
-                            // Rimpiazzo e aggiorno gli usi
-                            newInst->insertAfter(&instIter);
-                            I->replaceAllUsesWith(newInst);
-                            delStack.push(I);
-
-                            outs() << "Applicata strength reduction\n";
-                            strength_reduction_count++;
-                        }
-                        else{
-                            // Calcolo il valore del log più vicino (sotraggo 1 perché viene arrotondato sempre per eccesso)
-                            Value* constantShift = Builder.getInt32(val.nearestLogBase2()-1);
-
-                            // Creo l'istruzione di shift
-                            Instruction *newInstShl = BinaryOperator::Create(Instruction::Shl, op2, constantShift);
-
-                            // Creo l'istruzione di sottrazione
-                            Instruction *newInstSub = BinaryOperator::Create(Instruction::Sub, newInstShl, op2);
-
-                            // Rimpiazzo e aggiorno gli usi
-                            newInstShl->insertAfter(&instIter);
-                            newInstSub->insertAfter(newInstShl);
-                            I->replaceAllUsesWith(newInstSub);
-                            delStack.push(I);
-
-                            outs() << "Applicata strength reduction\n";
-                            strength_reduction_count++;
-                        }
-                    }   
-                } 
-                else if (y != nullptr) {
-                    if (y->isOne()){
-                        outs() <<"L'operando "<< *y <<" vale 1\n";
-                        I->replaceAllUsesWith(op1);
-                        delStack.push(I);
-
-                        outs() << "Applicata algebraic identity\n";
-                        algebraic_identity_count++;
-                    }
-                    else{
-                        APInt val = y->getValue();
-                        outs() << "L'operando " << *y << " è costante\n";
-
-                        // Se il valore della costante y è una potenza di 2, allora è candidata per lo shift
-                        if (val.isPowerOf2()) {
-                            // Creo una nuova costante per definire di quanto sarà lo shift (log base 2 di val)
-                            ConstantInt *constantShift = ConstantInt::get(Type::getInt32Ty(context), val.logBase2());
-
-                            outs() <<"L'operando "<< *y <<" è una potenza di 2\n";
-                            // Creo la nuova istruzione di shift
-                            Instruction *newInst = BinaryOperator::Create(Instruction::Shl, op1, constantShift);
-
-                            // Rimpiazzo e aggiorno gli usi
-                            newInst->insertAfter(&instIter);
-                            I->replaceAllUsesWith(newInst);
-                            delStack.push(I);
-
-                            outs() << "Applicata strength reduction\n";
-                            strength_reduction_count++;
-                        }
-                        else{
-                            // Calcolo il valore del log più vicino (sotraggo 1 perché viene arrotondato sempre per eccesso)
-                            Value* constantShift = Builder.getInt32(val.nearestLogBase2()-1);
-
-                            // Creo l'istruzione di shift
-                            Instruction *newInstShl = BinaryOperator::Create(Instruction::Shl, op1, constantShift);
-
-                            // Creo l'istruzione di sottrazione
-                            Instruction *newInstSub = BinaryOperator::Create(Instruction::Sub, newInstShl, op1);
-
-                            // Rimpiazzo e aggiorno gli usi
-                            newInstShl->insertAfter(&instIter);
-                            newInstSub->insertAfter(newInstShl);
-                            I->replaceAllUsesWith(newInstSub);
-                            delStack.push(I);
-
-                            outs() << "Applicata strength reduction\n";
-                            strength_reduction_count++;
-                        }
-                    }
-                }
-            }// Fine if per binary instruction mul
-            else if (binOp->getOpcode() == Instruction::Add){ // L'istruzione è una ADDIZIONE
-                // PASSO 1.1 - SLIDE 05
-                // Controllo se siamo nel caso della ALGEBRAIC IDENTIITY: x + 0 = 0 + x = x
-                if (x != nullptr){
-                    outs() << "L'operando " << *x << " è costante\n";
-
-                    if (x->isZero()){
-                        outs() << "L'operando "<< *x << " vale 0\n";
-
-                        I->replaceAllUsesWith(op2);
-                        delStack.push(I);
-
-                        outs() << "Applicata algebraic identity\n";
-                        algebraic_identity_count++;
-                    }
-                }
-                else if (y != nullptr){
-                    outs() << "L'operando " << *y << " è costante\n";
-
-                    if (y->isZero()){
-                        outs() << "L'operando "<< *y << " vale 0\n";
-
-                        I->replaceAllUsesWith(op1);
-                        delStack.push(I);
-
-                        outs() << "Applicata algebraic identity\n";
-                        algebraic_identity_count++;
-                    } 
-                    // PUNTO 3 - SLIDE 05
-                    // Dobbiamo trovare delle istruzioni in cui sia possibile applicare la MULTI INSTRUCTION OPTIMIZATION
-                    // a = b + 1, c = a -1 -> a = b + 1, c = b   
-                    else{
-                        // Scorro per tutti gli user
-                        for (auto userIter = I->user_begin(); userIter != I->user_end(); ++userIter){
-                            if (Instruction *userInst = dyn_cast<Instruction>(*userIter)){
-                                // Controllo che esta una istruzione SUB del tipo c = a - 1
-                                if (userInst->getOpcode() == Instruction::Sub){
-                                    outs() << "Primo operando: "<<*(userInst->getOperand(0))<<"\n";
-                                    if (userInst->getOperand(0) == I){
-                                        if (ConstantInt *constUser = dyn_cast<ConstantInt>(userInst->getOperand(1))){
-                                            if (y->equalsInt(constUser->getZExtValue())){
-                                                // Sostituisco userInst con l'operando di instIter
-                                                userInst->replaceAllUsesWith(I->getOperand(0));
-                                                
-                                                outs() << "Applicata Multi-Instruction Opt\n";
-                                                multi_instr_opt_count++;
-                                            }
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
+        for (auto It = Terms.rbegin(); It != Terms.rend(); ++It) {
+            append(Recipe, {It->second ? Instruction::Sub : Instruction::Add, Acc, 0, 0, It->first});
+            Acc = Recipe.Steps.size();
+        }
+
+        Recipe.Valid = true;
+        return Recipe;
+    }
+
+    const MulRecipe &findBest(const APInt &C, unsigned Depth) {
+        auto Cached = Cache.find(C);
+        if (Cached != Cache.end())
+            return Cached->second;
+
+        MulRecipe Best;
+        if (C.isOne()) {
+            Best.Valid = true;
+            return Cache[C] = Best;
+        }
+        if (C.isZero())
+            return Cache[C] = Best;
+
+        // Candidato 1: rappresentazione NAF
+        Best = buildNAF(C);
+
+        // Candidato 2: C = C' * 2^k, si calcola x * C' e poi si shifta
+        unsigned TZ = C.countr_zero();
+        if (TZ && !C.isPowerOf2()) {
+            MulRecipe Candidate = findBest(C.lshr(TZ), Depth);
+            if (Candidate.Valid) {
+                append(Candidate, {Instruction::Shl, (int)Candidate.Steps.size(), -1, TZ, 0});
+                if (isBetter(Candidate, Best))
+                    Best = Candidate;
+            }
+        }
+
+        // Candidato 3: C = (2^k +- 1) * C', il prodotto parziale r = x * C' viene riusato
+        unsigned W = C.getBitWidth();
+        for (unsigned K = 1; Depth > 0 && K < W; ++K) {
+            APInt Pow = APInt::getOneBitSet(W, K);
+            for (bool Plus : {true, false}) {
+                APInt Factor = Plus ? Pow + 1 : Pow - 1;
+                if (Factor.ule(1) || Factor == C || !C.urem(Factor).isZero())
+                    continue;
+
+                MulRecipe Candidate = findBest(C.udiv(Factor), Depth - 1);
+                if (!Candidate.Valid)
+                    continue;
+                int R = Candidate.Steps.size();
+                append(Candidate, {Plus ? Instruction::Add : Instruction::Sub, R, R, K, 0});
+                if (isBetter(Candidate, Best))
+                    Best = Candidate;
+            }
+        }
+
+        return Cache[C] = Best;
+    }
+};
+
+// ---------------------------------------------------------------------------
+// RIASSOCIAZIONE
+// Le catene di add/sub, mul, and, or e xor del blocco vengono appiattite in
+// una lista di termini più una costante: le costanti vengono piegate, i
+// termini opposti si cancellano (x - x, x ^ x, x & ~x, ...) e la catena viene
+// riscritta solo se la nuova forma richiede meno istruzioni. I nodi interni
+// della catena devono avere un solo uso, altrimenti verrebbero duplicati.
+// ---------------------------------------------------------------------------
+
+// Catena appiattita
+struct FlatExpr {
+    unsigned Opcode;                // Add (anche per le sub), Mul, And, Or o Xor
+    MapVector<Value*, APInt> Terms; // Termine -> coefficiente (add/sub) o molteplicità (mul/and/or/xor)
+    APInt Constant;                 // Costante piegata
+    unsigned NumNodes = 0;          // Istruzioni della catena (radice compresa)
+    bool AllNSW = true;             // Tutti i nodi hanno nsw
+    bool AllNUW = true;             // Tutti i nodi hanno nuw
+    bool HasSub = false;            // Nella catena compare almeno una sub
+    bool ConstantOverflowS = false; // Il piegamento delle costanti ha avuto overflow con segno
+    bool ConstantOverflowU = false; // Il piegamento delle costanti ha avuto overflow senza segno
+};
+
+// Funzione di supporto che stabilisce se V è un nodo interno della catena con radice nel blocco B
+static BinaryOperator *getChainNode(Value *V, unsigned Opcode, BasicBlock *B) {
+    auto *binOp = dyn_cast<BinaryOperator>(V);
+    if (!binOp || binOp->getParent() != B || !binOp->hasOneUse())
+        return nullptr;
+    unsigned NodeOpcode = binOp->getOpcode();
+    if (Opcode == Instruction::Add)
+        return NodeOpcode == Instruction::Add || NodeOpcode == Instruction::Sub ? binOp : nullptr;
+    return NodeOpcode == Opcode ? binOp : nullptr;
+}
+
+// Funzione di supporto che aggiunge alla catena E i flag del nodo Node
+static void accountChainNode(BinaryOperator *Node, FlatExpr &E) {
+    E.NumNodes++;
+    if (isa<OverflowingBinaryOperator>(Node)) {
+        E.AllNSW &= Node->hasNoSignedWrap();
+        E.AllNUW &= Node->hasNoUnsignedWrap();
+    }
+    E.HasSub |= Node->getOpcode() == Instruction::Sub;
+}
+
+// Funzione di supporto che appiattisce la catena con radice Root in E. La visita usa uno stack esplicito
+// (le catene generate possono essere lunghissime) e tocca gli operandi in preordine da sinistra a destra,
+// come farebbe la ricorsione. Il booleano di ogni operando indica che compare con segno meno (solo per add/sub)
+static void flattenChain(BinaryOperator *Root, FlatExpr &E) {
+    SmallVector<std::pair<Value*, bool>, 16> stack;
+    auto pushOperands = [&](BinaryOperator *Node, bool Negate) {
+        accountChainNode(Node, E);
+        bool IsSub = Node->getOpcode() == Instruction::Sub;
+        stack.push_back({Node->getOperand(1), Negate ^ IsSub});
+        stack.push_back({Node->getOperand(0), Negate});
+    };
+    pushOperands(Root, /*Negate=*/false);
+
+    while (!stack.empty()) {
+        Value *Op = stack.back().first;
+        bool OpNegate = stack.back().second;
+        stack.pop_back();
+
+        if (BinaryOperator *Child = getChainNode(Op, E.Opcode, Root->getParent())) {
+            pushOperands(Child, OpNegate);
+            continue;
+        }
+        const APInt *C;
+        if (match(Op, m_APInt(C))) {
+            bool Overflow = false;
+            switch (E.Opcode) {
+            case Instruction::Add:
+                if (OpNegate) {
+                    E.Constant = E.Constant.ssub_ov(*C, Overflow);
+                    E.ConstantOverflowU = true; // La sub di una costante non è gestita con nuw
+                } else {
+                    bool OverflowU = false;
+                    (void)E.Constant.uadd_ov(*C, OverflowU);
+                    E.ConstantOverflowU |= OverflowU;
+                    E.Constant = E.Constant.sadd_ov(*C, Overflow);
                 }
-            } // Fine if per binary instruction add
-            else if (binOp->getOpcode() == Instruction::SDiv){ // L'istruzione è una DIVISIONE
-                // PUNTO 2.2 - SLIDE 05
-                // STRENGTH REDUCTION: x/8 = x >> 3
-                if (y != nullptr){
-                    APInt val = y->getValue();
-
-                    // Se val è una potenza del 2, allora posso applicare la strength reduction
-                    if (val.isPowerOf2()){
-                        ConstantInt *constantShift = ConstantInt::get(Type::getInt32Ty(context), val.logBase2());
-
-                        // Creo la nuova istruzione di shift verso destra
-                        Instruction *newInst = BinaryOperator::Create(Instruction::LShr, op1, constantShift);
-
-                        // Rimpiazzo e aggiorno gli usi
-                        newInst->insertAfter(&instIter);
-                        I->replaceAllUsesWith(newInst);
-                        delStack.push(I);
-
-                        outs() << "Applicata strength reduction\n";
-                        strength_reduction_count++;
-                    }
+                break;
+            case Instruction::Mul: {
+                bool OverflowU = false;
+                (void)E.Constant.umul_ov(*C, OverflowU);
+                E.ConstantOverflowU |= OverflowU;
+                E.Constant = E.Constant.smul_ov(*C, Overflow);
+                break;
+            }
+            case Instruction::And: E.Constant &= *C; break;
+            case Instruction::Or: E.Constant |= *C; break;
+            case Instruction::Xor: E.Constant ^= *C; break;
+            }
+            E.ConstantOverflowS |= Overflow;
+            continue;
+        }
+
+        unsigned W = E.Constant.getBitWidth();
+        auto Inserted = E.Terms.insert({Op, APInt(W, 0)});
+        APInt &Coeff = Inserted.first->second;
+        if (OpNegate)
+            Coeff -= 1;
+        else
+            Coeff += 1;
+    }
+}
+
+// Funzione di supporto che genera (o, se Builder è nullo, solo conta) le istruzioni della catena appiattita.
+// Ritorna il numero di istruzioni necessarie
+static unsigned emitFlatExpr(const FlatExpr &E, Type *Ty, IRBuilderBase *Builder, Value **Result) {
+    unsigned W = E.Constant.getBitWidth();
+    unsigned Count = 0;
+    Value *Acc = nullptr;
+    bool HasAcc = false; // Serve anche quando si contano soltanto le istruzioni
+
+    auto constant = [&](const APInt &Val) -> Value* { return ConstantInt::get(Ty, Val); };
+
+    // Combina Acc con un nuovo operando; Acc nullo equivale all'elemento neutro
+    auto combine = [&](unsigned Opcode, Value *Op) {
+        if (!HasAcc && Opcode != Instruction::Sub) {
+            Acc = Op;
+            HasAcc = true;
+            return;
+        }
+        Count++;
+        if (Builder)
+            Acc = Builder->CreateBinOp((Instruction::BinaryOps)Opcode, HasAcc ? Acc : constant(APInt(W, 0)), Op);
+        HasAcc = true;
+    };
+
+    if (E.Opcode == Instruction::Add) {
+        // Prima i termini con coefficiente positivo, così la prima add è "gratuita"
+        SmallVector<std::pair<Value*, APInt>, 8> Positive, Negative;
+        for (const auto &Term : E.Terms) {
+            if (Term.second.isZero())
+                continue;
+            if (Term.second.isNegative() && !Term.second.isMinSignedValue())
+                Negative.push_back({Term.first, -Term.second});
+            else
+                Positive.push_back(Term);
+        }
+
+        auto scaled = [&](Value *V, const APInt &Coeff) -> Value* {
+            if (Coeff.isOne())
+                return V;
+            Count++;
+            return Builder ? Builder->CreateMul(V, constant(Coeff)) : nullptr;
+        };
+
+        for (const auto &Term : Positive)
+            combine(Instruction::Add, scaled(Term.first, Term.second));
+
+        bool ConstantUsed = false;
+        for (const auto &Term : Negative) {
+            Value *Op = scaled(Term.first, Term.second);
+            // Se non c'è ancora un accumulatore, la costante fa da minuendo: K - x
+            if (!HasAcc && !E.Constant.isZero()) {
+                Acc = Builder ? constant(E.Constant) : nullptr;
+                HasAcc = true;
+                ConstantUsed = true;
+            }
+            combine(Instruction::Sub, Op);
+        }
+
+        if (!ConstantUsed && !E.Constant.isZero())
+            combine(Instruction::Add, constant(E.Constant));
+        if (!HasAcc && Builder)
+            Acc = constant(E.Constant);
+    } else {
+        unsigned Opcode = E.Opcode;
+
+        // Costanti assorbenti: x * 0 = 0, x & 0 = 0, x | -1 = -1
+        bool Absorbing = (Opcode != Instruction::Or && Opcode != Instruction::Xor && E.Constant.isZero()) ||
+                         (Opcode == Instruction::Or && E.Constant.isAllOnes());
+
+        // Termini opposti: x & ~x = 0, x | ~x = -1
+        if (!Absorbing && (Opcode == Instruction::And || Opcode == Instruction::Or)) {
+            for (const auto &Term : E.Terms) {
+                Value *NotOp;
+                if (match(Term.first, m_Not(m_Value(NotOp))) && E.Terms.count(NotOp)) {
+                    Absorbing = true;
+                    break;
                 }
-            } // Fine if per binary instruction div         
+            }
+        }
+
+        if (Absorbing) {
+            if (Builder)
+                Acc = Opcode == Instruction::Or ? constant(APInt::getAllOnes(W)) : constant(APInt(W, 0));
+        } else {
+            for (const auto &Term : E.Terms) {
+                // and/or sono idempotenti, nello xor un termine ripetuto un numero pari di volte si cancella
+                unsigned Repeat = Term.second.getZExtValue();
+                if (Opcode == Instruction::And || Opcode == Instruction::Or)
+                    Repeat = 1;
+                else if (Opcode == Instruction::Xor)
+                    Repeat &= 1;
+                for (unsigned R = 0; R < Repeat; ++R)
+                    combine(Opcode, Term.first);
+            }
+
+            // Costanti neutre: x * 1, x & -1, x | 0, x ^ 0
+            bool Neutral = (Opcode == Instruction::Mul && E.Constant.isOne()) ||
+                           (Opcode == Instruction::And && E.Constant.isAllOnes()) ||
+                           ((Opcode == Instruction::Or || Opcode == Instruction::Xor) && E.Constant.isZero());
+            if (!Neutral)
+                combine(Opcode, constant(E.Constant));
+            if (!HasAcc && Builder)
+                Acc = constant(E.Constant);
+        }
+    }
+
+    if (Result)
+        *Result = Acc;
+    return Count;
+}
+
+// Funzione di supporto che riassocia la catena con radice Root.
+// Ritorna il valore che sostituisce la radice, oppure nullptr se la catena non si semplifica
+static Value *reassociateChain(BinaryOperator &Root, IRBuilderBase &Builder) {
+    unsigned Opcode = Root.getOpcode();
+    if (Opcode == Instruction::Sub)
+        Opcode = Instruction::Add;
+    if (Opcode != Instruction::Add && Opcode != Instruction::Mul && Opcode != Instruction::And &&
+        Opcode != Instruction::Or && Opcode != Instruction::Xor)
+        return nullptr;
+
+    // Solo le radici: un nodo interno viene appiattito insieme alla catena del suo unico user, e
+    // riassociarlo da solo renderebbe quadratico il lavoro su una catena lunga
+    if (Root.hasOneUse()) {
+        auto *User = dyn_cast<BinaryOperator>(Root.user_back());
+        if (User && getChainNode(&Root, Opcode, Root.getParent())) {
+            unsigned UserOpcode = User->getOpcode() == Instruction::Sub ? Instruction::Add : User->getOpcode();
+            if (UserOpcode == Opcode && User->getParent() == Root.getParent())
+                return nullptr;
+        }
+    }
+
+    Type *Ty = Root.getType();
+    unsigned W = Ty->getScalarSizeInBits();
+
+    FlatExpr E;
+    E.Opcode = Opcode;
+    switch (Opcode) {
+    case Instruction::Mul: E.Constant = APInt(W, 1); break;
+    case Instruction::And: E.Constant = APInt::getAllOnes(W); break;
+    default: E.Constant = APInt(W, 0); break;
+    }
+    flattenChain(&Root, E);
+
+    // La nuova forma deve costare strettamente meno della catena originale
+    unsigned NewCount = emitFlatExpr(E, Ty, nullptr, nullptr);
+    if (NewCount >= E.NumNodes)
+        return nullptr;
+
+    Value *Result = nullptr;
+    emitFlatExpr(E, Ty, &Builder, &Result);
+
+    // I flag nsw/nuw restano validi solo se valevano su tutta la catena, le costanti sono state
+    // piegate senza overflow e il risultato è una singola operazione su un solo termine
+    auto *NewInst = dyn_cast<BinaryOperator>(Result);
+    if (NewInst && NewCount == 1 && E.Terms.size() == 1 && isa<OverflowingBinaryOperator>(NewInst) &&
+        NewInst->getParent()) {
+        if (E.AllNSW && !E.ConstantOverflowS)
+            NewInst->setHasNoSignedWrap(true);
+        if (E.AllNUW && !E.ConstantOverflowU && !E.HasSub && NewInst->getOpcode() != Instruction::Sub)
+            NewInst->setHasNoUnsignedWrap(true);
+    }
+
+    return Result;
+}
+
+// ---------------------------------------------------------------------------
+// MOTORE DI REGOLE PEEPHOLE
+// Ogni regola è dichiarata in una tabella per opcode come coppia
+// (pattern PatternMatch, costruttore del valore sostitutivo). Gli operatori
+// commutativi vengono canonicalizzati una volta sola con la costante a destra,
+// quindi le regole considerano solo quel caso.
+// ---------------------------------------------------------------------------
+
+// Tipo di ottimizzazione applicata da una regola, usato per i contatori
+enum class RuleKind {
+    AlgebraicIdentity,
+    StrengthReduction,
+    DivisionByConstant,
+    MultiInstruction,
+    Reassociation,
+};
+
+// Contatori delle ottimizzazioni applicate su un basic block
+struct LocalOptsCounters {
+    int strength_reduction_count = 0;
+    int division_by_constant_count = 0;
+    int algebraic_identity_count = 0;
+    int multi_instr_opt_count = 0;
+    int reassociation_count = 0;
+
+    void record(RuleKind Kind) {
+        switch (Kind) {
+        case RuleKind::AlgebraicIdentity: algebraic_identity_count++; ++NumAlgebraicIdentity; break;
+        case RuleKind::StrengthReduction: strength_reduction_count++; ++NumStrengthReduction; break;
+        case RuleKind::DivisionByConstant: division_by_constant_count++; ++NumDivisionByConstant; break;
+        case RuleKind::MultiInstruction: multi_instr_opt_count++; ++NumMultiInstruction; break;
+        case RuleKind::Reassociation: reassociation_count++; ++NumReassociation; break;
+        }
+    }
+};
+
+// Nome della categoria di una regola, usato come nome del remark
+static const char *getRuleKindName(RuleKind Kind) {
+    switch (Kind) {
+    case RuleKind::AlgebraicIdentity: return "AlgebraicIdentity";
+    case RuleKind::StrengthReduction: return "StrengthReduction";
+    case RuleKind::DivisionByConstant: return "DivisionByConstant";
+    case RuleKind::MultiInstruction: return "MultiInstruction";
+    case RuleKind::Reassociation: return "Reassociation";
+    }
+    llvm_unreachable("categoria di regola sconosciuta");
+}
+
+// Valori catturati dal pattern di una regola e usati dal costruttore del valore sostitutivo
+struct RuleMatch {
+    Value *X = nullptr;
+    const APInt *C = nullptr;
+    const APInt *C2 = nullptr;
+    SmallVector<APInt, 4> Lanes; // Costante per corsia (vettori con costanti diverse tra le corsie)
+};
+
+// Strumenti a disposizione dei costruttori dei valori sostitutivi
+struct RuleContext {
+    IRBuilderBase &Builder;
+    MulSynthesizer &mulSynthesizer;
+    OptimizationRemarkEmitter &ORE;
+};
+
+struct PeepholeRule {
+    const char *Name;
+    RuleKind Kind;
+    // Pattern: ritorna true se l'istruzione ha la forma attesa, riempiendo RuleMatch
+    bool (*Match)(BinaryOperator &I, RuleMatch &M);
+    // Costruttore: ritorna il valore che sostituisce l'istruzione, o nullptr se la regola non conviene
+    Value *(*Build)(BinaryOperator &I, const RuleMatch &M, RuleContext &Ctx);
+};
+
+// Costruttori di uso comune
+static Value *buildX(BinaryOperator &, const RuleMatch &M, RuleContext &) {
+    return M.X;
+}
+
+static Value *buildZero(BinaryOperator &I, const RuleMatch &, RuleContext &) {
+    return Constant::getNullValue(I.getType());
+}
+
+static Value *buildMulByConstant(BinaryOperator &I, const RuleMatch &M, RuleContext &Ctx) {
+    const MulRecipe *recipe = Ctx.mulSynthesizer.getRecipe(*M.C, I.getType()->isVectorTy());
+    if (!recipe)
+        return nullptr;
+    LLVM_DEBUG(dbgs() << "Sequenza di " << recipe->Steps.size() << " passi, costo " << recipe->Cost << "\n");
+    return MulSynthesizer::emit(*recipe, M.X, Ctx.Builder);
+}
+
+static Value *buildDivisionByConstant(BinaryOperator &I, const RuleMatch &M, RuleContext &Ctx) {
+    return expandDivisionByConstant(&I, M.Lanes, Ctx.Builder);
+}
+
+// Pattern comune alle divisioni e ai resti: x op C, con C scalare, splat o costante per corsia
+static bool matchDivisionByConstant(BinaryOperator &I, RuleMatch &M) {
+    M.X = I.getOperand(0);
+    return getConstantLanes(I.getOperand(1), M.Lanes);
+}
+
+// Pattern per le costanti per corsia che sono tutte potenze di 2
+static bool matchPowerOf2Lanes(Value *V, RuleMatch &M) {
+    if (!getConstantLanes(V, M.Lanes))
+        return false;
+    for (const APInt &Lane : M.Lanes)
+        if (!Lane.isPowerOf2())
+            return false;
+    return true;
+}
+
+// PASSO 1.1 - SLIDE 05
+static const PeepholeRule AddRules[] = {
+    {"x + 0 = x", RuleKind::AlgebraicIdentity,
+     [](BinaryOperator &I, RuleMatch &M) { return match(&I, m_Add(m_Value(M.X), m_Zero())); },
+     buildX},
+    // PUNTO 3 - SLIDE 05: a = b - C, c = a + C -> c = b
+    {"(b - C) + C = b", RuleKind::MultiInstruction,
+     [](BinaryOperator &I, RuleMatch &M) {
+         return match(&I, m_Add(m_Sub(m_Value(M.X), m_APInt(M.C)), m_APInt(M.C2))) && *M.C == *M.C2;
+     },
+     buildX},
+};
+
+static const PeepholeRule SubRules[] = {
+    {"x - 0 = x", RuleKind::AlgebraicIdentity,
+     [](BinaryOperator &I, RuleMatch &M) { return match(&I, m_Sub(m_Value(M.X), m_Zero())); },
+     buildX},
+    {"x - x = 0", RuleKind::AlgebraicIdentity,
+     [](BinaryOperator &I, RuleMatch &M) { return match(&I, m_Sub(m_Value(M.X), m_Deferred(M.X))); },
+     buildZero},
+    // PUNTO 3 - SLIDE 05: a = b + C, c = a - C -> c = b (la add può non essere ancora canonicalizzata)
+    {"(b + C) - C = b", RuleKind::MultiInstruction,
+     [](BinaryOperator &I, RuleMatch &M) {
+         return match(&I, m_Sub(m_c_Add(m_Value(M.X), m_APInt(M.C)), m_APInt(M.C2))) && *M.C == *M.C2;
+     },
+     buildX},
+};
+
+// PASSO 1.2 e PUNTO 2.1 - SLIDE 05
+static const PeepholeRule MulRules[] = {
+    {"x * 1 = x", RuleKind::AlgebraicIdentity,
+     [](BinaryOperator &I, RuleMatch &M) { return match(&I, m_Mul(m_Value(M.X), m_One())); },
+     buildX},
+    {"x * 0 = 0", RuleKind::AlgebraicIdentity,
+     [](BinaryOperator &I, RuleMatch &M) { return match(&I, m_Mul(m_Value(M.X), m_Zero())); },
+     buildZero},
+    {"x * C = shift/add/sub", RuleKind::StrengthReduction,
+     [](BinaryOperator &I, RuleMatch &M) { return match(&I, m_Mul(m_Value(M.X), m_APInt(M.C))); },
+     buildMulByConstant},
+    // Vettori con una potenza di 2 diversa per corsia: x * <2, 8> = x << <1, 3>
+    {"x * <2^k...> = x << <k...>", RuleKind::StrengthReduction,
+     [](BinaryOperator &I, RuleMatch &M) {
+         M.X = I.getOperand(0);
+         return matchPowerOf2Lanes(I.getOperand(1), M);
+     },
+     [](BinaryOperator &I, const RuleMatch &M, RuleContext &Ctx) -> Value* {
+         SmallVector<APInt, 4> Shifts;
+         for (const APInt &Lane : M.Lanes)
+             Shifts.push_back(APInt(Lane.getBitWidth(), Lane.logBase2()));
+         return Ctx.Builder.CreateShl(M.X, getLanesConstant(I.getType(), Shifts));
+     }},
+};
+
+static const PeepholeRule AndRules[] = {
+    {"x & -1 = x", RuleKind::AlgebraicIdentity,
+     [](BinaryOperator &I, RuleMatch &M) { return match(&I, m_And(m_Value(M.X), m_AllOnes())); },
+     buildX},
+    {"x & 0 = 0", RuleKind::AlgebraicIdentity,
+     [](BinaryOperator &I, RuleMatch &M) { return match(&I, m_And(m_Value(M.X), m_Zero())); },
+     buildZero},
+    {"x & x = x", RuleKind::AlgebraicIdentity,
+     [](BinaryOperator &I, RuleMatch &M) { return match(&I, m_And(m_Value(M.X), m_Deferred(M.X))); },
+     buildX},
+};
+
+static const PeepholeRule OrRules[] = {
+    {"x | 0 = x", RuleKind::AlgebraicIdentity,
+     [](BinaryOperator &I, RuleMatch &M) { return match(&I, m_Or(m_Value(M.X), m_Zero())); },
+     buildX},
+    {"x | x = x", RuleKind::AlgebraicIdentity,
+     [](BinaryOperator &I, RuleMatch &M) { return match(&I, m_Or(m_Value(M.X), m_Deferred(M.X))); },
+     buildX},
+};
+
+static const PeepholeRule XorRules[] = {
+    {"x ^ 0 = x", RuleKind::AlgebraicIdentity,
+     [](BinaryOperator &I, RuleMatch &M) { return match(&I, m_Xor(m_Value(M.X), m_Zero())); },
+     buildX},
+    {"x ^ x = 0", RuleKind::AlgebraicIdentity,
+     [](BinaryOperator &I, RuleMatch &M) { return match(&I, m_Xor(m_Value(M.X), m_Deferred(M.X))); },
+     buildZero},
+};
+
+// Shift di 0 posizioni e catene di shift dello stesso tipo (vale per shl, lshr e ashr)
+static const PeepholeRule ShiftRules[] = {
+    {"x << 0 = x >> 0 = x", RuleKind::AlgebraicIdentity,
+     [](BinaryOperator &I, RuleMatch &M) { return match(&I, m_Shift(m_Value(M.X), m_Zero())); },
+     buildX},
+    // Ad esempio (x * 4) * 8, dopo la strength reduction della prima mul, diventa (x << 2) << 3 = x << 5
+    {"(x << C1) << C2 = x << (C1 + C2)", RuleKind::MultiInstruction,
+     [](BinaryOperator &I, RuleMatch &M) {
+         auto *inner = dyn_cast<BinaryOperator>(I.getOperand(0));
+         unsigned W = I.getType()->getScalarSizeInBits();
+         return inner && inner->getOpcode() == I.getOpcode() &&
+                match(inner, m_Shift(m_Value(M.X), m_APInt(M.C))) && match(I.getOperand(1), m_APInt(M.C2)) &&
+                M.C->ult(W) && M.C2->ult(W);
+     },
+     [](BinaryOperator &I, const RuleMatch &M, RuleContext &Ctx) -> Value* {
+         unsigned W = I.getType()->getScalarSizeInBits();
+         uint64_t Total = M.C->getZExtValue() + M.C2->getZExtValue();
+         if (Total < W)
+             return Ctx.Builder.CreateBinOp(I.getOpcode(), M.X, ConstantInt::get(I.getType(), Total));
+         // Shift di tutti i bit: shl e lshr danno 0, ashr replica il bit di segno
+         if (I.getOpcode() == Instruction::AShr)
+             return Ctx.Builder.CreateAShr(M.X, W - 1);
+         return Constant::getNullValue(I.getType());
+     }},
+};
+
+// PUNTO 2.2 - SLIDE 05
+static const PeepholeRule UDivRules[] = {
+    {"x /u 1 = x", RuleKind::AlgebraicIdentity,
+     [](BinaryOperator &I, RuleMatch &M) { return match(&I, m_UDiv(m_Value(M.X), m_One())); },
+     buildX},
+    {"x /u C = mulhi/shift", RuleKind::DivisionByConstant, matchDivisionByConstant, buildDivisionByConstant},
+};
+
+static const PeepholeRule URemRules[] = {
+    {"x %u 2^k = x & (2^k - 1)", RuleKind::DivisionByConstant,
+     [](BinaryOperator &I, RuleMatch &M) {
+         M.X = I.getOperand(0);
+         return matchPowerOf2Lanes(I.getOperand(1), M);
+     },
+     [](BinaryOperator &I, const RuleMatch &M, RuleContext &Ctx) -> Value* {
+         SmallVector<APInt, 4> Masks;
+         for (const APInt &Lane : M.Lanes)
+             Masks.push_back(Lane - 1);
+         return Ctx.Builder.CreateAnd(M.X, getLanesConstant(I.getType(), Masks));
+     }},
+    {"x %u C = x - (x /u C) * C", RuleKind::DivisionByConstant, matchDivisionByConstant, buildDivisionByConstant},
+};
+
+static const PeepholeRule SignedDivRemRules[] = {
+    {"x /s C, x %s C = mulhi/shift", RuleKind::DivisionByConstant, matchDivisionByConstant, buildDivisionByConstant},
+};
+
+// Funzione di supporto che ritorna le sole regole che possono applicarsi all'opcode dato
+static ArrayRef<PeepholeRule> getRulesForOpcode(unsigned Opcode) {
+    switch (Opcode) {
+    case Instruction::Add: return AddRules;
+    case Instruction::Sub: return SubRules;
+    case Instruction::Mul: return MulRules;
+    case Instruction::And: return AndRules;
+    case Instruction::Or: return OrRules;
+    case Instruction::Xor: return XorRules;
+    case Instruction::Shl:
+    case Instruction::LShr:
+    case Instruction::AShr: return ShiftRules;
+    case Instruction::UDiv: return UDivRules;
+    case Instruction::URem: return URemRules;
+    case Instruction::SDiv:
+    case Instruction::SRem: return SignedDivRemRules;
+    default: return {};
+    }
+}
+
+// Funzione di supporto che porta la costante a destra negli operatori commutativi.
+// Ritorna true se gli operandi sono stati scambiati
+static bool canonicalizeOperands(BinaryOperator &I) {
+    if (I.isCommutative() && isa<Constant>(I.getOperand(0)) && !isa<Constant>(I.getOperand(1))) {
+        I.swapOperands();
+        return true;
+    }
+    return false;
+}
+
+// Funzione di supporto che emette il remark di una trasformazione applicata a I.
+// Il messaggio viene costruito solo se i remark del passo sono abilitati
+static void emitRuleRemark(OptimizationRemarkEmitter &ORE, BinaryOperator &I, RuleKind Kind, const char *RuleName) {
+    ORE.emit([&]() {
+        return OptimizationRemark(DEBUG_TYPE, getRuleKindName(Kind), &I)
+               << "applicata la regola " << ore::NV("Rule", RuleName)
+               << " a " << ore::NV("Opcode", I.getOpcodeName());
+    });
+}
+
+// Funzione di supporto che prova ad ottimizzare una singola istruzione binaria con le regole del suo opcode.
+// Ritorna il valore che sostituisce l'istruzione, oppure nullptr se non c'è nulla da fare.
+// Le eventuali nuove istruzioni vengono create con Builder subito prima di binOp.
+static Value *optimizeInstruction(BinaryOperator *binOp, RuleContext &Ctx, LocalOptsCounters &counters) {
+    // Le regole gestiscono interi di qualsiasi ampiezza e vettori di interi
+    if (!binOp->getType()->isIntOrIntVectorTy())
+        return nullptr;
+
+    // Le nuove istruzioni vengono inserite subito prima dell'istruzione da sostituire
+    Ctx.Builder.SetInsertPoint(binOp);
+
+    for (const PeepholeRule &Rule : getRulesForOpcode(binOp->getOpcode())) {
+        RuleMatch M;
+        if (!Rule.Match(*binOp, M))
+            continue;
+
+        if (Value *newVal = Rule.Build(*binOp, M, Ctx)) {
+            LLVM_DEBUG(dbgs() << "Applicata regola: " << Rule.Name << "\n");
+            counters.record(Rule.Kind);
+            emitRuleRemark(Ctx.ORE, *binOp, Rule.Kind, Rule.Name);
+            return newVal;
         }
     }
 
-    outs() << "---Inizio eliminazione istruzioni---\n";
-    while (!delStack.empty()) {
-        outs() << "Elimino l'istruzione: "<< *(delStack.top()) <<"\n";
-        delStack.top()->eraseFromParent();
-        delStack.pop();
+    // Se nessuna regola si applica, provo a riassociare la catena di cui l'istruzione è radice
+    if (Value *newVal = reassociateChain(*binOp, Ctx.Builder)) {
+        LLVM_DEBUG(dbgs() << "Applicata riassociazione\n");
+        counters.record(RuleKind::Reassociation);
+        emitRuleRemark(Ctx.ORE, *binOp, RuleKind::Reassociation, "reassociate-chain");
+        return newVal;
+    }
+
+    return nullptr;
+}
+
+// Funzione di supporto che elimina un'istruzione diventata morta, rimettendo nella worklist
+// gli operandi del blocco che potrebbero essere diventati morti a loro volta
+static void eraseDeadInstruction(Instruction *I, BasicBlock &B, InstructionWorklist &worklist) {
+    LLVM_DEBUG(dbgs() << "Elimino l'istruzione: "<< *I <<"\n");
+    for (Value *op : I->operands()){
+        if (auto *opInst = dyn_cast<Instruction>(op))
+            if (opInst->getParent() == &B)
+                worklist.push(opInst);
+    }
+    worklist.remove(I);
+    I->eraseFromParent();
+    ++NumDeadErased;
+}
+
+bool runOnBasicBlock2(BasicBlock &B, OptimizationRemarkEmitter &ORE) {
+    LLVMContext &context = B.getContext();
+
+    // Worklist delle istruzioni da (ri)visitare. Una riscrittura rimette in lista gli user
+    // dell'istruzione sostituita e le nuove istruzioni create, finché non si raggiunge un punto fisso.
+    InstructionWorklist worklist;
+
+    // Ogni istruzione creata dal Builder viene aggiunta automaticamente alla worklist
+    IRBuilder<ConstantFolder, IRBuilderCallbackInserter> Builder(
+        context, ConstantFolder(), IRBuilderCallbackInserter([&worklist](Instruction *newInst) {
+            worklist.add(newInst);
+        }));
+
+    // Sintetizzatore delle moltiplicazioni per costante, con i costi del target del modulo
+    MulSynthesizer mulSynthesizer(getMulCostModel(B.getModule()));
+
+    // Le variabili seguenti servono come indice di controllo
+    LocalOptsCounters counters;
+    RuleContext ctx{Builder, mulSynthesizer, ORE};
+    bool Changed = false;
+
+    // Inserisco le istruzioni al contrario, così vengono estratte nell'ordine del programma
+    worklist.reserve(B.size());
+    for (Instruction &instIter : reverse(B))
+        worklist.push(&instIter);
+
+    LLVM_DEBUG(dbgs() << "---Iterazione sulla worklist del Basic Block:---\n");
+    while (!worklist.isEmpty()) {
+        // Le istruzioni create durante l'ultima riscrittura vengono visitate per prime
+        while (Instruction *deferred = worklist.popDeferred())
+            worklist.push(deferred);
+
+        Instruction *I = worklist.removeOne();
+        if (I == nullptr)
+            continue;
+
+        // Le istruzioni morte vengono eliminate subito
+        if (isInstructionTriviallyDead(I)) {
+            eraseDeadInstruction(I, B, worklist);
+            Changed = true;
+            continue;
+        }
+
+        // Controllo se sia una operazione binaria
+        auto *binOp = dyn_cast<BinaryOperator>(I);
+        if (!binOp)
+            continue;
+
+        LLVM_DEBUG(dbgs() << "Istruzione: " << *I << "\n");
+
+        // Canonicalizzazione degli operatori commutativi: costante a destra
+        if (canonicalizeOperands(*binOp))
+            Changed = true;
+
+        Value *newVal = optimizeInstruction(binOp, ctx, counters);
+        if (!newVal)
+            continue;
+
+        // Rimpiazzo e aggiorno gli usi: gli user vanno rivisitati perché potrebbero
+        // essere diventati a loro volta ottimizzabili
+        worklist.pushUsersToWorkList(*I);
+        I->replaceAllUsesWith(newVal);
+        eraseDeadInstruction(I, B, worklist);
+        Changed = true;
     }
 
     // Stampe di controllo delle variabili contatore
-    outs() << "Strength Reduction applicate: "<< strength_reduction_count << "\n";
-    outs() << "Algebraic Identity applicate: "<< algebraic_identity_count << "\n";
-    outs() << "Multi-Instruction Optimization applicate: "<< multi_instr_opt_count << "\n";
+    LLVM_DEBUG(dbgs() << "Strength Reduction applicate: "<< counters.strength_reduction_count << "\n");
+    LLVM_DEBUG(dbgs() << "Divisioni per costante ridotte: "<< counters.division_by_constant_count << "\n");
+    LLVM_DEBUG(dbgs() << "Algebraic Identity applicate: "<< counters.algebraic_identity_count << "\n");
+    LLVM_DEBUG(dbgs() << "Multi-Instruction Optimization applicate: "<< counters.multi_instr_opt_count << "\n");
+    LLVM_DEBUG(dbgs() << "Riassociazioni applicate: "<< counters.reassociation_count << "\n");
+
+    return Changed;
+}
+
+// ---------------------------------------------------------------------------
+// VALUE NUMBERING SU TUTTA LA FUNZIONE
+// Le espressioni pure vengono inserite in una tabella hash con scope, indicizzata
+// da opcode, tipo, flag e operandi (canonicalizzati per gli operatori
+// commutativi). I blocchi sono visitati in ordine di albero di dominanza:
+// un'espressione calcolata in un blocco dominante sostituisce tutte quelle
+// identiche nei blocchi dominati, e lo scope viene chiuso all'uscita dal
+// sottoalbero.
+// ---------------------------------------------------------------------------
+
+// Chiave di un'espressione nella tabella
+struct ExpressionKey {
+    unsigned Opcode = 0;
+    Type *Ty = nullptr;              // Tipo del risultato
+    Type *SourceTy = nullptr;        // Tipo sorgente delle GEP
+    unsigned Extra = 0;              // Predicato dei confronti oppure flag (nsw, nuw, exact, inbounds)
+    SmallVector<Value*, 4> Operands;
+};
+
+namespace llvm {
+template <> struct DenseMapInfo<ExpressionKey> {
+    static ExpressionKey getEmptyKey() {
+        ExpressionKey Key;
+        Key.Opcode = ~0U;
+        return Key;
+    }
+    static ExpressionKey getTombstoneKey() {
+        ExpressionKey Key;
+        Key.Opcode = ~0U - 1;
+        return Key;
+    }
+    static unsigned getHashValue(const ExpressionKey &Key) {
+        return hash_combine(Key.Opcode, Key.Ty, Key.SourceTy, Key.Extra,
+                            hash_combine_range(Key.Operands.begin(), Key.Operands.end()));
+    }
+    static bool isEqual(const ExpressionKey &LHS, const ExpressionKey &RHS) {
+        return LHS.Opcode == RHS.Opcode && LHS.Ty == RHS.Ty && LHS.SourceTy == RHS.SourceTy &&
+               LHS.Extra == RHS.Extra && LHS.Operands == RHS.Operands;
+    }
+};
+} // namespace llvm
+
+// Funzione di supporto che costruisce la chiave di I. Ritorna false se I non è un'espressione
+// pura che si può numerare (accessi in memoria, chiamate, phi, terminatori, ...)
+static bool getExpressionKey(Instruction &I, ExpressionKey &Key) {
+    if (!isa<BinaryOperator>(I) && !isa<CastInst>(I) && !isa<CmpInst>(I) && !isa<SelectInst>(I) &&
+        !isa<GetElementPtrInst>(I) && !isa<ExtractElementInst>(I) && !isa<InsertElementInst>(I))
+        return false;
+
+    Key.Opcode = I.getOpcode();
+    Key.Ty = I.getType();
+    Key.Operands.append(I.op_begin(), I.op_end());
+
+    if (auto *Cmp = dyn_cast<CmpInst>(&I)) {
+        CmpInst::Predicate Pred = Cmp->getPredicate();
+        // a < b e b > a sono la stessa espressione
+        if (Key.Operands[1] < Key.Operands[0]) {
+            std::swap(Key.Operands[0], Key.Operands[1]);
+            Pred = CmpInst::getSwappedPredicate(Pred);
+        }
+        Key.Extra = Pred;
+        return true;
+    }
+
+    if (auto *GEP = dyn_cast<GetElementPtrInst>(&I)) {
+        Key.SourceTy = GEP->getSourceElementType();
+        Key.Extra = GEP->isInBounds();
+        return true;
+    }
+
+    if (isa<OverflowingBinaryOperator>(I))
+        Key.Extra = I.hasNoSignedWrap() | (I.hasNoUnsignedWrap() << 1);
+    else if (isa<PossiblyExactOperator>(I))
+        Key.Extra = I.isExact();
+    else if (isa<FPMathOperator>(I)) {
+        FastMathFlags FMF = I.getFastMathFlags();
+        Key.Extra = FMF.noNaNs() | (FMF.noInfs() << 1) | (FMF.noSignedZeros() << 2) |
+                    (FMF.allowReciprocal() << 3) | (FMF.allowContract() << 4) |
+                    (FMF.approxFunc() << 5) | (FMF.allowReassoc() << 6);
+    }
+
+    // Gli operatori commutativi hanno gli operandi in ordine canonico
+    if (I.isCommutative() && Key.Operands[1] < Key.Operands[0])
+        std::swap(Key.Operands[0], Key.Operands[1]);
 
     return true;
 }
 
-bool runOnFunction2(Function &F) {
+bool runValueNumbering2(Function &F, DominatorTree &DT, OptimizationRemarkEmitter &ORE) {
+    using ExpressionTable = ScopedHashTable<ExpressionKey, Instruction*>;
+    using ExpressionScope = ExpressionTable::ScopeTy;
+
+    ExpressionTable table;
+    int cse_count = 0;
+
+    // Visita iterativa dell'albero di dominanza: ogni nodo apre uno scope che
+    // viene chiuso quando tutti i figli sono stati visitati
+    struct StackNode {
+        DomTreeNode *Node;
+        DomTreeNode::const_iterator NextChild;
+        std::unique_ptr<ExpressionScope> Scope;
+    };
+    SmallVector<StackNode, 32> stack;
+    stack.push_back({DT.getRootNode(), DT.getRootNode()->begin(), std::make_unique<ExpressionScope>(table)});
+    bool visitBlock = true;
+
+    while (!stack.empty()) {
+        StackNode &top = stack.back();
+
+        if (visitBlock) {
+            for (Instruction &I : make_early_inc_range(*top.Node->getBlock())) {
+                ExpressionKey key;
+                if (!getExpressionKey(I, key))
+                    continue;
+
+                // Espressione già calcolata in un blocco dominante: la riuso
+                if (Instruction *available = table.lookup(key)) {
+                    LLVM_DEBUG(dbgs() << "Espressione ridondante: " << I << "\n");
+                    ORE.emit([&]() {
+                        return OptimizationRemark(DEBUG_TYPE, "RedundantExpression", &I)
+                               << "espressione ridondante sostituita da "
+                               << ore::NV("Available", available);
+                    });
+                    // Eventuali flag non presenti nella chiave vengono ridotti a quelli comuni
+                    available->andIRFlags(&I);
+                    I.replaceAllUsesWith(available);
+                    I.eraseFromParent();
+                    cse_count++;
+                    ++NumRedundantExpr;
+                    continue;
+                }
+                table.insert(key, &I);
+            }
+        }
+
+        if (top.NextChild == top.Node->end()) {
+            stack.pop_back(); // Chiude lo scope del nodo
+            visitBlock = false;
+            continue;
+        }
+
+        DomTreeNode *child = *top.NextChild++;
+        stack.push_back({child, child->begin(), std::make_unique<ExpressionScope>(table)});
+        visitBlock = true;
+    }
+
+    LLVM_DEBUG(dbgs() << "Espressioni ridondanti eliminate: " << cse_count << "\n");
+    return cse_count > 0;
+}
+
+bool runOnFunction2(Function &F, DominatorTree &DT, OptimizationRemarkEmitter &ORE) {
     bool Transformed = false;
 
     for (auto Iter = F.begin(); Iter != F.end(); ++Iter) {
-        if (runOnBasicBlock2(*Iter)) {
+        if (runOnBasicBlock2(*Iter, ORE)) {
             Transformed = true;
         }
     }
 
+    // Value numbering su tutta la funzione, dopo le ottimizzazioni locali che possono
+    // aver reso identiche espressioni che prima non lo erano
+    if (runValueNumbering2(F, DT, ORE))
+        Transformed = true;
+
     return Transformed;
 }
 
-PreservedAnalyses LocalOpts2::run(Module &M,
-                                 ModuleAnalysisManager &AM) {
-    for (auto Fiter = M.begin(); Fiter != M.end(); ++Fiter)
-        if (runOnFunction2(*Fiter))
-            return PreservedAnalyses::none();
+PreservedAnalyses LocalOpts2::run(Function &F,
+                                 FunctionAnalysisManager &AM) {
+    // Il passo è eseguito su ogni funzione del modulo (tramite l'adattatore modulo -> funzione)
+    DominatorTree &DT = AM.getResult<DominatorTreeAnalysis>(F);
+    OptimizationRemarkEmitter &ORE = AM.getResult<OptimizationRemarkEmitterAnalysis>(F);
+    if (!runOnFunction2(F, DT, ORE))
+        return PreservedAnalyses::all();
 
-    return PreservedAnalyses::all();
+    // Le ottimizzazioni riscrivono solo istruzioni, il CFG resta invariato
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    return PA;
 }
@@ -7,7 +7,7 @@
 namespace llvm {
     class LocalOpts2 : public PassInfoMixin<LocalOpts2> {
     public:
-        PreservedAnalyses run(Module &M, ModuleAnalysisManager &AM);
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
     };
 } // namespace llvm
 #endif
\ No newline at end of file
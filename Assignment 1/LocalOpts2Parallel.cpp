@@ -0,0 +1,281 @@
+//===-- LocalOpts2Parallel.cpp - Driver parallelo per LocalOpts2 ---------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Strumento a riga di comando che esegue LocalOpts2 su più moduli in parallelo.
+// Va compilato come tool (ad esempio in llvm/tools/localopts2-parallel) con i
+// componenti Core, IRReader, BitReader, BitWriter, Linker, Passes, TransformUtils.
+//
+// Ogni file di input è un lavoro indipendente; con -split=N un modulo viene
+// diviso in N partizioni, ottimizzate separatamente e poi ricollegate.
+// Ogni lavoro usa il proprio LLVMContext: i contesti non sono thread-safe,
+// quindi i moduli passano tra i thread solo come bitcode serializzato.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/LocalOpts2.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LLVMRemarkStreamer.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+static cl::list<std::string> InputFilenames(cl::Positional, cl::OneOrMore,
+                                            cl::desc("<file .ll/.bc di input>"));
+
+static cl::opt<std::string> OutputFilename(
+    "o", cl::desc("File di output (ammesso solo con un singolo input)"),
+    cl::value_desc("filename"));
+
+static cl::opt<std::string> OutputSuffix(
+    "suffix", cl::desc("Suffisso dei file di output quando -o non è indicato"),
+    cl::init(".opt.bc"));
+
+static cl::opt<unsigned> NumThreads(
+    "j", cl::desc("Numero di thread del pool (0 = tutti i core disponibili)"),
+    cl::init(0));
+
+static cl::opt<unsigned> NumPartitions(
+    "split", cl::desc("Divide ogni modulo in N partizioni ottimizzate in parallelo"),
+    cl::init(1));
+
+static cl::opt<bool> SaveRemarks(
+    "save-remarks", cl::desc("Salva i remark di ogni lavoro accanto al file di input"),
+    cl::init(false));
+
+static cl::opt<std::string> RemarksFormat(
+    "remarks-format", cl::desc("Formato dei remark salvati (yaml o bitstream)"),
+    cl::init("yaml"));
+
+static cl::opt<bool> VerifyEach("verify", cl::desc("Verifica ogni modulo dopo l'ottimizzazione"),
+                                cl::init(true));
+
+// Un lavoro del pool: un modulo (o una partizione) da ottimizzare.
+// L'input è un file oppure un buffer di bitcode, l'output è sempre bitcode in memoria
+struct OptJob {
+    std::string Name;
+    std::string InputFile;
+    SmallVector<char, 0> Input;
+    SmallVector<char, 0> Output;
+    std::string Error;
+};
+
+// Un file di input con i lavori che gli appartengono (uno, o una per partizione)
+struct InputUnit {
+    std::string InputFile;
+    std::string OutputFile;
+    std::vector<size_t> Jobs;
+};
+
+// Funzione di supporto che esegue LocalOpts2 su tutte le funzioni del modulo
+static void optimizeModule(Module &M) {
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+
+    PassBuilder PB;
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    ModulePassManager MPM;
+    MPM.addPass(createModuleToFunctionPassAdaptor(LocalOpts2()));
+    MPM.run(M, MAM);
+}
+
+// Funzione di supporto che esegue un lavoro nel thread corrente, con un LLVMContext privato
+static void runJob(OptJob &Job) {
+    LLVMContext Context;
+    std::unique_ptr<Module> M;
+
+    // I remark sono legati al contesto, quindi ogni lavoro scrive il proprio file
+    std::unique_ptr<ToolOutputFile> RemarksFile;
+    if (SaveRemarks) {
+        std::string RemarksName = Job.Name;
+        std::replace(RemarksName.begin(), RemarksName.end(), '#', '.');
+        RemarksName += ".opt." + RemarksFormat;
+
+        Expected<std::unique_ptr<ToolOutputFile>> FileOrErr = setupLLVMOptimizationRemarks(
+            Context, RemarksName, /*RemarksPasses=*/"", RemarksFormat, /*RemarksWithHotness=*/false);
+        if (!FileOrErr) {
+            Job.Error = toString(FileOrErr.takeError());
+            return;
+        }
+        RemarksFile = std::move(*FileOrErr);
+    }
+
+    if (Job.InputFile.empty()) {
+        MemoryBufferRef Buffer(StringRef(Job.Input.data(), Job.Input.size()), Job.Name);
+        Expected<std::unique_ptr<Module>> MOrErr = parseBitcodeFile(Buffer, Context);
+        if (!MOrErr) {
+            Job.Error = toString(MOrErr.takeError());
+            return;
+        }
+        M = std::move(*MOrErr);
+    } else {
+        SMDiagnostic Err;
+        M = parseIRFile(Job.InputFile, Err, Context);
+        if (!M) {
+            raw_string_ostream OS(Job.Error);
+            Err.print(Job.InputFile.c_str(), OS);
+            return;
+        }
+    }
+
+    optimizeModule(*M);
+
+    if (VerifyEach) {
+        raw_string_ostream OS(Job.Error);
+        if (verifyModule(*M, &OS))
+            return;
+        OS.flush();
+        Job.Error.clear();
+    }
+
+    raw_svector_ostream OS(Job.Output);
+    WriteBitcodeToFile(*M, OS);
+
+    if (RemarksFile)
+        RemarksFile->keep();
+}
+
+// Funzione di supporto che divide un modulo in partizioni serializzate come bitcode.
+// I simboli locali non vengono rinominati, così le partizioni si ricollegano senza conflitti
+static bool splitInput(InputUnit &Unit, std::vector<OptJob> &Jobs) {
+    LLVMContext Context;
+    SMDiagnostic Err;
+    std::unique_ptr<Module> M = parseIRFile(Unit.InputFile, Err, Context);
+    if (!M) {
+        Err.print(Unit.InputFile.c_str(), errs());
+        return false;
+    }
+
+    unsigned Part = 0;
+    SplitModule(*M, NumPartitions, [&](std::unique_ptr<Module> PartM) {
+        OptJob Job;
+        Job.Name = Unit.InputFile + "#" + std::to_string(Part++);
+        raw_svector_ostream OS(Job.Input);
+        WriteBitcodeToFile(*PartM, OS);
+
+        Unit.Jobs.push_back(Jobs.size());
+        Jobs.push_back(std::move(Job));
+    }, /*PreserveLocals=*/true);
+    return true;
+}
+
+// Funzione di supporto che ricollega i risultati dei lavori di un input e scrive il file di output
+static bool writeOutput(const InputUnit &Unit, std::vector<OptJob> &Jobs) {
+    LLVMContext Context;
+    std::unique_ptr<Module> Merged;
+
+    for (size_t Idx : Unit.Jobs) {
+        OptJob &Job = Jobs[Idx];
+        MemoryBufferRef Buffer(StringRef(Job.Output.data(), Job.Output.size()), Job.Name);
+        Expected<std::unique_ptr<Module>> MOrErr = parseBitcodeFile(Buffer, Context);
+        if (!MOrErr) {
+            WithColor::error(errs()) << Job.Name << ": " << toString(MOrErr.takeError()) << "\n";
+            return false;
+        }
+
+        if (!Merged) {
+            Merged = std::move(*MOrErr);
+        } else if (Linker::linkModules(*Merged, std::move(*MOrErr))) {
+            WithColor::error(errs()) << Unit.InputFile << ": impossibile ricollegare le partizioni\n";
+            return false;
+        }
+    }
+
+    std::error_code EC;
+    ToolOutputFile Out(Unit.OutputFile, EC, sys::fs::OF_None);
+    if (EC) {
+        WithColor::error(errs()) << Unit.OutputFile << ": " << EC.message() << "\n";
+        return false;
+    }
+    WriteBitcodeToFile(*Merged, Out.os());
+    Out.keep();
+    return true;
+}
+
+int main(int argc, char **argv) {
+    InitLLVM X(argc, argv);
+    cl::ParseCommandLineOptions(argc, argv, "LocalOpts2 parallel driver\n");
+
+    if (!OutputFilename.empty() && InputFilenames.size() != 1) {
+        WithColor::error(errs()) << "-o richiede un singolo file di input\n";
+        return 1;
+    }
+
+    // Preparazione dei lavori nel thread principale: la divisione dei moduli
+    // avviene qui, così nessun lavoro del pool deve attenderne un altro
+    std::vector<InputUnit> Units;
+    std::vector<OptJob> Jobs;
+    for (const std::string &File : InputFilenames) {
+        InputUnit Unit;
+        Unit.InputFile = File;
+        Unit.OutputFile = OutputFilename.empty() ? File + OutputSuffix : std::string(OutputFilename);
+
+        if (NumPartitions > 1) {
+            if (!splitInput(Unit, Jobs))
+                return 1;
+        } else {
+            OptJob Job;
+            Job.Name = File;
+            Job.InputFile = File;
+            Unit.Jobs.push_back(Jobs.size());
+            Jobs.push_back(std::move(Job));
+        }
+        Units.push_back(std::move(Unit));
+    }
+
+    // I lavori sono indipendenti: ognuno legge e scrive solo il proprio OptJob
+    ThreadPool Pool(hardware_concurrency(NumThreads));
+    for (OptJob &Job : Jobs)
+        Pool.async([&Job] { runJob(Job); });
+    Pool.wait();
+
+    bool Failed = false;
+    for (const OptJob &Job : Jobs) {
+        if (!Job.Error.empty()) {
+            WithColor::error(errs()) << Job.Name << ": " << Job.Error << "\n";
+            Failed = true;
+        }
+    }
+    if (Failed)
+        return 1;
+
+    for (const InputUnit &Unit : Units) {
+        if (!writeOutput(Unit, Jobs))
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include "llvm/Transforms/Utils/AvailableExpressions.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "availableexpressions"
+
+using namespace llvm;
+using namespace llvm::dataflow;
+
+AnalysisKey AvailableExpressionsAnalysis::Key;
+
+AvailableExpressions::AvailableExpressions(Function &F) : Domain(F) {
+    GenKillTransfer Transfer(Domain.size());
+    for (BasicBlock &BB : F) {
+        BitVector &Gen = Transfer.getGen(&BB);
+        BitVector &Kill = Transfer.getKill(&BB);
+        // Un'espressione è uccisa dal blocco che definisce un suo operando. In SSA gli operandi sono
+        // definiti prima dell'uso, quindi ogni espressione calcolata in BB arriva all'uscita: il gen
+        // vince sul kill
+        for (Instruction &I : BB) {
+            for (unsigned User : Domain.getUsers(&I))
+                Kill.set(User);
+            if (std::optional<unsigned> Idx = Domain.getIndex(&I))
+                Gen.set(*Idx);
+        }
+    }
+
+    Result = solveDataflow<Direction::Forward, Meet::Intersection>(F, Domain.size(), BitVector(Domain.size()),
+                                                                   Transfer);
+    LLVM_DEBUG(dbgs() << "Available expressions di " << F.getName() << ": " << Result.getNumVisits()
+                      << " visite, " << Domain.size() << " espressioni\n");
+}
+
+bool AvailableExpressions::isAvailableBefore(const Instruction *I) const {
+    std::optional<unsigned> Idx = Domain.getIndex(I);
+    const BasicBlock *BB = I->getParent();
+    if (!Idx || !Result.isReachable(BB))
+        return false;
+    if (Result.getIn(BB).test(*Idx))
+        return true;
+    // Altrimenti deve essere calcolata prima di I nello stesso blocco
+    for (const Instruction &Prev : *BB) {
+        if (&Prev == I)
+            return false;
+        if (Domain.getIndex(&Prev) == Idx)
+            return true;
+    }
+    return false;
+}
+
+void AvailableExpressions::print(raw_ostream &OS, Function &F) const {
+    OS << "Available expressions della funzione " << F.getName() << "\n";
+    printDataflowResult(OS, F, Result, [&](raw_ostream &OS, const BitVector &Set) { Domain.printSet(OS, Set); });
+}
+
+AvailableExpressions AvailableExpressionsAnalysis::run(Function &F, FunctionAnalysisManager &FAM) {
+    return AvailableExpressions(F);
+}
+
+PreservedAnalyses AvailableExpressionsPrinterPass::run(Function &F, FunctionAnalysisManager &FAM) {
+    FAM.getResult<AvailableExpressionsAnalysis>(F).print(OS, F);
+    return PreservedAnalyses::all();
+}
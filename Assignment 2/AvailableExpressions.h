@@ -0,0 +1,50 @@
+#ifndef LLVM_TRANSFORMS_AVAILABLEEXPRESSIONS_H
+#define LLVM_TRANSFORMS_AVAILABLEEXPRESSIONS_H
+
+#include "llvm/IR/PassManager.h"
+#include "llvm/Transforms/Utils/DataflowFramework.h"
+
+namespace llvm {
+    // Espressioni disponibili: un'espressione è disponibile in un punto se su ogni cammino che arriva
+    // a quel punto è stata calcolata dopo l'ultima ridefinizione dei suoi operandi. Problema in avanti
+    // con intersezione, OUT(B) = GEN(B) ∪ (IN(B) - KILL(B)) e IN(entry) = {}
+    class AvailableExpressions {
+    public:
+        AvailableExpressions(Function &F);
+
+        const dataflow::ExpressionDomain &getDomain() const { return Domain; }
+
+        // Espressioni disponibili all'ingresso e all'uscita di BB, che deve essere raggiungibile
+        const BitVector &getAvailableAtEntry(const BasicBlock *BB) const { return Result.getIn(BB); }
+        const BitVector &getAvailableAtExit(const BasicBlock *BB) const { return Result.getOut(BB); }
+
+        // Vero se l'espressione calcolata da I è già disponibile prima di I, cioè se I è ridondante
+        bool isAvailableBefore(const Instruction *I) const;
+
+        const dataflow::DataflowResult &getDataflowResult() const { return Result; }
+        void print(raw_ostream &OS, Function &F) const;
+
+    private:
+        dataflow::ExpressionDomain Domain;
+        dataflow::DataflowResult Result;
+    };
+
+    class AvailableExpressionsAnalysis : public AnalysisInfoMixin<AvailableExpressionsAnalysis> {
+        friend AnalysisInfoMixin<AvailableExpressionsAnalysis>;
+        static AnalysisKey Key;
+
+    public:
+        using Result = AvailableExpressions;
+        Result run(Function &F, FunctionAnalysisManager &FAM);
+    };
+
+    class AvailableExpressionsPrinterPass : public PassInfoMixin<AvailableExpressionsPrinterPass> {
+        raw_ostream &OS;
+
+    public:
+        explicit AvailableExpressionsPrinterPass(raw_ostream &OS) : OS(OS) {}
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM);
+        static bool isRequired() { return true; }
+    };
+}
+#endif
@@ -0,0 +1,205 @@
+#include "llvm/Transforms/Utils/ConstantPropagation.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "constantpropagation"
+
+using namespace llvm;
+using namespace llvm::dataflow;
+
+static cl::opt<unsigned> MaxRounds(
+    "constantpropagation-max-rounds", cl::init(8), cl::Hidden,
+    cl::desc("Numero massimo di soluzioni del problema, ognuna con le costanti scoperte dalla precedente"));
+
+AnalysisKey ConstantPropagationAnalysis::Key;
+
+// Funzione di supporto che controlla se AI è una variabile intera usata solo da load e store non volatili
+// del suo tipo, cioè se il suo contenuto dipende solo dalle store che si vedono nella funzione
+static bool isTrackedSlot(const AllocaInst &AI) {
+    Type *type = AI.getAllocatedType();
+    if (!type->isIntegerTy() || AI.isArrayAllocation())
+        return false;
+    return llvm::all_of(AI.users(), [&](const User *U) {
+        if (auto *LI = dyn_cast<LoadInst>(U))
+            return !LI->isVolatile() && LI->getType() == type;
+        if (auto *SI = dyn_cast<StoreInst>(U))
+            return !SI->isVolatile() && SI->getPointerOperand() == &AI && SI->getValueOperand()->getType() == type;
+        return false;
+    });
+}
+
+ConstantPropagation::ConstantPropagation(Function &F) {
+    for (Instruction &I : instructions(F)) {
+        if (auto *AI = dyn_cast<AllocaInst>(&I)) {
+            if (isTrackedSlot(*AI)) {
+                SlotIndex[AI] = Slots.size();
+                Slots.push_back(AI);
+            }
+        }
+    }
+    SlotPairs.resize(Slots.size());
+
+    // Il dominio parte dalle costanti scritte direttamente nelle variabili
+    for (Instruction &I : instructions(F)) {
+        auto *SI = dyn_cast<StoreInst>(&I);
+        if (!SI)
+            continue;
+        auto It = SlotIndex.find(dyn_cast<AllocaInst>(SI->getPointerOperand()));
+        if (It != SlotIndex.end())
+            if (auto *C = dyn_cast<ConstantInt>(SI->getValueOperand()))
+                addPair(It->second, C);
+    }
+
+    for (unsigned round = 1;; ++round) {
+        unsigned size = Pairs.size();
+        Result = solveDataflow<Direction::Forward, Meet::Intersection>(
+            F, size, BitVector(size), [&](const BasicBlock &BB, const BitVector &In, BitVector &Out) {
+                evaluateBlock(BB, In, &Out, nullptr, nullptr);
+            });
+        LLVM_DEBUG(dbgs() << "Constant propagation di " << F.getName() << ", soluzione " << round << ": "
+                          << Result.getNumVisits() << " visite, " << size << " coppie\n");
+
+        // Rivaluto i blocchi con la soluzione: le istruzioni ripiegate sono il risultato e le costanti
+        // scritte senza una coppia allargano il dominio
+        SmallVector<std::pair<unsigned, ConstantInt*>, 8> Missing;
+        Constants.clear();
+        for (BasicBlock &BB : F)
+            if (Result.isReachable(&BB))
+                evaluateBlock(BB, Result.getIn(&BB), nullptr, &Constants, &Missing);
+
+        bool grown = false;
+        for (auto &pair : Missing)
+            grown |= addPair(pair.first, pair.second);
+        if (!grown || round >= MaxRounds)
+            break;
+    }
+}
+
+bool ConstantPropagation::addPair(unsigned Slot, ConstantInt *C) {
+    auto Inserted = PairIndex.try_emplace({Slot, C}, Pairs.size());
+    if (!Inserted.second)
+        return false;
+    Pairs.push_back({Slot, C});
+    SlotPairs[Slot].push_back(Inserted.first->second);
+    return true;
+}
+
+void ConstantPropagation::evaluateBlock(const BasicBlock &BB, const BitVector &In, BitVector *Out,
+                                        DenseMap<const Instruction*, Constant*> *Folded,
+                                        SmallVectorImpl<std::pair<unsigned, ConstantInt*>> *Missing) const {
+    const DataLayout &DL = BB.getModule()->getDataLayout();
+    // Contenuto noto delle variabili e valori noti delle istruzioni del blocco. I valori calcolati negli
+    // altri blocchi non si usano: la funzione di trasferimento deve dipendere solo da In
+    SmallDenseMap<unsigned, ConstantInt*, 8> current;
+    SmallDenseMap<const Instruction*, Constant*, 16> values;
+    for (unsigned Idx : In.set_bits())
+        current[Pairs[Idx].first] = Pairs[Idx].second;
+    if (Out)
+        *Out = In;
+
+    auto getValue = [&](const Value *V) -> Constant* {
+        if (auto *C = dyn_cast<Constant>(V))
+            return const_cast<Constant*>(C);
+        if (auto *I = dyn_cast<Instruction>(V))
+            return values.lookup(I);
+        return nullptr;
+    };
+    auto getSlot = [&](const Value *Ptr) -> std::optional<unsigned> {
+        auto It = SlotIndex.find(dyn_cast<AllocaInst>(Ptr));
+        if (It == SlotIndex.end())
+            return std::nullopt;
+        return It->second;
+    };
+
+    for (const Instruction &I : BB) {
+        if (auto *SI = dyn_cast<StoreInst>(&I)) {
+            std::optional<unsigned> slot = getSlot(SI->getPointerOperand());
+            if (!slot)
+                continue;
+            if (Out)
+                for (unsigned Idx : SlotPairs[*slot])
+                    Out->reset(Idx);
+            current.erase(*slot);
+            auto *C = dyn_cast_or_null<ConstantInt>(getValue(SI->getValueOperand()));
+            if (!C)
+                continue;
+            // Nel blocco la costante è nota anche senza una coppia nel dominio
+            current[*slot] = C;
+            auto It = PairIndex.find({*slot, C});
+            if (It == PairIndex.end()) {
+                if (Missing)
+                    Missing->push_back({*slot, C});
+            } else if (Out)
+                Out->set(It->second);
+            continue;
+        }
+
+        Constant *C = nullptr;
+        if (auto *LI = dyn_cast<LoadInst>(&I)) {
+            if (std::optional<unsigned> slot = getSlot(LI->getPointerOperand()))
+                C = current.lookup(*slot);
+        } else if (isa<BinaryOperator>(I) || isa<CmpInst>(I) || isa<CastInst>(I)) {
+            Constant *LHS = getValue(I.getOperand(0));
+            Constant *RHS = isa<CastInst>(I) ? nullptr : getValue(I.getOperand(1));
+            if (!LHS || (!isa<CastInst>(I) && !RHS))
+                continue;
+            if (auto *Cmp = dyn_cast<CmpInst>(&I))
+                C = ConstantFoldCompareInstOperands(Cmp->getPredicate(), LHS, RHS, DL);
+            else if (isa<CastInst>(I))
+                C = ConstantFoldCastOperand(I.getOpcode(), LHS, I.getType(), DL);
+            else
+                C = ConstantFoldBinaryOpOperands(I.getOpcode(), LHS, RHS, DL);
+        }
+        if (!C)
+            continue;
+        values[&I] = C;
+        if (Folded)
+            (*Folded)[&I] = C;
+    }
+}
+
+ConstantInt *ConstantPropagation::getConstantAtEntry(const BasicBlock *BB, const AllocaInst *Slot) const {
+    auto It = SlotIndex.find(Slot);
+    if (It == SlotIndex.end() || !Result.isReachable(BB))
+        return nullptr;
+    const BitVector &In = Result.getIn(BB);
+    for (unsigned Idx : SlotPairs[It->second])
+        if (In.test(Idx))
+            return Pairs[Idx].second;
+    return nullptr;
+}
+
+void ConstantPropagation::print(raw_ostream &OS, Function &F) const {
+    OS << "Constant propagation della funzione " << F.getName() << "\n";
+    printDataflowResult(OS, F, Result, [&](raw_ostream &OS, const BitVector &Set) {
+        OS << "{";
+        bool first = true;
+        for (unsigned Idx : Set.set_bits()) {
+            OS << (first ? " (" : ", (");
+            Slots[Pairs[Idx].first]->printAsOperand(OS, false);
+            OS << ", " << Pairs[Idx].second->getValue() << ")";
+            first = false;
+        }
+        OS << " }";
+    });
+    OS << "Istruzioni costanti:\n";
+    for (Instruction &I : instructions(F)) {
+        if (Constant *C = Constants.lookup(&I)) {
+            I.printAsOperand(OS << "  ", false);
+            C->printAsOperand(OS << " = ", true);
+            OS << "\n";
+        }
+    }
+}
+
+ConstantPropagation ConstantPropagationAnalysis::run(Function &F, FunctionAnalysisManager &FAM) {
+    return ConstantPropagation(F);
+}
+
+PreservedAnalyses ConstantPropagationPrinterPass::run(Function &F, FunctionAnalysisManager &FAM) {
+    FAM.getResult<ConstantPropagationAnalysis>(F).print(OS, F);
+    return PreservedAnalyses::all();
+}
@@ -0,0 +1,70 @@
+#ifndef LLVM_TRANSFORMS_CONSTANTPROPAGATION_H
+#define LLVM_TRANSFORMS_CONSTANTPROPAGATION_H
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Transforms/Utils/DataflowFramework.h"
+
+namespace llvm {
+    // Constant propagation sulle variabili in memoria (alloca intere usate solo da load e store, come
+    // nel codice a -O0). Il dominio sono le coppie (variabile, costante) e una coppia vale in un punto
+    // se su ogni cammino che ci arriva l'ultima store nella variabile ha scritto quella costante.
+    // Problema in avanti con intersezione e IN(entry) = {}; la funzione di trasferimento valuta il
+    // blocco: le load da variabili note e le istruzioni con operandi costanti vengono ripiegate, e una
+    // store genera la coppia della costante scritta e uccide le altre della stessa variabile.
+    // Le costanti ottenute ripiegando non sono note prima di risolvere il problema: dopo ogni
+    // soluzione si aggiungono al dominio quelle nuove e si risolve di nuovo, finché il dominio non
+    // cambia. Ogni soluzione intermedia è corretta, solo meno precisa
+    class ConstantPropagation {
+    public:
+        ConstantPropagation(Function &F);
+
+        // Costante contenuta in Slot all'ingresso di BB, se nota
+        ConstantInt *getConstantAtEntry(const BasicBlock *BB, const AllocaInst *Slot) const;
+
+        // Valore costante di I (una load da una variabile nota o un'istruzione ripiegata), se noto
+        Constant *getConstant(const Instruction *I) const { return Constants.lookup(I); }
+
+        void print(raw_ostream &OS, Function &F) const;
+
+    private:
+        // Aggiunge al dominio la coppia (Slot, C) e ritorna vero se non c'era
+        bool addPair(unsigned Slot, ConstantInt *C);
+
+        // Valuta BB a partire dalle coppie di In. Se Out non è nullo ci mette le coppie all'uscita, se
+        // Folded non è nullo ci aggiunge le istruzioni ripiegate, e se Missing non è nullo ci aggiunge le
+        // costanti scritte nelle variabili che non hanno ancora una coppia nel dominio
+        void evaluateBlock(const BasicBlock &BB, const BitVector &In, BitVector *Out,
+                           DenseMap<const Instruction*, Constant*> *Folded,
+                           SmallVectorImpl<std::pair<unsigned, ConstantInt*>> *Missing) const;
+
+        std::vector<const AllocaInst*> Slots;
+        DenseMap<const AllocaInst*, unsigned> SlotIndex;
+        // Coppie del dominio e coppie di ogni variabile
+        std::vector<std::pair<unsigned, ConstantInt*>> Pairs;
+        DenseMap<std::pair<unsigned, ConstantInt*>, unsigned> PairIndex;
+        std::vector<SmallVector<unsigned, 4>> SlotPairs;
+        DenseMap<const Instruction*, Constant*> Constants;
+        dataflow::DataflowResult Result;
+    };
+
+    class ConstantPropagationAnalysis : public AnalysisInfoMixin<ConstantPropagationAnalysis> {
+        friend AnalysisInfoMixin<ConstantPropagationAnalysis>;
+        static AnalysisKey Key;
+
+    public:
+        using Result = ConstantPropagation;
+        Result run(Function &F, FunctionAnalysisManager &FAM);
+    };
+
+    class ConstantPropagationPrinterPass : public PassInfoMixin<ConstantPropagationPrinterPass> {
+        raw_ostream &OS;
+
+    public:
+        explicit ConstantPropagationPrinterPass(raw_ostream &OS) : OS(OS) {}
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM);
+        static bool isRequired() { return true; }
+    };
+}
+#endif
@@ -0,0 +1,116 @@
+#include "llvm/Transforms/Utils/DataflowFramework.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Operator.h"
+
+#include <tuple>
+
+using namespace llvm;
+using namespace llvm::dataflow;
+
+// Chiave di un'espressione: opcode, predicato o flag, operandi
+using ExpressionKey = std::tuple<unsigned, unsigned, const Value*, const Value*>;
+
+// Funzione di supporto che costruisce la chiave di I. Ritorna false se I non calcola un'espressione
+static bool getExpressionKey(const Instruction &I, ExpressionKey &Key) {
+    const Value *LHS, *RHS;
+    unsigned Extra = 0;
+    if (auto *Cmp = dyn_cast<CmpInst>(&I)) {
+        LHS = Cmp->getOperand(0);
+        RHS = Cmp->getOperand(1);
+        CmpInst::Predicate Pred = Cmp->getPredicate();
+        // a < b e b > a sono la stessa espressione
+        if (RHS < LHS) {
+            std::swap(LHS, RHS);
+            Pred = CmpInst::getSwappedPredicate(Pred);
+        }
+        Extra = Pred;
+    } else if (auto *BO = dyn_cast<BinaryOperator>(&I)) {
+        LHS = BO->getOperand(0);
+        RHS = BO->getOperand(1);
+        if (BO->isCommutative() && RHS < LHS)
+            std::swap(LHS, RHS);
+        // add nsw e add sono espressioni diverse: una può essere poison dove l'altra non lo è
+        if (isa<OverflowingBinaryOperator>(BO))
+            Extra = BO->hasNoSignedWrap() | (BO->hasNoUnsignedWrap() << 1);
+        else if (isa<PossiblyExactOperator>(BO))
+            Extra = BO->isExact();
+        else if (isa<FPMathOperator>(BO))
+            Extra = BO->getFastMathFlags().isFast();
+    } else
+        return false;
+
+    Key = ExpressionKey(I.getOpcode(), Extra, LHS, RHS);
+    return true;
+}
+
+ExpressionDomain::ExpressionDomain(Function &F) {
+    DenseMap<ExpressionKey, unsigned> Keys;
+    for (BasicBlock &BB : F) {
+        for (Instruction &I : BB) {
+            ExpressionKey Key;
+            if (!getExpressionKey(I, Key))
+                continue;
+            auto Inserted = Keys.try_emplace(Key, Expressions.size());
+            IndexOf[&I] = Inserted.first->second;
+            if (!Inserted.second)
+                continue;
+            Expressions.push_back(&I);
+            UsersOf[I.getOperand(0)].push_back(Inserted.first->second);
+            if (I.getOperand(1) != I.getOperand(0))
+                UsersOf[I.getOperand(1)].push_back(Inserted.first->second);
+        }
+    }
+}
+
+std::optional<unsigned> ExpressionDomain::getIndex(const Instruction *I) const {
+    auto It = IndexOf.find(I);
+    if (It == IndexOf.end())
+        return std::nullopt;
+    return It->second;
+}
+
+ArrayRef<unsigned> ExpressionDomain::getUsers(const Value *V) const {
+    auto It = UsersOf.find(V);
+    if (It == UsersOf.end())
+        return {};
+    return It->second;
+}
+
+void ExpressionDomain::print(raw_ostream &OS, unsigned Idx) const {
+    const Instruction *I = Expressions[Idx];
+    OS << I->getOpcodeName();
+    if (auto *Cmp = dyn_cast<CmpInst>(I))
+        OS << " " << CmpInst::getPredicateName(Cmp->getPredicate());
+    OS << " ";
+    I->getOperand(0)->printAsOperand(OS, false);
+    OS << ", ";
+    I->getOperand(1)->printAsOperand(OS, false);
+}
+
+void ExpressionDomain::printSet(raw_ostream &OS, const BitVector &Set) const {
+    OS << "{";
+    bool first = true;
+    for (unsigned Idx : Set.set_bits()) {
+        OS << (first ? " " : ", ");
+        print(OS, Idx);
+        first = false;
+    }
+    OS << " }";
+}
+
+void llvm::dataflow::printDataflowResult(raw_ostream &OS, Function &F, const DataflowResult &Result,
+                                         function_ref<void(raw_ostream&, const BitVector&)> PrintSet) {
+    for (BasicBlock &BB : F) {
+        BB.printAsOperand(OS, false);
+        if (!Result.isReachable(&BB)) {
+            OS << ": non raggiungibile\n";
+            continue;
+        }
+        OS << ":\n  IN:  ";
+        PrintSet(OS, Result.getIn(&BB));
+        OS << "\n  OUT: ";
+        PrintSet(OS, Result.getOut(&BB));
+        OS << "\n";
+    }
+}
@@ -0,0 +1,220 @@
+#ifndef LLVM_TRANSFORMS_DATAFLOWFRAMEWORK_H
+#define LLVM_TRANSFORMS_DATAFLOWFRAMEWORK_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <optional>
+#include <queue>
+#include <vector>
+
+namespace llvm {
+namespace dataflow {
+
+    // Verso in cui si propagano le informazioni: in avanti IN(B) è il meet degli OUT dei predecessori,
+    // all'indietro OUT(B) è il meet degli IN dei successori
+    enum class Direction { Forward, Backward };
+
+    // Operatore di meet tra i valori che arrivano da più archi
+    enum class Meet { Union, Intersection };
+
+    // Insiemi IN e OUT (all'ingresso e all'uscita del blocco, in entrambe le direzioni) dei blocchi
+    // raggiungibili dall'entry. Gli insiemi sono bit-vector densi, un bit per elemento del dominio
+    class DataflowResult {
+    public:
+        bool isReachable(const BasicBlock *BB) const { return Index.count(BB); }
+
+        const BitVector &getIn(const BasicBlock *BB) const { return In[getIndex(BB)]; }
+        const BitVector &getOut(const BasicBlock *BB) const { return Out[getIndex(BB)]; }
+
+        // Numero di volte in cui è stata applicata una funzione di trasferimento
+        unsigned getNumVisits() const { return NumVisits; }
+
+    private:
+        template <Direction Dir, Meet MeetOp, typename TransferFn>
+        friend DataflowResult solveDataflow(Function &F, unsigned DomainSize, const BitVector &Boundary,
+                                            TransferFn &&Transfer);
+
+        unsigned getIndex(const BasicBlock *BB) const {
+            auto It = Index.find(BB);
+            assert(It != Index.end() && "Blocco non raggiungibile dall'entry");
+            return It->second;
+        }
+
+        DenseMap<const BasicBlock*, unsigned> Index;
+        std::vector<BitVector> In, Out;
+        unsigned NumVisits = 0;
+    };
+
+    // Risolve un problema di dataflow su F e ritorna il massimo punto fisso.
+    // Transfer è chiamata come Transfer(BB, Input, Output): Input è il meet degli archi entranti
+    // (IN in avanti, OUT all'indietro) e Output, già dimensionato, va riempito con l'altro insieme.
+    // Boundary è il valore all'ingresso dell'entry (in avanti) o all'uscita dei blocchi senza
+    // successori (all'indietro); gli altri blocchi partono dal top del meet (insieme pieno per
+    // l'intersezione, vuoto per l'unione).
+    // I blocchi sono numerati in reverse post-order in avanti e in post-order all'indietro, e la
+    // worklist estrae sempre il blocco con il numero più basso: ogni blocco vede i suoi predecessori
+    // (nel verso del problema) già aggiornati, tranne quelli sugli archi di ritorno, e si converge in
+    // un numero di passate proporzionale alla profondità dei loop invece che al numero di blocchi
+    template <Direction Dir, Meet MeetOp, typename TransferFn>
+    DataflowResult solveDataflow(Function &F, unsigned DomainSize, const BitVector &Boundary,
+                                 TransferFn &&Transfer) {
+        assert(Boundary.size() == DomainSize && "Boundary con dimensione diversa dal dominio");
+        DataflowResult Result;
+
+        std::vector<const BasicBlock*> order;
+        ReversePostOrderTraversal<Function*> RPOT(&F);
+        for (BasicBlock *BB : RPOT)
+            order.push_back(BB);
+        if (Dir == Direction::Backward)
+            std::reverse(order.begin(), order.end());
+        unsigned N = order.size();
+        for (unsigned i = 0; i < N; ++i)
+            Result.Index[order[i]] = i;
+
+        // Archi per indice: sources sono i blocchi da cui arriva il valore, targets quelli a cui va
+        std::vector<SmallVector<unsigned, 2>> sources(N), targets(N);
+        for (unsigned i = 0; i < N; ++i) {
+            for (const BasicBlock *Succ : successors(order[i])) {
+                unsigned j = Result.Index.lookup(Succ);
+                unsigned from = Dir == Direction::Forward ? i : j;
+                unsigned to = Dir == Direction::Forward ? j : i;
+                sources[to].push_back(from);
+                targets[from].push_back(to);
+            }
+        }
+
+        std::vector<BitVector> input(N, BitVector(DomainSize));
+        std::vector<BitVector> output(N, BitVector(DomainSize, MeetOp == Meet::Intersection));
+        BitVector scratch(DomainSize);
+        BitVector pending(N, true);
+        std::priority_queue<unsigned, std::vector<unsigned>, std::greater<unsigned>> worklist;
+        for (unsigned i = 0; i < N; ++i)
+            worklist.push(i);
+
+        while (!worklist.empty()) {
+            unsigned i = worklist.top();
+            worklist.pop();
+            pending.reset(i);
+
+            BitVector &meet = input[i];
+            if (sources[i].empty())
+                meet = Boundary;
+            else {
+                meet = output[sources[i].front()];
+                for (unsigned s : ArrayRef<unsigned>(sources[i]).drop_front()) {
+                    if (MeetOp == Meet::Intersection)
+                        meet &= output[s];
+                    else
+                        meet |= output[s];
+                }
+            }
+
+            scratch.reset();
+            Transfer(*order[i], static_cast<const BitVector&>(meet), scratch);
+            ++Result.NumVisits;
+            if (scratch == output[i])
+                continue;
+            std::swap(scratch, output[i]);
+            for (unsigned t : targets[i]) {
+                if (!pending.test(t)) {
+                    pending.set(t);
+                    worklist.push(t);
+                }
+            }
+        }
+
+        if (Dir == Direction::Forward) {
+            Result.In = std::move(input);
+            Result.Out = std::move(output);
+        } else {
+            Result.In = std::move(output);
+            Result.Out = std::move(input);
+        }
+        return Result;
+    }
+
+    // Funzione di trasferimento nella forma classica OUT = GEN ∪ (IN - KILL) (o IN = GEN ∪ (OUT - KILL)
+    // all'indietro). I blocchi senza insiemi propri lasciano passare il valore invariato
+    class GenKillTransfer {
+    public:
+        explicit GenKillTransfer(unsigned DomainSize) : DomainSize(DomainSize) {}
+
+        // I riferimenti restano validi finché non si chiedono gli insiemi di un altro blocco
+        BitVector &getGen(const BasicBlock *BB) { return getSets(BB).Gen; }
+        BitVector &getKill(const BasicBlock *BB) { return getSets(BB).Kill; }
+
+        void operator()(const BasicBlock &BB, const BitVector &Input, BitVector &Output) const {
+            Output = Input;
+            auto It = Sets.find(&BB);
+            if (It == Sets.end())
+                return;
+            Output.reset(It->second.Kill);
+            Output |= It->second.Gen;
+        }
+
+    private:
+        struct BlockSets {
+            BitVector Gen, Kill;
+        };
+
+        BlockSets &getSets(const BasicBlock *BB) {
+            auto Inserted = Sets.try_emplace(BB);
+            if (Inserted.second) {
+                Inserted.first->second.Gen.resize(DomainSize);
+                Inserted.first->second.Kill.resize(DomainSize);
+            }
+            return Inserted.first->second;
+        }
+
+        unsigned DomainSize;
+        DenseMap<const BasicBlock*, BlockSets> Sets;
+    };
+
+    // Universo delle espressioni di una funzione, condiviso dalle analisi sulle espressioni.
+    // Ogni operatore binario o confronto calcola un'espressione; istruzioni con lo stesso opcode,
+    // gli stessi flag e gli stessi operandi (a meno dell'ordine, per gli operatori commutativi e per
+    // i confronti con predicato scambiato) hanno lo stesso indice
+    class ExpressionDomain {
+    public:
+        explicit ExpressionDomain(Function &F);
+
+        unsigned size() const { return Expressions.size(); }
+
+        // Indice dell'espressione calcolata da I, se I ne calcola una
+        std::optional<unsigned> getIndex(const Instruction *I) const;
+
+        // Prima istruzione (nell'ordine dei blocchi) che calcola l'espressione
+        const Instruction *getExpression(unsigned Idx) const { return Expressions[Idx]; }
+
+        // Espressioni che usano V come operando, da uccidere dove V viene definito
+        ArrayRef<unsigned> getUsers(const Value *V) const;
+
+        void print(raw_ostream &OS, unsigned Idx) const;
+        void printSet(raw_ostream &OS, const BitVector &Set) const;
+
+    private:
+        std::vector<const Instruction*> Expressions;
+        DenseMap<const Instruction*, unsigned> IndexOf;
+        DenseMap<const Value*, SmallVector<unsigned, 2>> UsersOf;
+    };
+
+    // Stampa gli insiemi IN e OUT di ogni blocco raggiungibile, usando PrintSet per gli insiemi
+    void printDataflowResult(raw_ostream &OS, Function &F, const DataflowResult &Result,
+                             function_ref<void(raw_ostream&, const BitVector&)> PrintSet);
+
+} // namespace dataflow
+} // namespace llvm
+#endif
@@ -0,0 +1,90 @@
+#include "llvm/Transforms/Utils/DominatorAnalysis.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "dominatoranalysis"
+
+using namespace llvm;
+using namespace llvm::dataflow;
+
+AnalysisKey DominatorAnalysis::Key;
+
+DominatorSets::DominatorSets(Function &F) {
+    for (BasicBlock &BB : F) {
+        BlockIndex[&BB] = Blocks.size();
+        Blocks.push_back(&BB);
+    }
+
+    // Il gen di ogni blocco è il blocco stesso e il kill è vuoto: invece di una GenKillTransfer
+    // basta accendere un bit
+    Result = solveDataflow<Direction::Forward, Meet::Intersection>(
+        F, Blocks.size(), BitVector(Blocks.size()),
+        [&](const BasicBlock &BB, const BitVector &In, BitVector &Out) {
+            Out = In;
+            Out.set(BlockIndex.lookup(&BB));
+        });
+    LLVM_DEBUG(dbgs() << "Dominatori di " << F.getName() << ": " << Result.getNumVisits()
+                      << " visite per " << Blocks.size() << " blocchi\n");
+}
+
+bool DominatorSets::dominates(const BasicBlock *A, const BasicBlock *B) const {
+    if (!Result.isReachable(B))
+        return true;
+    return Result.getOut(B).test(BlockIndex.lookup(A));
+}
+
+bool DominatorSets::properlyDominates(const BasicBlock *A, const BasicBlock *B) const {
+    return A != B && dominates(A, B);
+}
+
+const BasicBlock *DominatorSets::getImmediateDominator(const BasicBlock *BB) const {
+    if (!Result.isReachable(BB))
+        return nullptr;
+    // I dominatori stretti di BB formano una catena: l'immediato è quello che ne ha di più
+    const BasicBlock *IDom = nullptr;
+    unsigned best = 0;
+    for (unsigned Idx : Result.getIn(BB).set_bits()) {
+        unsigned count = Result.getOut(Blocks[Idx]).count();
+        if (count > best) {
+            best = count;
+            IDom = Blocks[Idx];
+        }
+    }
+    return IDom;
+}
+
+SmallVector<const BasicBlock*, 8> DominatorSets::getDominators(const BasicBlock *BB) const {
+    SmallVector<const BasicBlock*, 8> Dominators;
+    if (!Result.isReachable(BB))
+        return Dominators;
+    for (unsigned Idx : Result.getOut(BB).set_bits())
+        Dominators.push_back(Blocks[Idx]);
+    return Dominators;
+}
+
+void DominatorSets::print(raw_ostream &OS, Function &F) const {
+    OS << "Dominatori della funzione " << F.getName() << "\n";
+    printDataflowResult(OS, F, Result, [&](raw_ostream &OS, const BitVector &Set) {
+        OS << "{";
+        bool first = true;
+        for (unsigned Idx : Set.set_bits()) {
+            OS << (first ? " " : ", ");
+            Blocks[Idx]->printAsOperand(OS, false);
+            first = false;
+        }
+        OS << " }";
+    });
+}
+
+bool DominatorSets::invalidate(Function &F, const PreservedAnalyses &PA, FunctionAnalysisManager::Invalidator &Inv) {
+    auto PAC = PA.getChecker<DominatorAnalysis>();
+    return !(PAC.preserved() || PAC.preservedSet<AllAnalysesOn<Function>>() || PAC.preservedSet<CFGAnalyses>());
+}
+
+DominatorSets DominatorAnalysis::run(Function &F, FunctionAnalysisManager &FAM) {
+    return DominatorSets(F);
+}
+
+PreservedAnalyses DominatorAnalysisPrinterPass::run(Function &F, FunctionAnalysisManager &FAM) {
+    FAM.getResult<DominatorAnalysis>(F).print(OS, F);
+    return PreservedAnalyses::all();
+}
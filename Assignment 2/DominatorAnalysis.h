@@ -0,0 +1,55 @@
+#ifndef LLVM_TRANSFORMS_DOMINATORANALYSIS_H
+#define LLVM_TRANSFORMS_DOMINATORANALYSIS_H
+
+#include "llvm/IR/PassManager.h"
+#include "llvm/Transforms/Utils/DataflowFramework.h"
+
+namespace llvm {
+    // Insiemi dei dominatori di ogni blocco: problema in avanti con intersezione,
+    // OUT(B) = {B} ∪ IN(B) e IN(entry) = {}
+    class DominatorSets {
+    public:
+        DominatorSets(Function &F);
+
+        // Vero se A domina B. Come per DominatorTree, un blocco non raggiungibile è dominato da tutti
+        bool dominates(const BasicBlock *A, const BasicBlock *B) const;
+        bool properlyDominates(const BasicBlock *A, const BasicBlock *B) const;
+
+        // Dominatore immediato: il dominatore stretto con più dominatori. nullptr per l'entry e per
+        // i blocchi non raggiungibili
+        const BasicBlock *getImmediateDominator(const BasicBlock *BB) const;
+
+        // Blocchi che dominano BB (BB compreso), nell'ordine della funzione
+        SmallVector<const BasicBlock*, 8> getDominators(const BasicBlock *BB) const;
+
+        const dataflow::DataflowResult &getDataflowResult() const { return Result; }
+        void print(raw_ostream &OS, Function &F) const;
+
+        // Gli insiemi dipendono solo dal CFG
+        bool invalidate(Function &F, const PreservedAnalyses &PA, FunctionAnalysisManager::Invalidator &Inv);
+
+    private:
+        std::vector<const BasicBlock*> Blocks;
+        DenseMap<const BasicBlock*, unsigned> BlockIndex;
+        dataflow::DataflowResult Result;
+    };
+
+    class DominatorAnalysis : public AnalysisInfoMixin<DominatorAnalysis> {
+        friend AnalysisInfoMixin<DominatorAnalysis>;
+        static AnalysisKey Key;
+
+    public:
+        using Result = DominatorSets;
+        Result run(Function &F, FunctionAnalysisManager &FAM);
+    };
+
+    class DominatorAnalysisPrinterPass : public PassInfoMixin<DominatorAnalysisPrinterPass> {
+        raw_ostream &OS;
+
+    public:
+        explicit DominatorAnalysisPrinterPass(raw_ostream &OS) : OS(OS) {}
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM);
+        static bool isRequired() { return true; }
+    };
+}
+#endif
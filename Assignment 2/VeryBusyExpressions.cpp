@@ -0,0 +1,47 @@
+#include "llvm/Transforms/Utils/VeryBusyExpressions.h"
+#include "llvm/Support/Debug.h"
+
+#define DEBUG_TYPE "verybusyexpressions"
+
+using namespace llvm;
+using namespace llvm::dataflow;
+
+AnalysisKey VeryBusyExpressionsAnalysis::Key;
+
+VeryBusyExpressions::VeryBusyExpressions(Function &F) : Domain(F) {
+    GenKillTransfer Transfer(Domain.size());
+    for (BasicBlock &BB : F) {
+        BitVector &Gen = Transfer.getGen(&BB);
+        BitVector &Kill = Transfer.getKill(&BB);
+        // In SSA ogni valore è definito una sola volta, quindi un'espressione è uccisa dal blocco che
+        // definisce un suo operando (le PHI contano come definite all'inizio del blocco). Un'espressione
+        // calcolata in BB è nel gen solo se nessun operando è definito prima in BB, cioè se lo è già
+        // all'ingresso del blocco
+        for (Instruction &I : BB) {
+            if (std::optional<unsigned> Idx = Domain.getIndex(&I))
+                if (!Kill.test(*Idx))
+                    Gen.set(*Idx);
+            for (unsigned User : Domain.getUsers(&I))
+                Kill.set(User);
+        }
+    }
+
+    Result = solveDataflow<Direction::Backward, Meet::Intersection>(F, Domain.size(), BitVector(Domain.size()),
+                                                                    Transfer);
+    LLVM_DEBUG(dbgs() << "Very busy expressions di " << F.getName() << ": " << Result.getNumVisits()
+                      << " visite, " << Domain.size() << " espressioni\n");
+}
+
+void VeryBusyExpressions::print(raw_ostream &OS, Function &F) const {
+    OS << "Very busy expressions della funzione " << F.getName() << "\n";
+    printDataflowResult(OS, F, Result, [&](raw_ostream &OS, const BitVector &Set) { Domain.printSet(OS, Set); });
+}
+
+VeryBusyExpressions VeryBusyExpressionsAnalysis::run(Function &F, FunctionAnalysisManager &FAM) {
+    return VeryBusyExpressions(F);
+}
+
+PreservedAnalyses VeryBusyExpressionsPrinterPass::run(Function &F, FunctionAnalysisManager &FAM) {
+    FAM.getResult<VeryBusyExpressionsAnalysis>(F).print(OS, F);
+    return PreservedAnalyses::all();
+}
@@ -0,0 +1,47 @@
+#ifndef LLVM_TRANSFORMS_VERYBUSYEXPRESSIONS_H
+#define LLVM_TRANSFORMS_VERYBUSYEXPRESSIONS_H
+
+#include "llvm/IR/PassManager.h"
+#include "llvm/Transforms/Utils/DataflowFramework.h"
+
+namespace llvm {
+    // Espressioni very busy: un'espressione è very busy in un punto se viene calcolata su ogni cammino
+    // che parte da quel punto prima che uno dei suoi operandi venga ridefinito. Problema all'indietro
+    // con intersezione, IN(B) = GEN(B) ∪ (OUT(B) - KILL(B)) e OUT(exit) = {}
+    class VeryBusyExpressions {
+    public:
+        VeryBusyExpressions(Function &F);
+
+        const dataflow::ExpressionDomain &getDomain() const { return Domain; }
+
+        // Espressioni very busy all'ingresso e all'uscita di BB, che deve essere raggiungibile
+        const BitVector &getVeryBusyAtEntry(const BasicBlock *BB) const { return Result.getIn(BB); }
+        const BitVector &getVeryBusyAtExit(const BasicBlock *BB) const { return Result.getOut(BB); }
+
+        const dataflow::DataflowResult &getDataflowResult() const { return Result; }
+        void print(raw_ostream &OS, Function &F) const;
+
+    private:
+        dataflow::ExpressionDomain Domain;
+        dataflow::DataflowResult Result;
+    };
+
+    class VeryBusyExpressionsAnalysis : public AnalysisInfoMixin<VeryBusyExpressionsAnalysis> {
+        friend AnalysisInfoMixin<VeryBusyExpressionsAnalysis>;
+        static AnalysisKey Key;
+
+    public:
+        using Result = VeryBusyExpressions;
+        Result run(Function &F, FunctionAnalysisManager &FAM);
+    };
+
+    class VeryBusyExpressionsPrinterPass : public PassInfoMixin<VeryBusyExpressionsPrinterPass> {
+        raw_ostream &OS;
+
+    public:
+        explicit VeryBusyExpressionsPrinterPass(raw_ostream &OS) : OS(OS) {}
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM);
+        static bool isRequired() { return true; }
+    };
+}
+#endif
@@ -0,0 +1,270 @@
+#include "llvm/Transforms/Utils/LoopStrengthReduction.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/LoopIterator.h"
+#include "llvm/Analysis/MemorySSA.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+
+#include <algorithm>
+
+#define DEBUG_TYPE "loopstrengthreduction"
+
+using namespace llvm;
+
+// Contatori del passo, visibili con -stats
+STATISTIC(NumRewritten, "Numero di espressioni della variabile di induzione riscritte con una PHI");
+STATISTIC(NumMulsRemoved, "Numero di moltiplicazioni (mul e shl) tolte dal corpo del loop");
+STATISTIC(NumPHIsCreated, "Numero di PHI create per le espressioni riscritte");
+STATISTIC(NumPHIsReused, "Numero di variabili di induzione esistenti riusate dalle espressioni riscritte");
+
+static cl::opt<unsigned> MaxNewPHIs(
+    "loopstrengthreduction-max-phis", cl::init(4), cl::Hidden,
+    cl::desc("Numero massimo di PHI create in un loop: ogni PHI occupa un registro per tutto il loop"));
+
+// ---------------------------------------------------------------------------
+// ESPRESSIONI DA RIDURRE
+// Un'istruzione del loop il cui valore, per ScalarEvolution, è un AddRec affine
+// {inizio,+,passo} del loop viene calcolata da zero a ogni iterazione anche se
+// basterebbe aggiungere il passo al valore dell'iterazione precedente. Conviene
+// riscriverla quando il suo calcolo contiene una moltiplicazione (mul o shl) che
+// dipende dalla variabile di induzione, come in i * stride + base o nell'indice
+// di una getelementptr.
+// ---------------------------------------------------------------------------
+
+// Espressione da riscrivere: il suo valore è inizio + X, dove X = {0,+,passo} è condivisa da tutte
+// le espressioni del loop con lo stesso passo
+struct ReductionCandidate {
+    Instruction *Inst;
+    const SCEVAddRecExpr *AR;
+};
+
+// Espressioni con lo stesso passo: una sola PHI X = {0,+,passo} sostituisce tutte le loro moltiplicazioni
+struct StrideGroup {
+    SmallVector<ReductionCandidate, 4> roots;
+    unsigned multiplies = 0;
+};
+
+// Funzione di supporto che ritorna l'AddRec affine del loop L che descrive il valore di I, se esiste
+static const SCEVAddRecExpr *getAffineAddRec(Instruction *I, Loop &L, ScalarEvolution &SE) {
+    if (!SE.isSCEVable(I->getType()))
+        return nullptr;
+    auto *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(I));
+    if (!AR || AR->getLoop() != &L || !AR->isAffine())
+        return nullptr;
+    return AR;
+}
+
+// Funzione di supporto che raccoglie le istruzioni riducibili del loop (nei suoi blocchi, non in quelli dei
+// sotto-loop) e le raggruppa per passo. Un'istruzione è riducibile se è un AddRec affine e se il suo calcolo
+// contiene una moltiplicazione; vengono riscritte solo le radici, cioè quelle con almeno un uso che non è
+// riducibile: le altre servono solo alle radici e diventano codice morto. Ogni moltiplicazione è contata
+// nel gruppo della prima radice che la usa ed è aggiunta a multiplies.
+// I blocchi sono visitati in reverse post-order, così ogni operando è classificato prima dei suoi usi
+static void collectCandidates(Loop &L, LoopStandardAnalysisResults &LAR, MapVector<const SCEV*, StrideGroup> &groups,
+                              SmallVectorImpl<WeakTrackingVH> &multiplies) {
+    LoopBlocksRPO RPOT(&L);
+    RPOT.perform(&LAR.LI);
+
+    SmallPtrSet<Instruction*, 16> reducible;
+    SmallVector<Instruction*, 16> order;
+    for (BasicBlock *BB : RPOT) {
+        if (LAR.LI.getLoopFor(BB) != &L)
+            continue;
+        for (Instruction &I : *BB) {
+            if (isa<PHINode>(I) || !getAffineAddRec(&I, L, LAR.SE))
+                continue;
+            bool isMultiply = I.getOpcode() == Instruction::Mul || I.getOpcode() == Instruction::Shl;
+            bool usesMultiply = llvm::any_of(I.operands(), [&](Value *op) {
+                auto *opInst = dyn_cast<Instruction>(op);
+                return opInst && reducible.count(opInst);
+            });
+            if (isMultiply || usesMultiply) {
+                reducible.insert(&I);
+                order.push_back(&I);
+                if (isMultiply)
+                    multiplies.push_back(&I);
+            }
+        }
+    }
+
+    SmallPtrSet<Instruction*, 16> counted;
+    for (Instruction *I : order) {
+        bool isRoot = llvm::any_of(I->users(), [&](User *U) {
+            auto *userInst = dyn_cast<Instruction>(U);
+            return !userInst || !reducible.count(userInst);
+        });
+        if (!isRoot)
+            continue;
+        const SCEVAddRecExpr *AR = getAffineAddRec(I, L, LAR.SE);
+        StrideGroup &group = groups[AR->getStepRecurrence(LAR.SE)];
+        group.roots.push_back({I, AR});
+
+        SmallVector<Instruction*, 8> worklist = {I};
+        while (!worklist.empty()) {
+            Instruction *member = worklist.pop_back_val();
+            if (!counted.insert(member).second)
+                continue;
+            if (member->getOpcode() == Instruction::Mul || member->getOpcode() == Instruction::Shl)
+                group.multiplies++;
+            for (Value *op : member->operands())
+                if (auto *opInst = dyn_cast<Instruction>(op))
+                    if (reducible.count(opInst))
+                        worklist.push_back(opInst);
+        }
+    }
+}
+
+// Funzione di supporto che cerca tra le PHI dell'header una variabile di induzione che vale già {0,+,passo}
+static PHINode *findExistingIV(Loop &L, const SCEV *Step, ScalarEvolution &SE) {
+    const SCEV *Target = SE.getAddRecExpr(SE.getZero(Step->getType()), Step, &L, SCEV::FlagAnyWrap);
+    for (PHINode &PN : L.getHeader()->phis())
+        if (SE.isSCEVable(PN.getType()) && PN.getType() == Step->getType() && SE.getSCEV(&PN) == Target)
+            return &PN;
+    return nullptr;
+}
+
+// Funzione di supporto che crea la PHI X = {0,+,passo}: il passo, invariante, è calcolato nel preheader e
+// l'incremento alla fine del latch. È l'unica somma che resta a ogni iterazione per tutto il gruppo
+static PHINode *createStrideIV(Loop &L, const SCEV *Step, SCEVExpander &Rewriter) {
+    BasicBlock *preHeader = L.getLoopPreheader();
+    BasicBlock *latch = L.getLoopLatch();
+    Type *type = Step->getType();
+    Value *stepValue = Rewriter.expandCodeFor(Step, type, preHeader->getTerminator());
+
+    PHINode *IV = PHINode::Create(type, 2, "lsr.iv", &L.getHeader()->front());
+    IRBuilder<> Builder(latch->getTerminator());
+    Value *next = Builder.CreateAdd(IV, stepValue, "lsr.iv.next");
+    IV->addIncoming(ConstantInt::get(type, 0), preHeader);
+    IV->addIncoming(next, latch);
+    return IV;
+}
+
+// Funzione di supporto che riscrive una radice come inizio + X. L'inizio, invariante, è calcolato nel
+// preheader; una radice di tipo puntatore diventa una getelementptr di X byte a partire dall'inizio
+static Value *rewriteRoot(const ReductionCandidate &C, PHINode *IV, Loop &L, SCEVExpander &Rewriter) {
+    Instruction *insertPt = L.getLoopPreheader()->getTerminator();
+    Type *type = C.Inst->getType();
+    const SCEV *start = C.AR->getStart();
+    IRBuilder<> Builder(C.Inst);
+
+    if (type->isPointerTy()) {
+        Type *bytePtr = PointerType::get(Builder.getInt8Ty(), type->getPointerAddressSpace());
+        Value *base = Rewriter.expandCodeFor(start, bytePtr, insertPt);
+        Value *address = Builder.CreateGEP(Builder.getInt8Ty(), base, IV, C.Inst->getName() + ".lsr");
+        return Builder.CreateBitCast(address, type);
+    }
+    if (start->isZero())
+        return IV;
+    Value *base = Rewriter.expandCodeFor(start, type, insertPt);
+    return Builder.CreateAdd(base, IV, C.Inst->getName() + ".lsr");
+}
+
+static bool reduceLoop(Loop &L, LoopStandardAnalysisResults &LAR, OptimizationRemarkEmitter &ORE) {
+    ScalarEvolution &SE = LAR.SE;
+    MapVector<const SCEV*, StrideGroup> groups;
+    SmallVector<WeakTrackingVH, 8> multiplies;
+    collectCandidates(L, LAR, groups, multiplies);
+    if (groups.empty())
+        return false;
+
+    // I gruppi che tolgono più moltiplicazioni ottengono per primi una PHI nuova
+    SmallVector<std::pair<const SCEV*, StrideGroup*>, 4> order;
+    for (auto &entry : groups)
+        order.push_back({entry.first, &entry.second});
+    std::stable_sort(order.begin(), order.end(), [](const auto &A, const auto &B) {
+        return A.second->multiplies > B.second->multiplies;
+    });
+
+    const DataLayout &DL = L.getHeader()->getModule()->getDataLayout();
+    SCEVExpander Rewriter(SE, DL, "lsr");
+    // In modo canonico l'expander riscriverebbe ogni addrec come {0,+,1} moltiplicato per il passo,
+    // reintroducendo le moltiplicazioni che il passo vuole eliminare: serve una PHI per ogni passo
+    Rewriter.disableCanonicalMode();
+    SmallVector<WeakTrackingVH, 16> dead;
+    unsigned newPHIs = 0;
+    bool Changed = false;
+
+    for (auto &entry : order) {
+        const SCEV *Step = entry.first;
+        StrideGroup &group = *entry.second;
+        // Il passo e gli inizi vengono calcolati nel preheader: devono poter essere espansi senza rischi
+        if (!Rewriter.isSafeToExpand(Step) || llvm::any_of(group.roots, [&](const ReductionCandidate &C) {
+                return !Rewriter.isSafeToExpand(C.AR->getStart());
+            }))
+            continue;
+
+        PHINode *IV = findExistingIV(L, Step, SE);
+        if (IV) {
+            ++NumPHIsReused;
+        } else {
+            if (newPHIs == MaxNewPHIs) {
+                ORE.emit([&]() {
+                    return OptimizationRemarkMissed(DEBUG_TYPE, "TooManyPHIs", group.roots.front().Inst)
+                           << "espressione non ridotta: il loop ha già " << ore::NV("PHIs", newPHIs)
+                           << " PHI create dalla riduzione";
+                });
+                continue;
+            }
+            IV = createStrideIV(L, Step, Rewriter);
+            ++newPHIs;
+            ++NumPHIsCreated;
+        }
+
+        for (const ReductionCandidate &C : group.roots) {
+            LLVM_DEBUG(dbgs() << "Riduco " << *C.Inst << " = " << *C.AR << "\n");
+            Value *replacement = rewriteRoot(C, IV, L, Rewriter);
+            SE.forgetValue(C.Inst);
+            C.Inst->replaceAllUsesWith(replacement);
+            dead.push_back(C.Inst);
+            ++NumRewritten;
+        }
+        Changed = true;
+        ORE.emit([&]() {
+            return OptimizationRemark(DEBUG_TYPE, "Reduced", group.roots.front().Inst)
+                   << ore::NV("Roots", (unsigned)group.roots.size())
+                   << " espressioni con lo stesso passo calcolate da una sola variabile di induzione, "
+                   << ore::NV("Multiplies", group.multiplies) << " moltiplicazioni tolte dal loop";
+        });
+    }
+
+    // Le radici e le istruzioni che servivano solo a loro (moltiplicazioni comprese) non hanno più usi
+    RecursivelyDeleteTriviallyDeadInstructionsPermissive(dead);
+    NumMulsRemoved += llvm::count_if(multiplies, [](const WeakTrackingVH &VH) { return !VH; });
+    if (Changed)
+        SE.forgetLoop(&L);
+    return Changed;
+}
+
+PreservedAnalyses LoopStrengthReduction::run(Loop &L, LoopAnalysisManager &LAM, LoopStandardAnalysisResults &LAR,
+                                             LPMUpdater &LU) {
+    LLVM_DEBUG(dbgs() << "---INIZIO PASSO LOOP STRENGTH REDUCTION " << L.getName() << "---\n");
+    OptimizationRemarkEmitter ORE(L.getHeader()->getParent());
+
+    // La PHI nuova ha bisogno di un preheader e di un solo latch
+    if (!L.isLoopSimplifyForm()) {
+        LLVM_DEBUG(dbgs() << "Il loop non è in forma normalizzata\n");
+        return PreservedAnalyses::all();
+    }
+    if (!reduceLoop(L, LAR, ORE))
+        return PreservedAnalyses::all();
+
+    // Il CFG non cambia e non vengono toccati accessi in memoria, quindi anche MemorySSA resta valida;
+    // ScalarEvolution ha dimenticato il loop
+    auto PA = getLoopPassPreservedAnalyses();
+    PA.preserveSet<CFGAnalyses>();
+    if (LAR.MSSA)
+        PA.preserve<MemorySSAAnalysis>();
+    return PA;
+}
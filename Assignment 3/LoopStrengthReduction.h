@@ -0,0 +1,13 @@
+#ifndef LLVM_TRANSFORMS_LOOPSTRENGTHREDUCTION_H
+#define LLVM_TRANSFORMS_LOOPSTRENGTHREDUCTION_H
+
+#include "llvm/IR/PassManager.h"
+#include <llvm/Transforms/Scalar/LoopPassManager.h>
+
+namespace llvm {
+	class LoopStrengthReduction : public PassInfoMixin<LoopStrengthReduction> {
+	public:
+		PreservedAnalyses run(Loop &L, LoopAnalysisManager &LAM, LoopStandardAnalysisResults &LAR, LPMUpdater &LU);
+	};
+}
+#endif //LLVM_TRANSFORMS_LOOPSTRENGTHREDUCTION_H
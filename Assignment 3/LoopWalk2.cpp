@@ -1,54 +1,175 @@
 #include "llvm/Transforms/Utils/LoopWalk2.h"
 #include "llvm/Analysis/LoopPass.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/AliasSetTracker.h"
+#include "llvm/Analysis/MemoryLocation.h"
+#include "llvm/Analysis/MemorySSA.h"
+#include "llvm/Analysis/MemorySSAUpdater.h"
+#include "llvm/Analysis/MustExecute.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/IR/Dominators.h"
 #include "llvm/Analysis/ValueTracking.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/LoopIterator.h"
+#include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/Support/GenericLoopInfo.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/DomTreeUpdater.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include <algorithm>
+
+#define DEBUG_TYPE "loopwalk2"
 
 using namespace llvm;
 
+// Contatori del passo, visibili con -stats
+STATISTIC(NumInvariant, "Numero di istruzioni loop-invariant identificate");
+STATISTIC(NumCandidates, "Numero di istruzioni candidate alla code motion");
+STATISTIC(NumHoisted, "Numero di istruzioni spostate nel preheader");
+STATISTIC(NumLoadsHoisted, "Numero di load spostate nel preheader");
+STATISTIC(NumPromoted, "Numero di locazioni di memoria promosse a registro");
+STATISTIC(NumSpeculated, "Numero di istruzioni spostate speculativamente nel preheader");
+STATISTIC(NumSunk, "Numero di istruzioni spostate nei blocchi di uscita");
+STATISTIC(NumKeptForPressure, "Numero di candidate lasciate nel loop dal modello di costo");
+STATISTIC(NumTrivialUnswitched, "Numero di branch invarianti spostati fuori dal loop");
+STATISTIC(NumUnswitched, "Numero di loop duplicati per una condizione invariante");
+
+static cl::opt<bool> EnableSpeculation(
+    "loopwalk2-speculate", cl::init(true), cl::Hidden,
+    cl::desc("Sposta nel preheader anche le invarianti dei blocchi condizionali, se eseguibili speculativamente"));
+
+static cl::opt<unsigned> SpeculationThreshold(
+    "loopwalk2-speculation-threshold", cl::init(2), cl::Hidden,
+    cl::desc("Costo massimo (TTI, TCK_SizeAndLatency) di un'istruzione spostata speculativamente"));
+
+static cl::opt<bool> EnableSinking(
+    "loopwalk2-sink", cl::init(true), cl::Hidden,
+    cl::desc("Sposta nei blocchi di uscita le istruzioni usate solo fuori dal loop"));
+
+static cl::opt<bool> EnablePressureModel(
+    "loopwalk2-pressure-aware", cl::init(true), cl::Hidden,
+    cl::desc("Limita le istruzioni spostate nel preheader in base ai registri disponibili sul target"));
+
+static cl::opt<unsigned> ReservedRegisters(
+    "loopwalk2-reserved-regs", cl::init(2), cl::Hidden,
+    cl::desc("Registri di ogni classe lasciati ai valori temporanei del corpo del loop"));
+
+static cl::opt<bool> EnableNestHoisting(
+    "loopwalk2-nest", cl::init(false), cl::Hidden,
+    cl::desc("Sposta le invarianti di tutto il nest nel preheader del loop più esterno in cui sono invarianti"));
+
+static cl::opt<bool> EnableUnswitching(
+    "loopwalk2-unswitch", cl::init(true), cl::Hidden,
+    cl::desc("Sposta fuori dal loop i branch su condizioni invarianti, duplicando il loop se necessario"));
+
+static cl::opt<unsigned> UnswitchThreshold(
+    "loopwalk2-unswitch-threshold", cl::init(50), cl::Hidden,
+    cl::desc("Dimensione massima (TTI, TCK_CodeSize) di un loop che può essere duplicato dall'unswitching"));
+
+// Attributo dei loop prodotti dall'unswitching, che non vengono duplicati di nuovo
+static const char *const UnswitchedAttr = "llvm.loop.loopwalk2.unswitched";
+
+// Funzione di supporto che stabilisce se una data istruzione può essere presa in considerazione
+// come loop-invariant: le PHI, i terminatori e i blocchi di gestione delle eccezioni restano nel loop.
+// Restano nel loop anche le istruzioni con effetti collaterali (store, chiamate che scrivono in
+// memoria o possono sollevare eccezioni), le alloca e le istruzioni che leggono la memoria,
+// con l'eccezione delle load semplici che vengono esaminate da isMemoryInvariant
+bool canBeInvariant(Instruction& Inst) {
+    if (isa<PHINode>(Inst) || Inst.isTerminator() || Inst.isEHPad() || isa<AllocaInst>(Inst))
+        return false;
+
+    if (Inst.mayHaveSideEffects())
+        return false;
+
+    if (auto *CB = dyn_cast<CallBase>(&Inst))
+        if (CB->isConvergent())
+            return false;
+
+    if (auto *LI = dyn_cast<LoadInst>(&Inst))
+        return LI->isSimple();
+
+    return !Inst.mayReadFromMemory();
+}
+
+// Scritture in memoria di un loop, raccolte una volta sola e usate quando MemorySSA non è disponibile.
+// L'AliasSetTracker le raggruppa in alias set e, quando diventano troppi, li fonde in un unico insieme
+// "may alias": ogni load interroga l'alias analysis solo contro gli insiemi, con un costo limitato
+// invece che proporzionale al numero di scritture del loop
+class LoopWriteSet {
+public:
+    LoopWriteSet(Loop& L, AAResults& AA) : BatchAA(AA), AST(BatchAA) {
+        for (BasicBlock *BB : L.blocks())
+            for (Instruction &I : *BB)
+                if (I.mayWriteToMemory())
+                    AST.add(&I);
+    }
+
+    bool mayModify(const MemoryLocation& Loc) {
+        for (AliasSet &AS : AST) {
+            if (AS.isForwardingAliasSet() || !AS.isMod())
+                continue;
+            if (AS.aliasesPointer(Loc.Ptr, Loc.Size, Loc.AATags, BatchAA) != AliasResult::NoAlias)
+                return true;
+        }
+        return false;
+    }
+
+private:
+    BatchAAResults BatchAA;
+    AliasSetTracker AST;
+};
+
+// Funzione di supporto che stabilisce se la memoria letta da una load non viene modificata nel loop.
+// Con MemorySSA basta controllare che l'accesso che la "clobbera" sia fuori dal loop; senza MemorySSA
+// si interrogano le scritture del loop, raccolte in writeSet alla prima load esaminata
+bool isMemoryInvariant(LoadInst& LI, Loop& L, LoopStandardAnalysisResults& LAR,
+                       std::unique_ptr<LoopWriteSet>& writeSet) {
+    if (LI.hasMetadata(LLVMContext::MD_invariant_load))
+        return true;
+
+    if (MemorySSA *MSSA = LAR.MSSA) {
+        MemoryAccess *Clobber = MSSA->getWalker()->getClobberingMemoryAccess(&LI);
+        return MSSA->isLiveOnEntryDef(Clobber) || !L.contains(Clobber->getBlock());
+    }
+
+    if (!writeSet)
+        writeSet = std::make_unique<LoopWriteSet>(L, LAR.AA);
+    return !writeSet->mayModify(MemoryLocation::get(&LI));
+}
+
 // Funzione di supporto che stabilisce se una data istruzione è loop-invariant
-bool isLoopInvariant(Loop& L, const std::vector <Instruction*> &invariantInstructions, Instruction& Inst) {
-    // Variabile di supporto per il check del loop invariant
-	bool isInvariant = true;
-
-    // Itero per ogni operatore dell'istruzione
-	for (auto* Iter = Inst.op_begin(); Iter != Inst.op_end(); ++Iter) {
-		// Ottengo l'operando
-		Value* Operand = *Iter;
-
-        // Controllo se l'operando op è una costante, allora potrebbe essere invariant
-		if (ConstantInt* C = dyn_cast<ConstantInt>(Operand)) { 
-			isInvariant = true; 
-		}
-		else if (Instruction* I = dyn_cast<Instruction>(Operand)) { //controllo l'istruzione generatrice
-            // Se non è costante, allora bisogna ragionare su due casi
-            // CASO 1: per ogni istruzione del tipo A = B + C l'istruzione è loop-invariant
-            // se Tutte le definizioni di B e C che raggiungono l’istruzione A = B + C si trovano FUORI dal loop
-            // CASO 2: c’è esattamente una reaching definition per B (e C), e si tratta di un’istruzione del loop che è stata 
-            // marcata loop-invariant
-
-            // CASO 1: Controllo se il Basic Block padre è nel Loop
-			// Ottengo il Basic Block dell'istruzione e controllo se è nel loop
-			if (L.contains(I->getParent())) {
-				isInvariant = false; 
-
-                // CASO 2
-                // Scorro per tutte le istruzioni nel vettore invariantInstructions
-				for (const Instruction* inst : invariantInstructions) {
-					if (inst == I) 
-						isInvariant = true; 	
-				}
-			}
-			else
-				isInvariant = true;
-		}
-		if (!isInvariant)
-			return false;
-	}
-	return true;
+bool isLoopInvariant(Loop& L, const SmallPtrSetImpl<Instruction*> &invariantSet, Instruction& Inst) {
+    // Itero per ogni operando dell'istruzione
+    for (Value* Operand : Inst.operands()) {
+        // Costanti, argomenti e valori definiti fuori dal loop sono sempre invarianti.
+        // Per ogni istruzione del tipo A = B + C l'istruzione è loop-invariant se:
+        // CASO 1: tutte le definizioni di B e C che raggiungono l'istruzione si trovano FUORI dal loop
+        // CASO 2: c'è esattamente una reaching definition per B (e C), e si tratta di un'istruzione
+        // del loop che è stata marcata loop-invariant
+        Instruction* I = dyn_cast<Instruction>(Operand);
+        if (!I || !L.contains(I))
+            continue;
+
+        // CASO 2: la ricerca nell'insieme delle invarianti è in tempo costante
+        if (!invariantSet.count(I))
+            return false;
+    }
+    return true;
 }
 
 // Funzione di supporto che ritorna true se basicBlock domina tutti i basic blocks di uscita dal loop
@@ -67,21 +188,16 @@ bool dominatesAllExit(BasicBlock* basicBlock, const SmallVector<BasicBlock*>& ex
 // Funzione di supporto che ritorna true se l'istruzione candidata domina tutti i blochi nel loop
 // che usano la variabile a cui si sta assegnando un valore
 bool dominatesAllUses(Instruction* inst, Loop& L, DominatorTree& DT){
-    BasicBlock* basicBlock = inst->getParent();
-    Value* assignedValue = inst;
-    
-    // Scorro per tutti gli user che usa l'istruzione I
-    for(auto *user : assignedValue->users()){
-        if (Instruction* userInst = dyn_cast<Instruction>(user)){
-            // Prendo il basic block in cui è definita l'istruzione user
-            BasicBlock* userBB = userInst->getParent();
-
-            // Controllo se il basic block dell'uso è contenuto nel loop
-            if (L.contains(userBB)){
-                // Verifichiamo se il blocco basicBlock domina il blocco dell'uso
-                if (!DT.properlyDominates(basicBlock, userBB))
-                    return false;
-            }
+    // Scorro per tutti gli usi dell'istruzione
+    for (Use &U : inst->uses()){
+        Instruction* userInst = dyn_cast<Instruction>(U.getUser());
+
+        // Controllo se l'uso è contenuto nel loop
+        if (userInst && L.contains(userInst)){
+            // La dominanza è verificata sulle istruzioni: un uso che segue la definizione nello
+            // stesso blocco è dominato, mentre per le PHI conta l'arco da cui arriva il valore
+            if (!DT.dominates(inst, U))
+                return false;
         }
     }
 
@@ -89,68 +205,595 @@ bool dominatesAllUses(Instruction* inst, Loop& L, DominatorTree& DT){
     return true;
 }
 
-// Funzione di supporto che stabilisce se una istruzione candidata possa essere effettivamente spostata nel preheader
-bool allDependenciesMoved(Instruction* inst, std::vector<Instruction*>& candidateInst, Loop& L){
+// Funzione di supporto che stabilisce se una istruzione candidata possa essere effettivamente spostata nel preheader:
+// ogni operando definito nel loop deve essere a sua volta una candidata ancora da spostare
+bool allDependenciesMoved(Instruction* inst, const SmallPtrSetImpl<Instruction*>& candidateSet, Loop& L){
     // Per ogni operando dell'istruzione
     for (Value* op : inst->operands()){
         if (Instruction* opInst = dyn_cast<Instruction>(op)){
-            bool found = false;
-            // Controllo se l'istruzione è nel loop
-            if (L.contains(opInst)){
-                // Controlliamo se l'istruzione è da spostare (deve appartenere al vettore)
-                for (auto *inst : candidateInst){
-                    if (inst == opInst){
-                        found = true;
-                        break; // L'istruzione è stata trovata, si procede con il prossimo operando
-                    }
+            // Le istruzioni già spostate non appartengono più al loop
+            if (L.contains(opInst) && !candidateSet.count(opInst))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+// Funzione di supporto che stabilisce se un'istruzione invariante, che non è eseguita a ogni
+// iterazione, può essere spostata speculativamente nel preheader
+bool canSpeculate(Instruction* inst, Loop& L, TargetTransformInfo& TTI) {
+    if (!EnableSpeculation)
+        return false;
+
+    // Il punto di esecuzione è la fine del preheader
+    if (!isSafeToSpeculativelyExecute(inst, L.getLoopPreheader()->getTerminator()))
+        return false;
+
+    InstructionCost Cost = TTI.getInstructionCost(inst, TargetTransformInfo::TCK_SizeAndLatency);
+    return Cost.isValid() && Cost <= SpeculationThreshold;
+}
+
+// Funzione di supporto che identifica tutte le istruzioni loop-invariant.
+// I blocchi sono visitati in reverse post-order, così (escluse le PHI) ogni definizione è visitata
+// prima dei suoi usi. Quando un'istruzione diventa invariante, gli user già visitati e scartati
+// vengono rimessi nella worklist: ogni istruzione è riesaminata al più una volta per operando,
+// quindi l'insieme completo si ottiene con una visita lineare.
+// Le invarianti sono restituite nell'ordine in cui sono state scoperte, che rispetta le dipendenze
+void findLoopInvariants(Loop& L, LoopStandardAnalysisResults& LAR, std::vector<Instruction*>& invariantInstructions,
+                        SmallPtrSetImpl<Instruction*>& invariantSet) {
+    LoopBlocksRPO RPOT(&L);
+    RPOT.perform(&LAR.LI);
+
+    SmallPtrSet<Instruction*, 32> visited;
+    SmallVector<Instruction*, 16> worklist;
+    std::unique_ptr<LoopWriteSet> writeSet;
+
+    int i = 1; // Per contare i blocchi
+    for (BasicBlock* BB : RPOT) {
+        LLVM_DEBUG(dbgs() << "Blocco" << i << "\n");
+
+        // Itero per ogni istruzione nel basic block
+        for (auto &inst : *BB) {
+            LLVM_DEBUG(dbgs() << inst << "\n");
+            visited.insert(&inst);
+            worklist.push_back(&inst);
+
+            while (!worklist.empty()) {
+                Instruction* I = worklist.pop_back_val();
+
+                // Controllo se I è una loop-invariant
+                if (invariantSet.count(I) || !canBeInvariant(*I) || !isLoopInvariant(L, invariantSet, *I))
+                    continue;
+
+                // Una load è invariante solo se la memoria che legge non cambia durante il loop
+                if (auto *LI = dyn_cast<LoadInst>(I))
+                    if (!isMemoryInvariant(*LI, L, LAR, writeSet))
+                        continue;
+
+                invariantSet.insert(I);
+                invariantInstructions.push_back(I);
+
+                // Gli user nel loop già visitati vanno riesaminati
+                for (User* user : I->users()) {
+                    Instruction* userInst = dyn_cast<Instruction>(user);
+                    if (userInst && visited.count(userInst) && !invariantSet.count(userInst))
+                        worklist.push_back(userInst);
                 }
+            }
+        }
+
+        i++;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// PROMOZIONE SCALARE
+// Una locazione di memoria letta e scritta a ogni iterazione tramite un puntatore
+// invariante viene tenuta in un registro: il valore iniziale è letto nel preheader,
+// gli accessi nel loop diventano valori SSA e il valore finale viene scritto una
+// sola volta in ogni blocco di uscita.
+// ---------------------------------------------------------------------------
+
+// Funzione di supporto che rispetta la forma LCSSA: un valore calcolato nel loop
+// e usato in un blocco di uscita deve passare da una PHI di quel blocco
+static Value *getLCSSAValue(Value *V, BasicBlock *ExitBlock, Loop &L) {
+    Instruction *I = dyn_cast<Instruction>(V);
+    if (!I || !L.contains(I))
+        return V;
+
+    PHINode *PN = PHINode::Create(I->getType(), pred_size(ExitBlock), I->getName() + ".lcssa", &ExitBlock->front());
+    for (BasicBlock *Pred : predecessors(ExitBlock))
+        PN->addIncoming(I, Pred);
+    return PN;
+}
 
-                if (!found)
-                    return false;
+// Promotore: riscrive load e store del loop con SSAUpdater e aggiunge la scrittura
+// finale nei blocchi di uscita, tenendo aggiornata MemorySSA se disponibile
+class ScalarPromoter : public LoadAndStorePromoter {
+    Value *Ptr;
+    ArrayRef<BasicBlock*> ExitBlocks;
+    Align Alignment;
+    Loop &L;
+    SSAUpdater &SSA;
+    ScalarEvolution &SE;
+    MemorySSAUpdater *MSSAU;
+
+public:
+    ScalarPromoter(ArrayRef<const Instruction*> Insts, SSAUpdater &S, Value *Ptr, ArrayRef<BasicBlock*> ExitBlocks,
+                   Align Alignment, Loop &L, ScalarEvolution &SE, MemorySSAUpdater *MSSAU)
+        : LoadAndStorePromoter(Insts, S), Ptr(Ptr), ExitBlocks(ExitBlocks), Alignment(Alignment), L(L), SSA(S),
+          SE(SE), MSSAU(MSSAU) {}
+
+    void doExtraRewritesBeforeFinalDeletion() override {
+        for (BasicBlock *ExitBlock : ExitBlocks) {
+            Value *LiveOut = getLCSSAValue(SSA.GetValueInMiddleOfBlock(ExitBlock), ExitBlock, L);
+            StoreInst *NewSI = new StoreInst(LiveOut, Ptr, &*ExitBlock->getFirstInsertionPt());
+            NewSI->setAlignment(Alignment);
+
+            if (MSSAU) {
+                MemoryAccess *NewMA = MSSAU->createMemoryAccessInBB(NewSI, nullptr, ExitBlock, MemorySSA::Beginning);
+                MSSAU->insertDef(cast<MemoryDef>(NewMA), /*RenameUses=*/true);
             }
         }
     }
 
+    void instructionDeleted(Instruction *I) const override {
+        SE.forgetValue(I);
+        if (MSSAU)
+            MSSAU->removeMemoryAccess(I);
+    }
+};
+
+// Funzione di supporto che promuove a registro le locazioni del loop che lo permettono.
+// Una locazione è promuovibile se:
+// - è acceduta solo da load e store semplici dello stesso tipo tramite un puntatore definito fuori dal loop
+// - almeno una store è eseguita sicuramente a ogni ingresso nel loop (quindi il puntatore è valido
+//   e scrivere nei blocchi di uscita non introduce scritture che il programma non farebbe)
+// - nessun'altra istruzione del loop può leggerla o modificarla
+bool promoteLoopAccesses(Loop& L, LoopStandardAnalysisResults& LAR, LoopSafetyInfo& SafetyInfo,
+                         MemorySSAUpdater *MSSAU, OptimizationRemarkEmitter& ORE) {
+    BasicBlock *preHeader = L.getLoopPreheader();
+    if (!preHeader)
+        return false;
+
+    // Con un'eccezione il valore non arriverebbe mai in memoria
+    if (SafetyInfo.anyBlockMayThrow())
+        return false;
+
+    SmallVector<BasicBlock*, 8> exitBlocks;
+    L.getUniqueExitBlocks(exitBlocks);
+    for (BasicBlock *exitBlock : exitBlocks) {
+        if (exitBlock->isEHPad())
+            return false;
+    }
+
+    // Raggruppo gli accessi per puntatore, tenendo da parte tutte le istruzioni che toccano la memoria
+    MapVector<Value*, SmallVector<Instruction*, 4>> accessesByPtr;
+    SmallVector<Instruction*, 16> memoryInsts;
+    for (BasicBlock *BB : L.blocks()) {
+        for (Instruction &I : *BB) {
+            if (!I.mayReadOrWriteMemory())
+                continue;
+            memoryInsts.push_back(&I);
+
+            Value *Ptr = nullptr;
+            if (auto *LI = dyn_cast<LoadInst>(&I)) {
+                if (LI->isSimple())
+                    Ptr = LI->getPointerOperand();
+            } else if (auto *SI = dyn_cast<StoreInst>(&I)) {
+                if (SI->isSimple() && SI->getValueOperand() != SI->getPointerOperand())
+                    Ptr = SI->getPointerOperand();
+            }
+
+            Instruction *PtrInst = Ptr ? dyn_cast<Instruction>(Ptr) : nullptr;
+            if (Ptr && !(PtrInst && L.contains(PtrInst)))
+                accessesByPtr[Ptr].push_back(&I);
+        }
+    }
+
+    bool Changed = false;
+    for (auto &Entry : accessesByPtr) {
+        Value *Ptr = Entry.first;
+        SmallVector<Instruction*, 4> &accesses = Entry.second;
+
+        // Tutti gli accessi devono avere lo stesso tipo, e una store deve essere eseguita sicuramente
+        Type *AccessTy = getLoadStoreType(accesses.front());
+        StoreInst *guaranteedStore = nullptr;
+        bool sameType = true;
+        for (Instruction *I : accesses) {
+            sameType &= getLoadStoreType(I) == AccessTy;
+            auto *SI = dyn_cast<StoreInst>(I);
+            if (SI && !guaranteedStore && SafetyInfo.isGuaranteedToExecute(*SI, &LAR.DT, &L))
+                guaranteedStore = SI;
+        }
+        if (!sameType || !guaranteedStore || isa<ScalableVectorType>(AccessTy))
+            continue;
+
+        // Nessun'altra istruzione del loop può accedere alla locazione
+        MemoryLocation Loc = MemoryLocation::get(guaranteedStore).getWithoutAATags();
+        SmallPtrSet<Instruction*, 8> accessSet(accesses.begin(), accesses.end());
+        bool aliased = false;
+        for (Instruction *I : memoryInsts) {
+            if (!accessSet.count(I) && isModOrRefSet(LAR.AA.getModRefInfo(I, Loc))) {
+                aliased = true;
+                break;
+            }
+        }
+        if (aliased)
+            continue;
+
+        LLVM_DEBUG(dbgs() << "Promuovo a registro la locazione " << *Ptr << "\n");
+        ORE.emit([&]() {
+            return OptimizationRemark(DEBUG_TYPE, "PromoteLoopAccessesToScalar", guaranteedStore)
+                   << "locazione di memoria promossa a registro";
+        });
+
+        // Valore iniziale letto nel preheader
+        SmallVector<const Instruction*, 4> constAccesses(accesses.begin(), accesses.end());
+        SmallVector<PHINode*, 16> newPHIs;
+        SSAUpdater SSA(&newPHIs);
+        ScalarPromoter promoter(constAccesses, SSA, Ptr, exitBlocks, guaranteedStore->getAlign(), L, LAR.SE, MSSAU);
+
+        LoadInst *preLoad = new LoadInst(AccessTy, Ptr, Ptr->getName() + ".promoted", /*isVolatile=*/false,
+                                         guaranteedStore->getAlign(), preHeader->getTerminator());
+        SSA.AddAvailableValue(preHeader, preLoad);
+        if (MSSAU) {
+            MemoryAccess *NewMA = MSSAU->createMemoryAccessInBB(preLoad, nullptr, preHeader, MemorySSA::End);
+            MSSAU->insertUse(cast<MemoryUse>(NewMA), /*RenameUses=*/true);
+        }
+
+        promoter.run(accesses);
+
+        // Se nessun uso nel loop ha avuto bisogno del valore iniziale, la load è superflua
+        if (preLoad->use_empty()) {
+            if (MSSAU)
+                MSSAU->removeMemoryAccess(preLoad);
+            preLoad->eraseFromParent();
+        }
+
+        ++NumPromoted;
+        Changed = true;
+    }
+
+    return Changed;
+}
+
+// ---------------------------------------------------------------------------
+// SPOSTAMENTO NEI BLOCCHI DI USCITA
+// Un'istruzione del loop il cui risultato è usato solo dopo il loop (in forma
+// LCSSA: solo dalle PHI dei blocchi di uscita) viene calcolata una sola volta
+// in ogni blocco di uscita, invece che a ogni iterazione.
+// ---------------------------------------------------------------------------
+
+// Funzione di supporto che ritorna true se PN è una PHI LCSSA di V, cioè riceve V da ogni predecessore
+static bool isLCSSAPhiOf(PHINode *PN, Value *V) {
+    return all_of(PN->incoming_values(), [V](Value *Incoming) { return Incoming == V; });
+}
+
+// Funzione di supporto che ritorna il valore di V nel blocco di uscita, riusando la PHI LCSSA
+// già presente oppure creandone una nuova
+static Value *getExitValue(Value *V, BasicBlock *ExitBlock, Loop &L) {
+    Instruction *I = dyn_cast<Instruction>(V);
+    if (!I || !L.contains(I))
+        return V;
+
+    for (PHINode &PN : ExitBlock->phis()) {
+        if (isLCSSAPhiOf(&PN, V))
+            return &PN;
+    }
+    return getLCSSAValue(V, ExitBlock, L);
+}
+
+// Funzione di supporto che stabilisce se un'istruzione del loop può essere spostata nei blocchi di uscita
+static bool canSinkToExitBlocks(Instruction &I, Loop &L, LoopStandardAnalysisResults &LAR,
+                                std::unique_ptr<LoopWriteSet> &writeSet) {
+    if (isa<PHINode>(I) || I.isTerminator() || I.isEHPad() || isa<AllocaInst>(I) || I.mayHaveSideEffects())
+        return false;
+
+    if (auto *CB = dyn_cast<CallBase>(&I))
+        if (CB->isConvergent())
+            return false;
+
+    // Una load può essere ritardata solo se nessuna istruzione del loop scrive la sua memoria
+    if (I.mayReadFromMemory()) {
+        auto *LI = dyn_cast<LoadInst>(&I);
+        if (!LI || !LI->isSimple() || !isMemoryInvariant(*LI, L, LAR, writeSet))
+            return false;
+    }
+
+    // Tutti gli usi devono essere PHI LCSSA dei blocchi di uscita
+    if (I.use_empty())
+        return false;
+    for (User *U : I.users()) {
+        auto *PN = dyn_cast<PHINode>(U);
+        if (!PN || L.contains(PN) || !isLCSSAPhiOf(PN, &I))
+            return false;
+    }
     return true;
 }
 
-bool runOnLoop2(Loop &L, LoopAnalysisManager &LAM, LoopStandardAnalysisResults &LAR, LPMUpdater &LU) {
-    // PASSO 1
-    // Controllo se il loop è nella forma NORMALIZZATA
-    if (!L.isLoopSimplifyForm()) {
-        errs() << "Il loop non è in forma normalizzata\n";
+// Funzione di supporto che sposta nei blocchi di uscita le istruzioni usate solo fuori dal loop.
+// Le istruzioni sono visitate al contrario: quando un'istruzione viene spostata, i suoi operandi
+// calcolati nel loop diventano usati solo dalle nuove PHI LCSSA e possono essere spostati a loro volta
+bool sinkToExitBlocks(Loop& L, LoopStandardAnalysisResults& LAR, MemorySSAUpdater *MSSAU,
+                      OptimizationRemarkEmitter& ORE) {
+    // I blocchi di uscita devono avere solo predecessori nel loop (garantito dalla forma normalizzata)
+    if (!L.hasDedicatedExits())
         return false;
+
+    LoopBlocksRPO RPOT(&L);
+    RPOT.perform(&LAR.LI);
+
+    SmallVector<Instruction*, 32> worklist;
+    for (BasicBlock *BB : RPOT) {
+        // Solo le istruzioni del loop corrente: quelle dei sotto-loop escono tramite le loro PHI LCSSA
+        if (LAR.LI.getLoopFor(BB) != &L)
+            continue;
+        for (Instruction &I : *BB)
+            worklist.push_back(&I);
     }
 
-    // PASSO 2: identifico tutte le istruzioni loop-invariant
+    bool Changed = false;
+    std::unique_ptr<LoopWriteSet> writeSet;
+    while (!worklist.empty()) {
+        Instruction *I = worklist.pop_back_val();
+        if (!canSinkToExitBlocks(*I, L, LAR, writeSet))
+            continue;
 
-    // Vettore di istruzioni che memorizza le istruzioni loop-invariant
-    std::vector <Instruction*> invariantInstructions;
+        LLVM_DEBUG(dbgs() << "Sposto nei blocchi di uscita l'istruzione " << *I << "\n");
+        ORE.emit([&]() {
+            return OptimizationRemark(DEBUG_TYPE, "Sunk", I)
+                   << "istruzione usata solo dopo il loop spostata nei blocchi di uscita";
+        });
 
-    // Itero sui basic block del loop
-    int i = 1; // Per contare i blocchi
-    for (auto blockIterator = L.block_begin(); blockIterator != L.block_end(); ++blockIterator) {
-        BasicBlock *BasicBlock = *blockIterator;
-        outs() << "Blocco" << i << "\n";
+        // Una copia per ogni PHI LCSSA, che viene sostituita dalla copia stessa
+        SmallVector<PHINode*, 4> lcssaPhis;
+        for (User *U : I->users())
+            lcssaPhis.push_back(cast<PHINode>(U));
 
-        // Itero per ogni istruzione nel basic block
-        for (auto &inst : *BasicBlock) {
-            outs() << inst << "\n";  
+        for (PHINode *PN : lcssaPhis) {
+            BasicBlock *ExitBlock = PN->getParent();
+            Instruction *Clone = I->clone();
+            Clone->setName(I->getName());
+            Clone->insertBefore(&*ExitBlock->getFirstInsertionPt());
+
+            for (Use &Op : Clone->operands())
+                Op.set(getExitValue(Op.get(), ExitBlock, L));
+
+            if (MSSAU && isa<LoadInst>(Clone)) {
+                MemoryAccess *NewMA = MSSAU->createMemoryAccessInBB(Clone, nullptr, ExitBlock, MemorySSA::Beginning);
+                MSSAU->insertUse(cast<MemoryUse>(NewMA), /*RenameUses=*/true);
+            }
 
-            // Controllo se inst è una loop-invariant
-            if (isLoopInvariant(L, invariantInstructions, inst))       
-                invariantInstructions.push_back(&inst);                                                          
+            PN->replaceAllUsesWith(Clone);
+            LAR.SE.forgetValue(PN);
+            PN->eraseFromParent();
         }
 
-        i++;
+        if (MSSAU)
+            MSSAU->removeMemoryAccess(I);
+        LAR.SE.forgetValue(I);
+        I->eraseFromParent();
+        ++NumSunk;
+        Changed = true;
     }
 
-    // Stampa di debug delle istruzioni invariant
-    outs() << "---STAMPA ISTRUZIONI INVARIANT IDENTIFICATE---\n";
-    for (auto *inst : invariantInstructions){
-        outs() <<"Istruzione: "<< *inst << "\n";
+    return Changed;
+}
+
+// ---------------------------------------------------------------------------
+// MODELLO DI COSTO DELLO SPOSTAMENTO
+// Ogni istruzione spostata nel preheader il cui risultato è ancora usato nel loop
+// diventa un valore vivo per tutta la durata del loop. Le candidate vengono
+// ordinate per guadagno (costo risparmiato a ogni iterazione, pesato con la
+// frequenza del blocco) e spostate finché i valori vivi attraverso il loop
+// restano entro i registri della loro classe (TTI). Le altre restano nel loop e
+// vengono ricalcolate a ogni iterazione.
+// ---------------------------------------------------------------------------
+
+// Funzione di supporto che ritorna la classe di registri di un valore
+static unsigned getRegisterClass(Value* V, TargetTransformInfo& TTI) {
+    return TTI.getRegisterClassForType(V->getType()->isVectorTy(), V->getType());
+}
+
+// Funzione di supporto che conta, per classe di registri, i valori già vivi attraverso il loop:
+// i valori definiti fuori e usati dentro il loop, e le PHI dell'header che passano da un'iterazione all'altra
+static void countLiveAcrossLoop(Loop& L, TargetTransformInfo& TTI, DenseMap<unsigned, int>& liveAcross) {
+    SmallPtrSet<Value*, 32> liveIns;
+    for (BasicBlock* BB : L.blocks()) {
+        for (Instruction& I : *BB) {
+            for (Value* op : I.operands()) {
+                auto* opInst = dyn_cast<Instruction>(op);
+                bool definedOutside = (opInst && !L.contains(opInst)) || isa<Argument>(op);
+                if (definedOutside && liveIns.insert(op).second)
+                    liveAcross[getRegisterClass(op, TTI)]++;
+            }
+        }
+    }
+
+    for (PHINode& PN : L.getHeader()->phis())
+        liveAcross[getRegisterClass(&PN, TTI)]++;
+}
+
+// Funzione di supporto che stima quante volte il blocco viene eseguito per ogni iterazione del loop,
+// in sedicesimi: con BlockFrequencyInfo si usa il rapporto con la frequenza dell'header, altrimenti
+// un blocco che domina il latch vale un'esecuzione per iterazione e un blocco condizionale mezza
+static uint64_t getIterationWeight(BasicBlock* BB, Loop& L, LoopStandardAnalysisResults& LAR) {
+    if (LAR.BFI) {
+        uint64_t headerFreq = LAR.BFI->getBlockFreq(L.getHeader()).getFrequency();
+        uint64_t blockFreq = LAR.BFI->getBlockFreq(BB).getFrequency();
+        if (headerFreq != 0)
+            return std::max<uint64_t>(1, blockFreq * 16 / headerFreq);
+    }
+    return LAR.DT.dominates(BB, L.getLoopLatch()) ? 16 : 8;
+}
+
+// Funzione di supporto che seleziona le candidate da spostare nel rispetto del budget di registri.
+// Le candidate escluse vengono tolte da candidateSet
+void selectProfitableCandidates(Loop& L, LoopStandardAnalysisResults& LAR, const std::vector<Instruction*>& candidateInst,
+                                SmallPtrSetImpl<Instruction*>& candidateSet, OptimizationRemarkEmitter& ORE) {
+    TargetTransformInfo& TTI = LAR.TTI;
+
+    // Guadagno di ogni candidata: costo di un'esecuzione per esecuzioni in un'iterazione
+    DenseMap<Instruction*, InstructionCost> benefit;
+    for (Instruction* inst : candidateInst) {
+        InstructionCost cost = TTI.getInstructionCost(inst, TargetTransformInfo::TCK_RecipThroughput);
+        benefit[inst] = cost.isValid() ? cost * getIterationWeight(inst->getParent(), L, LAR) : InstructionCost(0);
     }
 
+    std::vector<Instruction*> ranked(candidateInst.begin(), candidateInst.end());
+    std::stable_sort(ranked.begin(), ranked.end(), [&](Instruction* A, Instruction* B) {
+        return benefit[B] < benefit[A];
+    });
+
+    // Registri ancora disponibili per classe
+    DenseMap<unsigned, int> liveAcross;
+    countLiveAcrossLoop(L, TTI, liveAcross);
+    auto exceedsBudget = [&](unsigned regClass, int live) {
+        return live + int(ReservedRegisters) > int(TTI.getNumberOfRegisters(regClass));
+    };
+
+    // Per ogni istruzione selezionata, usi nel loop da parte di istruzioni che restano nel loop:
+    // finché sono più di zero il valore è vivo attraverso il loop
+    SmallPtrSet<Instruction*, 32> selected;
+    DenseMap<Instruction*, unsigned> pendingUses;
+
+    for (Instruction* inst : ranked) {
+        if (selected.count(inst) || !(benefit[inst] > 0))
+            continue;
+
+        // Insieme da spostare: la candidata e le candidate del loop da cui dipende
+        SmallVector<Instruction*, 8> group;
+        SmallPtrSet<Instruction*, 8> inGroup;
+        group.push_back(inst);
+        inGroup.insert(inst);
+        bool movable = true;
+        for (unsigned idx = 0; idx < group.size() && movable; ++idx) {
+            for (Value* op : group[idx]->operands()) {
+                auto* opInst = dyn_cast<Instruction>(op);
+                if (!opInst || !L.contains(opInst) || selected.count(opInst) || inGroup.count(opInst))
+                    continue;
+                if (!candidateSet.count(opInst)) {
+                    movable = false;
+                    break;
+                }
+                group.push_back(opInst);
+                inGroup.insert(opInst);
+            }
+        }
+        if (!movable)
+            continue;
+
+        // Variazione dei valori vivi attraverso il loop se il gruppo venisse spostato
+        DenseMap<unsigned, int> delta;
+        DenseMap<Instruction*, unsigned> groupUses;
+        DenseMap<Instruction*, unsigned> consumedUses;
+        for (Instruction* member : group) {
+            unsigned remaining = 0;
+            for (User* user : member->users()) {
+                auto* userInst = dyn_cast<Instruction>(user);
+                if (userInst && L.contains(userInst) && !selected.count(userInst) && !inGroup.count(userInst))
+                    remaining++;
+            }
+            groupUses[member] = remaining;
+            if (remaining > 0)
+                delta[getRegisterClass(member, TTI)]++;
+
+            // Gli operandi già selezionati usati solo dal gruppo smettono di essere vivi
+            for (Value* op : member->operands()) {
+                auto* opInst = dyn_cast<Instruction>(op);
+                if (opInst && selected.count(opInst) && ++consumedUses[opInst] == pendingUses[opInst])
+                    delta[getRegisterClass(opInst, TTI)]--;
+            }
+        }
+
+        bool fits = true;
+        for (auto& entry : delta) {
+            if (entry.second > 0 && exceedsBudget(entry.first, liveAcross[entry.first] + entry.second))
+                fits = false;
+        }
+        if (!fits) {
+            LLVM_DEBUG(dbgs() << "Registri esauriti, l'istruzione " << *inst << " resta nel loop\n");
+            ORE.emit([&]() {
+                return OptimizationRemarkMissed(DEBUG_TYPE, "RegisterPressure", inst)
+                       << "istruzione invariante lasciata nel loop: spostarla supererebbe i registri disponibili";
+            });
+            continue;
+        }
+
+        for (Instruction* member : group) {
+            selected.insert(member);
+            pendingUses[member] = groupUses[member];
+        }
+        for (auto& entry : consumedUses)
+            pendingUses[entry.first] -= entry.second;
+        for (auto& entry : delta)
+            liveAcross[entry.first] += entry.second;
+    }
+
+    for (Instruction* inst : candidateInst) {
+        if (!selected.count(inst)) {
+            candidateSet.erase(inst);
+            ++NumKeptForPressure;
+        }
+    }
+}
+
+// Funzione di supporto che sposta un'istruzione alla fine del preheader di L, tenendo aggiornata MemorySSA
+void moveToPreheader(Instruction* inst, Loop& L, bool speculated, LoopStandardAnalysisResults& LAR,
+                     MemorySSAUpdater *MSSAU, OptimizationRemarkEmitter& ORE) {
+    BasicBlock *preHeader = L.getLoopPreheader();
+
+    LLVM_DEBUG(dbgs() << "L'istruzione "<< *inst << " può essere spostata nel preheader\n");
+    ORE.emit([&]() {
+        if (speculated)
+            return OptimizationRemark(DEBUG_TYPE, "Speculated", inst)
+                   << "istruzione loop-invariant spostata speculativamente nel preheader";
+        return OptimizationRemark(DEBUG_TYPE, "Hoisted", inst)
+               << "istruzione loop-invariant spostata nel preheader";
+    });
+
+    // ScalarEvolution tiene in cache le espressioni dell'istruzione e la loro relazione con i loop
+    LAR.SE.forgetValue(inst);
+    inst->moveBefore(preHeader->getTerminator());
+
+    // I metadati (!range, !nonnull, ...) valevano solo sul percorso condizionale
+    if (speculated) {
+        inst->dropUnknownNonDebugMetadata();
+        ++NumSpeculated;
+    }
+    if (MSSAU) {
+        if (MemoryUseOrDef *MA = LAR.MSSA->getMemoryAccess(inst))
+            MSSAU->moveToPlace(MA, preHeader, MemorySSA::BeforeTerminator);
+    }
+    ++NumHoisted;
+    if (isa<LoadInst>(inst))
+        ++NumLoadsHoisted;
+}
+
+// Funzione di supporto che sposta nel preheader le istruzioni invarianti del solo loop L
+bool hoistLoopInvariants(Loop& L, LoopStandardAnalysisResults& LAR, LoopSafetyInfo& SafetyInfo,
+                         MemorySSAUpdater *MSSAU, OptimizationRemarkEmitter& ORE) {
+    bool Changed = false;
+
+    // PASSO 2: identifico tutte le istruzioni loop-invariant
+
+    // Vettore di istruzioni che memorizza le istruzioni loop-invariant (in ordine di scoperta)
+    // e insieme usato per i test di appartenenza
+    std::vector <Instruction*> invariantInstructions;
+    SmallPtrSet<Instruction*, 32> invariantSet;
+    findLoopInvariants(L, LAR, invariantInstructions, invariantSet);
+
+    NumInvariant += invariantInstructions.size();
+
+    // Stampa di debug delle istruzioni invariant
+    LLVM_DEBUG({
+        dbgs() << "---STAMPA ISTRUZIONI INVARIANT IDENTIFICATE---\n";
+        for (auto *inst : invariantInstructions)
+            dbgs() << "Istruzione: " << *inst << "\n";
+    });
+
     // PASSO 3: identifico le istruzioni candidate alla code-motion
     // Tra tutte le possibili istruzioni loop-invariant quelle candidate alla code motion sono quelle:
     // - loop invariant
@@ -158,9 +801,17 @@ bool runOnLoop2(Loop &L, LoopAnalysisManager &LAM, LoopStandardAnalysisResults &
     // - assegnano un valore a variabili non assegnate altrove nel loop
     // - si trovano in blocchi che dominano tutti i blocchi nel loop che usano la variabile
     //   a cui si sta assegnando un valore
+    // Le load, e ogni istruzione che non si può eseguire speculativamente (per esempio una
+    // divisione per un divisore che può essere zero), devono inoltre essere eseguite sicuramente
+    // a ogni ingresso nel loop: dominare le uscite non basta se prima c'è una chiamata che può
+    // non ritornare o se il loop non ha uscite.
+    // Un'istruzione che non soddisfa queste condizioni può comunque essere spostata
+    // speculativamente, se eseguirla quando il loop non l'avrebbe eseguita non ha effetti
+    // (isSafeToSpeculativelyExecute) e il suo costo non supera la soglia
 
-    // Vettore che memorizza le istruzioni candidate alla code-motion
+    // Vettore che memorizza le istruzioni candidate alla code-motion e relativo insieme
     std::vector <Instruction*> candidateInst;
+    SmallPtrSet<Instruction*, 32> candidateSet;
 
     // Dominance Tree
     DominatorTree &DT = LAR.DT;
@@ -169,46 +820,545 @@ bool runOnLoop2(Loop &L, LoopAnalysisManager &LAM, LoopStandardAnalysisResults &
     SmallVector<BasicBlock*> exitLoopBlocks;
 	L.getExitBlocks(exitLoopBlocks);
 
+    // Istruzioni candidate che verranno eseguite speculativamente
+    SmallPtrSet<Instruction*, 16> speculatedSet;
+
     for (auto *inst : invariantInstructions){
         // Ottengo il basic block in sui si trova l'istruzione
         BasicBlock* basicBlock = inst->getParent();
 
         // Controllo se basicBlock domina tutte le USCITE e gli USI
-        if (dominatesAllExit(basicBlock, exitLoopBlocks, DT) && dominatesAllUses(inst, L, DT))
-            candidateInst.push_back(inst);
+        if (!dominatesAllUses(inst, L, DT))
+            continue;
+
+        bool guaranteed = dominatesAllExit(basicBlock, exitLoopBlocks, DT);
+        if ((isa<LoadInst>(inst) || !isSafeToSpeculativelyExecute(inst, L.getLoopPreheader()->getTerminator())) &&
+            !SafetyInfo.isGuaranteedToExecute(*inst, &DT, &L))
+            guaranteed = false;
+
+        if (!guaranteed) {
+            if (!canSpeculate(inst, L, LAR.TTI))
+                continue;
+            speculatedSet.insert(inst);
+        }
+
+        candidateInst.push_back(inst);
+        candidateSet.insert(inst);
     }
 
+    NumCandidates += candidateInst.size();
+
+    // Le candidate che non conviene spostare (guadagno nullo o registri esauriti) restano nel loop
+    if (EnablePressureModel)
+        selectProfitableCandidates(L, LAR, candidateInst, candidateSet, ORE);
+
     // Stampa di debug delle istruzioni candidate alla code-motion
-    outs() <<"---STAMPA ISTRUZIONI CANDIDATE ALLA CODE MOTION---\n";
-    for (auto *inst : candidateInst){
-        outs() <<"Istruzione: "<< *inst << "\n";
-    }
+    LLVM_DEBUG({
+        dbgs() << "---STAMPA ISTRUZIONI CANDIDATE ALLA CODE MOTION---\n";
+        for (auto *inst : candidateInst)
+            dbgs() << "Istruzione: " << *inst << "\n";
+    });
 
     // PASSO 4: spostiamo le istruzioni candidate alla code-motion nel PREHEADER a patto che vengano rispettate le dipendende
     // tutte le istruzioni invarianti da cui questa dipende devono essere spostate
 
+    // Per ogni istruzione candidata cerco se il vincolo è rispettato. Le candidate sono in ordine
+    // di scoperta, quindi le dipendenze vengono esaminate prima delle istruzioni che le usano
+    for (auto *inst : candidateInst){
+        if (!candidateSet.count(inst))
+            continue;
+
+        if (!allDependenciesMoved(inst, candidateSet, L)) {
+            // L'istruzione resta nel loop: nemmeno chi la usa potrà essere spostato
+            candidateSet.erase(inst);
+            continue;
+        }
+
+        // Il vincolo è rispettato, dunque sposto l'istruzione alla fine del preheader
+        moveToPreheader(inst, L, speculatedSet.count(inst), LAR, MSSAU, ORE);
+        Changed = true;
+    }
+
+    return Changed;
+}
+
+// ---------------------------------------------------------------------------
+// MODALITÀ NEST
+// Invece di spostare le invarianti loop per loop (dal più interno al più esterno,
+// riscoprendole a ogni livello), quando il passo arriva al loop più esterno si
+// calcola per ogni istruzione del nest il loop più esterno in cui è invariante e
+// la si sposta direttamente nel suo preheader, con una sola visita del nest.
+// ---------------------------------------------------------------------------
+
+// Informazioni calcolate una volta per ogni loop del nest
+struct NestLoopInfo {
+    SmallVector<BasicBlock*> ExitBlocks;
+    SimpleLoopSafetyInfo SafetyInfo;
+    std::unique_ptr<LoopWriteSet> WriteSet;
+};
+
+// Funzione di supporto che stabilisce se tutti gli operandi di inst, dopo gli spostamenti già
+// decisi, si trovano fuori dal loop M
+bool operandsOutsideLoop(Instruction& inst, Loop& M, const DenseMap<Instruction*, Loop*>& hoistTargets) {
+    for (Value* op : inst.operands()) {
+        Instruction* opInst = dyn_cast<Instruction>(op);
+        if (!opInst)
+            continue;
+
+        // Un operando già spostato si trova nel preheader del suo loop di destinazione
+        Loop* target = hoistTargets.lookup(opInst);
+        BasicBlock* opBlock = target ? target->getLoopPreheader() : opInst->getParent();
+        if (M.contains(opBlock))
+            return false;
+    }
+    return true;
+}
+
+// Funzione di supporto che ritorna il loop più esterno del nest (fino a Outermost) nel cui preheader
+// inst può essere spostata, oppure nullptr se inst deve restare dov'è. Il test si ferma al primo
+// loop in cui inst non è invariante o lo spostamento non è sicuro
+Loop* findHoistTarget(Instruction& inst, Loop& Outermost, LoopStandardAnalysisResults& LAR,
+                      const DenseMap<Instruction*, Loop*>& hoistTargets,
+                      DenseMap<Loop*, std::unique_ptr<NestLoopInfo>>& nestInfo, bool& speculated) {
+    if (!canBeInvariant(inst))
+        return nullptr;
+
+    Loop* target = nullptr;
+    for (Loop* M = LAR.LI.getLoopFor(inst.getParent()); M; M = M->getParentLoop()) {
+        if (!M->getLoopPreheader() || !operandsOutsideLoop(inst, *M, hoistTargets))
+            break;
+
+        std::unique_ptr<NestLoopInfo>& info = nestInfo[M];
+        if (!info) {
+            info = std::make_unique<NestLoopInfo>();
+            M->getExitBlocks(info->ExitBlocks);
+            info->SafetyInfo.computeLoopSafetyInfo(M);
+        }
+
+        auto *LI = dyn_cast<LoadInst>(&inst);
+        if (LI && !isMemoryInvariant(*LI, *M, LAR, info->WriteSet))
+            break;
+
+        // Stesse condizioni del caso a singolo loop: esecuzione garantita oppure speculazione sicura
+        bool guaranteed = dominatesAllExit(inst.getParent(), info->ExitBlocks, LAR.DT);
+        if ((LI || !isSafeToSpeculativelyExecute(&inst, M->getLoopPreheader()->getTerminator())) &&
+            !info->SafetyInfo.isGuaranteedToExecute(inst, &LAR.DT, M))
+            guaranteed = false;
+        if (!guaranteed && !canSpeculate(&inst, *M, LAR.TTI))
+            break;
+
+        target = M;
+        speculated = !guaranteed;
+        if (M == &Outermost)
+            break;
+    }
+    return target;
+}
+
+// Funzione di supporto che sposta le invarianti di tutto il nest di Outermost.
+// Il nest è visitato in reverse post-order: gli operandi di un'istruzione (escluse le PHI, che
+// non vengono spostate) hanno già una destinazione quando si esamina l'istruzione
+bool hoistNestInvariants(Loop& Outermost, LoopStandardAnalysisResults& LAR, MemorySSAUpdater *MSSAU,
+                         OptimizationRemarkEmitter& ORE) {
+    LoopBlocksRPO RPOT(&Outermost);
+    RPOT.perform(&LAR.LI);
+
+    DenseMap<Instruction*, Loop*> hoistTargets;
+    DenseMap<Loop*, std::unique_ptr<NestLoopInfo>> nestInfo;
+    bool Changed = false;
+
+    for (BasicBlock* BB : RPOT) {
+        for (Instruction& inst : make_early_inc_range(*BB)) {
+            bool speculated = false;
+            Loop* target = findHoistTarget(inst, Outermost, LAR, hoistTargets, nestInfo, speculated);
+            if (!target)
+                continue;
+
+            LLVM_DEBUG(dbgs() << "Destinazione nel nest: loop " << target->getName() << "\n");
+            hoistTargets[&inst] = target;
+            ++NumInvariant;
+            moveToPreheader(&inst, *target, speculated, LAR, MSSAU, ORE);
+            Changed = true;
+        }
+    }
+
+    return Changed;
+}
+
+// ---------------------------------------------------------------------------
+// UNSWITCHING
+// Un branch su una condizione invariante viene valutato a ogni iterazione anche se
+// prende sempre la stessa direzione. Se una delle due direzioni esce dal loop e il
+// branch è eseguito a ogni iterazione prima di qualunque effetto collaterale, basta
+// spostarlo nel preheader (unswitching banale). Altrimenti il loop viene duplicato
+// in due versioni specializzate per i due valori della condizione, scelte da un
+// branch prima del loop: la duplicazione è limitata dalla dimensione del loop.
+// ---------------------------------------------------------------------------
+
+// Funzione di supporto che cerca un branch su una condizione invariante che esce dal loop e che è eseguito
+// a ogni iterazione prima di qualunque effetto collaterale: si parte dall'header e si seguono i salti
+// incondizionati all'interno del loop
+static BranchInst *findTrivialUnswitchBranch(Loop &L) {
+    SmallPtrSet<BasicBlock*, 8> visited;
+    BasicBlock *BB = L.getHeader();
+    while (visited.insert(BB).second) {
+        for (Instruction &I : *BB)
+            if (I.mayHaveSideEffects())
+                return nullptr;
+
+        auto *BI = dyn_cast<BranchInst>(BB->getTerminator());
+        if (!BI)
+            return nullptr;
+        if (BI->isUnconditional()) {
+            BB = BI->getSuccessor(0);
+            if (!L.contains(BB))
+                return nullptr;
+            continue;
+        }
+
+        Value *Cond = BI->getCondition();
+        if (isa<Constant>(Cond) || !L.isLoopInvariant(Cond))
+            return nullptr;
+        bool exitOnTrue = !L.contains(BI->getSuccessor(0));
+        if (exitOnTrue == !L.contains(BI->getSuccessor(1)))
+            return nullptr;
+
+        // Le PHI del blocco di uscita riceveranno i valori dal preheader, quindi devono essere invarianti
+        BasicBlock *exitBB = BI->getSuccessor(exitOnTrue ? 0 : 1);
+        for (PHINode &PN : exitBB->phis())
+            if (!L.isLoopInvariant(PN.getIncomingValueForBlock(BB)))
+                return nullptr;
+        return BI;
+    }
+    return nullptr;
+}
+
+// Funzione di supporto che sposta nel preheader un branch trovato da findTrivialUnswitchBranch.
+// Il vecchio preheader esegue il branch e un nuovo preheader porta all'header; nel loop il branch
+// diventa un salto incondizionato verso il successore interno
+static void unswitchTrivialBranch(Loop &L, BranchInst *BI, LoopStandardAnalysisResults &LAR,
+                                  MemorySSAUpdater *MSSAU, OptimizationRemarkEmitter &ORE) {
+    BasicBlock *BB = BI->getParent();
+    bool exitOnTrue = !L.contains(BI->getSuccessor(0));
+    BasicBlock *exitBB = BI->getSuccessor(exitOnTrue ? 0 : 1);
+    BasicBlock *continueBB = BI->getSuccessor(exitOnTrue ? 1 : 0);
+
+    LLVM_DEBUG(dbgs() << "Unswitching banale del branch " << *BI << "\n");
+    ORE.emit([&]() {
+        return OptimizationRemark(DEBUG_TYPE, "TrivialUnswitch", BI)
+               << "branch su una condizione invariante spostato fuori dal loop";
+    });
+
+    // Cambia il numero di iterazioni del loop, e di quelli che lo contengono se l'uscita li lascia tutti
+    Loop *parentLoop = L.getParentLoop();
+    if (parentLoop && !parentLoop->contains(exitBB))
+        LAR.SE.forgetTopmostLoop(&L);
+    else
+        LAR.SE.forgetLoop(&L);
+
     BasicBlock *preHeader = L.getLoopPreheader();
-    if (!preHeader) {
-        outs() << "Preheader non trovato\n";
-        return false;
+    BasicBlock *newPreHeader = SplitBlock(preHeader, preHeader->getTerminator(), &LAR.DT, &LAR.LI, MSSAU);
+
+    preHeader->getTerminator()->eraseFromParent();
+    BranchInst::Create(exitOnTrue ? exitBB : newPreHeader, exitOnTrue ? newPreHeader : exitBB, BI->getCondition(),
+                       preHeader);
+    for (PHINode &PN : exitBB->phis())
+        PN.replaceIncomingBlockWith(BB, preHeader);
+
+    BranchInst::Create(continueBB, BI);
+    BI->eraseFromParent();
+
+    SmallVector<DominatorTree::UpdateType, 2> updates = {{DominatorTree::Insert, preHeader, exitBB},
+                                                         {DominatorTree::Delete, BB, exitBB}};
+    LAR.DT.applyUpdates(updates);
+    if (MSSAU)
+        MSSAU->applyUpdates(updates, LAR.DT);
+
+    // exitBB ora ha anche un predecessore fuori dal loop: le uscite rimaste ricevono un blocco dedicato
+    formDedicatedExitBlocks(&L, &LAR.DT, &LAR.LI, MSSAU, /*PreserveLCSSA=*/true);
+    ++NumTrivialUnswitched;
+}
+
+// Funzione di supporto che calcola i blocchi del loop raggiungibili dall'header quando la condizione
+// Cond vale Val: dei branch su Cond si segue solo il successore scelto da Val
+static void collectLiveBlocks(Loop &L, Value *Cond, bool Val, SmallPtrSetImpl<BasicBlock*> &live) {
+    SmallVector<BasicBlock*, 16> worklist = {L.getHeader()};
+    live.insert(L.getHeader());
+    while (!worklist.empty()) {
+        BasicBlock *BB = worklist.pop_back_val();
+        auto *BI = dyn_cast<BranchInst>(BB->getTerminator());
+        for (BasicBlock *Succ : successors(BB)) {
+            if (BI && BI->isConditional() && BI->getCondition() == Cond && Succ != BI->getSuccessor(Val ? 0 : 1))
+                continue;
+            if (L.contains(Succ) && live.insert(Succ).second)
+                worklist.push_back(Succ);
+        }
     }
-    
-    // Per ogni istruzione candidata cerco se il vincolo è rispettato
-    for (auto *inst : candidateInst){
-        if (allDependenciesMoved(inst, candidateInst, L)){
-            // Il vincolo è rispettato, dunque sposto l'istruzione alla fine del preheader
-            outs() << "L'istruzione "<< *inst << " può essere spostata nel preheader\n";
-            inst->moveBefore(preHeader->getTerminator());
-        }     
+}
+
+// Funzione di supporto che stabilisce se il loop può essere duplicato per la condizione Cond:
+// i branch su Cond devono restare nel loop, e in entrambe le versioni latch e blocchi di uscita
+// devono restare raggiungibili, così ogni versione è ancora un loop con le stesse uscite
+static bool canVersionOnCondition(Loop &L, Value *Cond) {
+    for (BasicBlock *BB : L.blocks()) {
+        auto *BI = dyn_cast<BranchInst>(BB->getTerminator());
+        if (BI && BI->isConditional() && BI->getCondition() == Cond &&
+            (!L.contains(BI->getSuccessor(0)) || !L.contains(BI->getSuccessor(1))))
+            return false;
+    }
+
+    SmallVector<BasicBlock*, 4> exitingBlocks;
+    L.getExitingBlocks(exitingBlocks);
+    for (bool Val : {true, false}) {
+        SmallPtrSet<BasicBlock*, 16> live;
+        collectLiveBlocks(L, Cond, Val, live);
+        if (!live.count(L.getLoopLatch()))
+            return false;
+        for (BasicBlock *exiting : exitingBlocks)
+            if (!live.count(exiting))
+                return false;
     }
     return true;
 }
 
+// Funzione di supporto che cerca una condizione invariante usata da un branch o da una select del loop.
+// Il loop deve essere il più interno, non già duplicato e più piccolo della soglia di dimensione
+static Value *findUnswitchCondition(Loop &L, TargetTransformInfo &TTI) {
+    if (!L.isInnermost() || getBooleanLoopAttribute(&L, UnswitchedAttr))
+        return nullptr;
+
+    InstructionCost size = 0;
+    for (BasicBlock *BB : L.blocks())
+        for (Instruction &I : *BB)
+            size += TTI.getInstructionCost(&I, TargetTransformInfo::TCK_CodeSize);
+    if (!size.isValid() || size > UnswitchThreshold)
+        return nullptr;
+
+    for (BasicBlock *BB : L.blocks()) {
+        for (Instruction &I : *BB) {
+            Value *Cond = nullptr;
+            if (auto *BI = dyn_cast<BranchInst>(&I)) {
+                if (BI->isConditional())
+                    Cond = BI->getCondition();
+            } else if (auto *SI = dyn_cast<SelectInst>(&I)) {
+                if (SI->getCondition()->getType()->isIntegerTy(1))
+                    Cond = SI->getCondition();
+            }
+            if (Cond && !isa<Constant>(Cond) && L.isLoopInvariant(Cond) && canVersionOnCondition(L, Cond))
+                return Cond;
+        }
+    }
+    return nullptr;
+}
+
+// Funzione di supporto che specializza una versione del loop per Cond == Val: le select su Cond sono
+// sostituite dall'operando scelto, i branch su Cond diventano incondizionati e i blocchi del loop
+// non più raggiungibili vengono eliminati
+static void specializeLoopVersion(Loop &L, Value *Cond, bool Val, LoopStandardAnalysisResults &LAR,
+                                  MemorySSAUpdater *MSSAU) {
+    SmallVector<DominatorTree::UpdateType, 8> updates;
+    for (BasicBlock *BB : L.blocks()) {
+        for (Instruction &I : make_early_inc_range(*BB)) {
+            auto *SI = dyn_cast<SelectInst>(&I);
+            if (!SI || SI->getCondition() != Cond)
+                continue;
+            SI->replaceAllUsesWith(Val ? SI->getTrueValue() : SI->getFalseValue());
+            SI->eraseFromParent();
+        }
+
+        auto *BI = dyn_cast<BranchInst>(BB->getTerminator());
+        if (!BI || !BI->isConditional() || BI->getCondition() != Cond)
+            continue;
+        BasicBlock *liveSucc = BI->getSuccessor(Val ? 0 : 1);
+        BasicBlock *deadSucc = BI->getSuccessor(Val ? 1 : 0);
+        BranchInst::Create(liveSucc, BI);
+        BI->eraseFromParent();
+        if (deadSucc != liveSucc) {
+            deadSucc->removePredecessor(BB);
+            updates.push_back({DominatorTree::Delete, BB, deadSucc});
+        }
+    }
+
+    // Gli altri usi della condizione nel loop ne vedono il valore costante
+    Cond->replaceUsesWithIf(ConstantInt::getBool(Cond->getContext(), Val), [&](Use &U) {
+        auto *UserInst = dyn_cast<Instruction>(U.getUser());
+        return UserInst && L.contains(UserInst);
+    });
+
+    SmallPtrSet<BasicBlock*, 16> live;
+    collectLiveBlocks(L, Cond, Val, live);
+    SmallSetVector<BasicBlock*, 8> deadBlocks;
+    for (BasicBlock *BB : L.blocks())
+        if (!live.count(BB))
+            deadBlocks.insert(BB);
+
+    DomTreeUpdater DTU(LAR.DT, DomTreeUpdater::UpdateStrategy::Eager);
+    DTU.applyUpdates(updates);
+    if (MSSAU) {
+        MSSAU->applyUpdates(updates, LAR.DT);
+        MSSAU->removeBlocks(deadBlocks);
+    }
+    for (BasicBlock *BB : deadBlocks)
+        LAR.LI.removeBlock(BB);
+    DeleteDeadBlocks(deadBlocks.getArrayRef(), &DTU);
+}
+
+// Funzione di supporto che duplica il loop e sceglie la versione prima di entrare:
+// il loop originale è specializzato per Cond vera, la copia per Cond falsa.
+// La copia viene segnalata al pass manager come loop fratello da visitare
+static void unswitchInvariantCondition(Loop &L, Value *Cond, LoopStandardAnalysisResults &LAR,
+                                       MemorySSAUpdater *MSSAU, LPMUpdater &LU, OptimizationRemarkEmitter &ORE) {
+    LLVM_DEBUG(dbgs() << "Duplico il loop per la condizione invariante " << *Cond << "\n");
+    ORE.emit([&]() {
+        return OptimizationRemark(DEBUG_TYPE, "Unswitched", L.getStartLoc(), L.getHeader())
+               << "loop duplicato per una condizione invariante";
+    });
+
+    LAR.SE.forgetLoop(&L);
+
+    SmallVector<BasicBlock*, 4> exitBlocks;
+    L.getUniqueExitBlocks(exitBlocks);
+
+    // Il vecchio preheader diventa il blocco che sceglie la versione, ognuna con il proprio preheader
+    BasicBlock *preHeader = L.getLoopPreheader();
+    BasicBlock *newPreHeader = SplitBlock(preHeader, preHeader->getTerminator(), &LAR.DT, &LAR.LI, MSSAU);
+
+    ValueToValueMapTy VMap;
+    SmallVector<BasicBlock*, 16> clonedBlocks;
+    Loop *clonedL = cloneLoopWithPreheader(newPreHeader, preHeader, &L, VMap, ".us", &LAR.LI, &LAR.DT, clonedBlocks);
+    remapInstructionsInBlocks(clonedBlocks, VMap);
+    BasicBlock *clonedPreHeader = cast<BasicBlock>(VMap[newPreHeader]);
+
+    preHeader->getTerminator()->eraseFromParent();
+    BranchInst::Create(newPreHeader, clonedPreHeader, Cond, preHeader);
+
+    // I blocchi di uscita (in LCSSA) ricevono i valori anche dalla copia
+    SmallVector<DominatorTree::UpdateType, 8> updates = {{DominatorTree::Insert, preHeader, clonedPreHeader}};
+    for (BasicBlock *exitBB : exitBlocks) {
+        for (PHINode &PN : exitBB->phis()) {
+            for (unsigned i = 0, e = PN.getNumIncomingValues(); i != e; ++i) {
+                Value *clonedV = VMap.lookup(PN.getIncomingValue(i));
+                PN.addIncoming(clonedV ? clonedV : PN.getIncomingValue(i),
+                               cast<BasicBlock>(VMap[PN.getIncomingBlock(i)]));
+            }
+        }
+        for (BasicBlock *Pred : predecessors(exitBB))
+            if (clonedL->contains(Pred))
+                updates.push_back({DominatorTree::Insert, Pred, exitBB});
+    }
+
+    // I blocchi fuori dal loop dominati da un blocco del loop sono ora raggiunti da entrambe le versioni
+    SmallVector<DomTreeNode*, 8> outsideChildren;
+    for (BasicBlock *BB : L.blocks())
+        for (DomTreeNode *child : LAR.DT.getNode(BB)->children())
+            if (!L.contains(child->getBlock()))
+                outsideChildren.push_back(child);
+    for (DomTreeNode *child : outsideChildren)
+        LAR.DT.changeImmediateDominator(child, LAR.DT.getNode(preHeader));
+
+    if (MSSAU) {
+        LoopBlocksRPO RPOT(&L);
+        RPOT.perform(&LAR.LI);
+        MSSAU->updateForClonedLoop(RPOT, exitBlocks, VMap);
+        MSSAU->applyInsertUpdates(updates, LAR.DT);
+    }
+
+    specializeLoopVersion(L, Cond, true, LAR, MSSAU);
+    specializeLoopVersion(*clonedL, Cond, false, LAR, MSSAU);
+
+    // Le uscite sono condivise dalle due versioni: ognuna riceve i propri blocchi di uscita dedicati
+    formDedicatedExitBlocks(&L, &LAR.DT, &LAR.LI, MSSAU, /*PreserveLCSSA=*/true);
+    formDedicatedExitBlocks(clonedL, &LAR.DT, &LAR.LI, MSSAU, /*PreserveLCSSA=*/true);
+
+    // Le due versioni non vengono duplicate di nuovo, così la crescita del codice resta limitata
+    addStringMetadataToLoop(&L, UnswitchedAttr, 1);
+    addStringMetadataToLoop(clonedL, UnswitchedAttr, 1);
+
+    LU.addSiblingLoops({clonedL});
+    ++NumUnswitched;
+}
+
+// Funzione di supporto che esegue l'unswitching delle condizioni invarianti del loop.
+// Ritorna true se il CFG è stato modificato
+bool unswitchLoop(Loop& L, LoopStandardAnalysisResults& LAR, MemorySSAUpdater *MSSAU, LPMUpdater &LU,
+                  OptimizationRemarkEmitter& ORE) {
+    bool Changed = false;
+    while (BranchInst *BI = findTrivialUnswitchBranch(L)) {
+        unswitchTrivialBranch(L, BI, LAR, MSSAU, ORE);
+        Changed = true;
+    }
+
+    if (Value *Cond = findUnswitchCondition(L, LAR.TTI)) {
+        unswitchInvariantCondition(L, Cond, LAR, MSSAU, LU, ORE);
+        Changed = true;
+    }
+    return Changed;
+}
+
+bool runOnLoop2(Loop &L, LoopAnalysisManager &LAM, LoopStandardAnalysisResults &LAR, LPMUpdater &LU,
+                bool &CFGChanged) {
+    // I remark sono costruiti solo se abilitati (-pass-remarks*, -pass-remarks-output)
+    OptimizationRemarkEmitter ORE(L.getHeader()->getParent());
+
+    // PASSO 1
+    // Controllo se il loop è nella forma NORMALIZZATA
+    if (!L.isLoopSimplifyForm()) {
+        LLVM_DEBUG(dbgs() << "Il loop non è in forma normalizzata\n");
+        ORE.emit([&]() {
+            return OptimizationRemarkMissed(DEBUG_TYPE, "NotLoopSimplifyForm", L.getStartLoc(), L.getHeader())
+                   << "il loop non è in forma normalizzata";
+        });
+        return false;
+    }
+
+    // MemorySSA, se calcolata, va tenuta aggiornata per i passi successivi
+    std::unique_ptr<MemorySSAUpdater> MSSAU;
+    if (LAR.MSSA)
+        MSSAU = std::make_unique<MemorySSAUpdater>(LAR.MSSA);
+
+    // Informazioni su quali istruzioni del loop sono eseguite sicuramente
+    SimpleLoopSafetyInfo SafetyInfo;
+    SafetyInfo.computeLoopSafetyInfo(&L);
+
+    // PASSI 2-4: spostamento delle istruzioni loop-invariant nel preheader.
+    // In modalità nest i loop interni vengono saltati e tutto il nest è trattato dal loop più esterno
+    bool Changed = false;
+    if (EnableNestHoisting) {
+        if (L.isOutermost())
+            Changed |= hoistNestInvariants(L, LAR, MSSAU.get(), ORE);
+    } else {
+        Changed |= hoistLoopInvariants(L, LAR, SafetyInfo, MSSAU.get(), ORE);
+    }
+
+    // PASSO 5: i branch su condizioni diventate invarianti (ora calcolate nel preheader) escono dal loop
+    if (EnableUnswitching && unswitchLoop(L, LAR, MSSAU.get(), LU, ORE)) {
+        CFGChanged = true;
+        Changed = true;
+        SafetyInfo.computeLoopSafetyInfo(&L);
+    }
+
+    // PASSO 6: le locazioni lette e scritte a ogni iterazione vengono tenute in un registro
+    Changed |= promoteLoopAccesses(L, LAR, SafetyInfo, MSSAU.get(), ORE);
+
+    // PASSO 7: le istruzioni il cui risultato serve solo dopo il loop vengono calcolate una volta sola
+    if (EnableSinking)
+        Changed |= sinkToExitBlocks(L, LAR, MSSAU.get(), ORE);
+    return Changed;
+}
+
 PreservedAnalyses LoopWalk2::run(Loop &L, LoopAnalysisManager &LAM, LoopStandardAnalysisResults &LAR, LPMUpdater &LU) {
-    outs() << "---INIZIO PASSO LOOP---\n";
-    if (runOnLoop2(L, LAM, LAR, LU)) {
+    LLVM_DEBUG(dbgs() << "---INIZIO PASSO LOOP " << L.getName() << "---\n");
+    bool CFGChanged = false;
+    if (!runOnLoop2(L, LAM, LAR, LU, CFGChanged))
         return PreservedAnalyses::all();
-    } else {
-        return PreservedAnalyses::none();
-    }                                               
+
+    // DominatorTree e LoopInfo sono aggiornati anche dall'unswitching, ScalarEvolution ha dimenticato
+    // i valori e i loop toccati e MemorySSA, se presente, è stata aggiornata con MemorySSAUpdater.
+    // Solo l'unswitching modifica il CFG
+    auto PA = getLoopPassPreservedAnalyses();
+    if (!CFGChanged)
+        PA.preserveSet<CFGAnalyses>();
+    if (LAR.MSSA)
+        PA.preserve<MemorySSAAnalysis>();
+    return PA;
 }
\ No newline at end of file
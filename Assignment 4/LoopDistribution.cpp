@@ -0,0 +1,523 @@
+#include "llvm/Transforms/Utils/LoopDistribution.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/LoopIterator.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/LoopMemoryUtils.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include <algorithm>
+
+#define DEBUG_TYPE "loopdistribution"
+
+using namespace llvm;
+
+// Contatori del passo, visibili con -stats
+STATISTIC(NumDistributed, "Numero di loop distribuiti");
+STATISTIC(NumCreatedLoops, "Numero di loop creati dalla distribuzione");
+
+// Funzione di supporto che emette il remark di un loop non distribuito
+static void emitNotDistributed(OptimizationRemarkEmitter &ORE, Loop *L, StringRef RemarkName, StringRef Reason) {
+  ORE.emit([&]() {
+    return OptimizationRemarkMissed(DEBUG_TYPE, RemarkName, L->getStartLoc(), L->getHeader())
+           << "loop " << ore::NV("Loop", L->getHeader()->getName()) << " non distribuito: " << Reason;
+  });
+}
+
+// Funzione di supporto che controlla la forma del loop: innermost, con preheader, un solo blocco di uscita
+// raggiunto da un solo blocco, trip count calcolabile e, in memoria, solo load e store semplici.
+// Le informazioni di debug non contano: un loop compilato con -g si distribuisce come senza
+// Ogni loop creato dalla distribuzione esegue lo stesso controllo e quindi le stesse iterazioni
+static bool hasDistributableShape(Loop *L, ScalarEvolution &SE) {
+  if (!L->isInnermost() || !L->getLoopPreheader() || !L->getLoopLatch() || !L->getExitBlock() ||
+      !L->getExitingBlock() || !L->hasDedicatedExits())
+    return false;
+  if (isa<SCEVCouldNotCompute>(SE.getBackedgeTakenCount(L)))
+    return false;
+
+  for (BasicBlock *BB : L->blocks())
+    for (Instruction &I : *BB) {
+      if (isa<DbgInfoIntrinsic>(I))
+        continue;
+      if (I.isEHPad() || isa<CallBase>(I))
+        return false;
+      if (auto *load = dyn_cast<LoadInst>(&I)) {
+        if (!load->isSimple())
+          return false;
+      } else if (auto *store = dyn_cast<StoreInst>(&I)) {
+        if (!store->isSimple())
+          return false;
+      } else if (I.mayReadOrWriteMemory()) {
+        return false;
+      }
+    }
+  return true;
+}
+
+// Funzione di supporto che raccoglie le istruzioni da cui dipendono i terminatori del loop (la variabile di
+// induzione, il confronto di uscita, le condizioni dei branch nel corpo). Sono copiate in ogni loop creato
+// dalla distribuzione, quindi possono leggere solo memoria che nessuna store del loop scrive: ritorna false altrimenti
+static bool collectLoopControl(Loop *L, SmallPtrSetImpl<Instruction*> &control) {
+  SmallVector<Instruction*, 8> worklist, stores;
+  for (BasicBlock *BB : L->blocks()) {
+    worklist.push_back(BB->getTerminator());
+    for (Instruction &I : *BB)
+      if (isa<StoreInst>(I))
+        stores.push_back(&I);
+  }
+
+  while (!worklist.empty()) {
+    Instruction *I = worklist.pop_back_val();
+    if (!control.insert(I).second)
+      continue;
+    if (isa<LoadInst>(I)) {
+      if (llvm::any_of(stores, [&](Instruction *S) { return mayShareMemory(I, S); }))
+        return false;
+    } else if (I->mayReadOrWriteMemory()) {
+      return false;
+    }
+    for (Value *op : I->operands())
+      if (auto *opInst = dyn_cast<Instruction>(op))
+        if (L->contains(opInst))
+          worklist.push_back(opInst);
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// GRAFO DELLE DIPENDENZE TRA LE ISTRUZIONI
+// I nodi sono le istruzioni del corpo che non fanno parte del controllo del loop
+// (escluse le informazioni di debug).
+// Un arco A -> B indica che ogni istanza di B deve restare dopo l'istanza di A da
+// cui dipende: gli archi vengono dagli usi SSA (comprese le PHI, che chiudono le
+// ricorrenze scalari) e dalle dipendenze in memoria trovate da DependenceInfo.
+// Una componente fortemente connessa con più di un nodo (o con un arco su se
+// stessa) è una ricorrenza e deve restare in un solo loop.
+// ---------------------------------------------------------------------------
+
+struct StatementGraph {
+  SmallVector<Instruction*, 32> nodes;
+  DenseMap<Instruction*, unsigned> index;
+  SmallVector<SmallVector<unsigned, 4>, 32> edges;
+  // Nodi con almeno una dipendenza in memoria: un load senza dipendenze può essere ripetuto in più loop
+  SmallVector<bool, 32> hasMemoryDependence;
+
+  void addEdge(unsigned from, unsigned to) { edges[from].push_back(to); }
+};
+
+// Funzione di supporto che aggiunge al grafo gli archi della dipendenza tra A e B (A precede B nel corpo).
+// Le direzioni dei loop esterni devono ammettere =, altrimenti la dipendenza è portata da un loop esterno;
+// la direzione del loop distribuito decide il verso: < o = va da A a B, > da B a A (iterazione precedente)
+static void addMemoryDependence(StatementGraph &G, unsigned A, unsigned B, const Dependence &Dep) {
+  unsigned levels = Dep.getLevels();
+  if (Dep.isConfused() || levels == 0) {
+    G.addEdge(A, B);
+    G.addEdge(B, A);
+  } else {
+    for (unsigned level = 1; level < levels; ++level)
+      if (!(Dep.getDirection(level) & Dependence::DVEntry::EQ))
+        return;
+    unsigned direction = Dep.getDirection(levels);
+    if (direction & (Dependence::DVEntry::LT | Dependence::DVEntry::EQ))
+      G.addEdge(A, B);
+    if (direction & Dependence::DVEntry::GT)
+      G.addEdge(B, A);
+  }
+  G.hasMemoryDependence[A] = true;
+  G.hasMemoryDependence[B] = true;
+}
+
+static void buildStatementGraph(Loop *L, const SmallPtrSetImpl<Instruction*> &control, LoopInfo &LI,
+                                DependenceInfo &DI, StatementGraph &G) {
+  // I blocchi sono visitati in reverse post-order, quindi i nodi sono in ordine di programma
+  LoopBlocksRPO RPO(L);
+  RPO.perform(&LI);
+  for (BasicBlock *BB : RPO)
+    for (Instruction &I : *BB)
+      if (!control.count(&I) && !I.isTerminator() && !isa<DbgInfoIntrinsic>(I)) {
+        G.index[&I] = G.nodes.size();
+        G.nodes.push_back(&I);
+      }
+  G.edges.resize(G.nodes.size());
+  G.hasMemoryDependence.resize(G.nodes.size(), false);
+
+  SmallVector<unsigned, 16> memoryNodes;
+  for (unsigned node = 0; node < G.nodes.size(); ++node) {
+    Instruction *I = G.nodes[node];
+    for (Value *op : I->operands()) {
+      auto operand = G.index.find(dyn_cast<Instruction>(op));
+      if (operand != G.index.end())
+        G.addEdge(operand->second, node);
+    }
+    if (I->mayReadOrWriteMemory())
+      memoryNodes.push_back(node);
+  }
+
+  for (unsigned i = 0; i < memoryNodes.size(); ++i)
+    for (unsigned j = i + 1; j < memoryNodes.size(); ++j) {
+      Instruction *A = G.nodes[memoryNodes[i]];
+      Instruction *B = G.nodes[memoryNodes[j]];
+      if (!A->mayWriteToMemory() && !B->mayWriteToMemory())
+        continue;
+      if (!mayShareMemory(A, B))
+        continue;
+      if (std::unique_ptr<Dependence> Dep = DI.depends(A, B, true))
+        addMemoryDependence(G, memoryNodes[i], memoryNodes[j], *Dep);
+    }
+
+  // Una store può dipendere da se stessa tra iterazioni diverse (es. a[0] = ...)
+  for (unsigned node : memoryNodes) {
+    Instruction *I = G.nodes[node];
+    if (!I->mayWriteToMemory())
+      continue;
+    if (std::unique_ptr<Dependence> Dep = DI.depends(I, I, true))
+      if (Dep->isConfused() || Dep->getLevels() == 0 || (Dep->getDirection(Dep->getLevels()) & ~Dependence::DVEntry::EQ)) {
+        G.addEdge(node, node);
+        G.hasMemoryDependence[node] = true;
+      }
+  }
+}
+
+// Componenti fortemente connesse del grafo, calcolate con l'algoritmo di Tarjan.
+// Le componenti sono numerate in ordine topologico inverso: gli archi vanno da numeri più alti a più bassi
+struct SCCResult {
+  SmallVector<unsigned, 32> component;
+  unsigned numComponents = 0;
+};
+
+static void tarjanVisit(const StatementGraph &G, unsigned node, SmallVectorImpl<unsigned> &order,
+                        SmallVectorImpl<unsigned> &lowLink, SmallVectorImpl<bool> &onStack,
+                        SmallVectorImpl<unsigned> &stack, unsigned &counter, SCCResult &result) {
+  order[node] = lowLink[node] = ++counter;
+  stack.push_back(node);
+  onStack[node] = true;
+
+  for (unsigned succ : G.edges[node]) {
+    if (!order[succ]) {
+      tarjanVisit(G, succ, order, lowLink, onStack, stack, counter, result);
+      lowLink[node] = std::min(lowLink[node], lowLink[succ]);
+    } else if (onStack[succ]) {
+      lowLink[node] = std::min(lowLink[node], order[succ]);
+    }
+  }
+
+  if (lowLink[node] != order[node])
+    return;
+  unsigned member;
+  do {
+    member = stack.pop_back_val();
+    onStack[member] = false;
+    result.component[member] = result.numComponents;
+  } while (member != node);
+  ++result.numComponents;
+}
+
+static SCCResult findSCCs(const StatementGraph &G) {
+  unsigned size = G.nodes.size();
+  SCCResult result;
+  result.component.resize(size);
+  SmallVector<unsigned, 32> order(size, 0), lowLink(size, 0), stack;
+  SmallVector<bool, 32> onStack(size, false);
+  unsigned counter = 0;
+  for (unsigned node = 0; node < size; ++node)
+    if (!order[node])
+      tarjanVisit(G, node, order, lowLink, onStack, stack, counter, result);
+  return result;
+}
+
+// Insieme di istruzioni che diventerà un loop: le componenti di una partizione sono tutte
+// cicliche (ricorrenze) o tutte acicliche (vettorizzabili se prese da sole)
+struct Partition {
+  SmallVector<unsigned, 8> nodes;
+  bool cyclic = false;
+  bool hasStore = false;
+};
+
+// Funzione di supporto che ordina le componenti in ordine topologico e le raggruppa in partizioni.
+// Tra le componenti pronte si sceglie, se possibile, una dello stesso tipo dell'ultima partizione,
+// così le componenti acicliche finiscono insieme lontano dalle ricorrenze con meno loop possibile
+static void buildPartitions(const StatementGraph &G, const SCCResult &SCC, SmallVectorImpl<Partition> &partitions) {
+  unsigned numComponents = SCC.numComponents;
+  SmallVector<SmallVector<unsigned, 4>, 16> members(numComponents);
+  SmallVector<SmallSetVector<unsigned, 4>, 16> successors(numComponents);
+  SmallVector<unsigned, 16> predecessors(numComponents, 0);
+  SmallVector<bool, 16> cyclic(numComponents, false);
+
+  for (unsigned node = 0; node < G.nodes.size(); ++node) {
+    unsigned from = SCC.component[node];
+    members[from].push_back(node);
+    for (unsigned succ : G.edges[node]) {
+      unsigned to = SCC.component[succ];
+      if (from == to)
+        cyclic[from] = true; // archi interni: la componente è una ricorrenza
+      else if (successors[from].insert(to))
+        ++predecessors[to];
+    }
+  }
+
+  // Le componenti pronte sono visitate in ordine di programma del loro primo nodo
+  SmallVector<unsigned, 16> ready[2];
+  auto push = [&](unsigned component) { ready[cyclic[component]].push_back(component); };
+  auto pop = [&](bool kind) {
+    auto first = std::min_element(ready[kind].begin(), ready[kind].end(),
+                                  [&](unsigned a, unsigned b) { return members[a].front() < members[b].front(); });
+    unsigned component = *first;
+    ready[kind].erase(first);
+    return component;
+  };
+  for (unsigned component = 0; component < numComponents; ++component)
+    if (!predecessors[component])
+      push(component);
+
+  while (!ready[0].empty() || !ready[1].empty()) {
+    bool kind = partitions.empty() ? ready[0].empty() : partitions.back().cyclic;
+    if (ready[kind].empty())
+      kind = !kind;
+    unsigned component = pop(kind);
+
+    if (partitions.empty() || partitions.back().cyclic != kind) {
+      partitions.emplace_back();
+      partitions.back().cyclic = kind;
+    }
+    Partition &partition = partitions.back();
+    for (unsigned node : members[component]) {
+      partition.nodes.push_back(node);
+      partition.hasStore |= G.nodes[node]->mayWriteToMemory();
+    }
+
+    for (unsigned to : successors[component]) {
+      if (!--predecessors[to])
+        push(to);
+    }
+  }
+
+  // Una partizione senza store produce solo valori per le partizioni successive: viene unita alla seguente
+  // (o alla precedente se è l'ultima), mantenendo l'ordine topologico
+  for (unsigned i = 0; i < partitions.size() && partitions.size() > 1;) {
+    if (partitions[i].hasStore) {
+      ++i;
+      continue;
+    }
+    unsigned into = i + 1 < partitions.size() ? i + 1 : i - 1;
+    Partition &target = partitions[into];
+    target.nodes.append(partitions[i].nodes.begin(), partitions[i].nodes.end());
+    target.cyclic |= partitions[i].cyclic;
+    partitions.erase(partitions.begin() + i);
+    if (into < i)
+      break;
+  }
+}
+
+// Funzione di supporto che calcola le istruzioni di ogni partizione: quelle che le servono tra le sue e
+// quelle (di altre partizioni) da cui dipendono tramite valori SSA, che vengono ricalcolate nel suo loop. Si possono
+// ricalcolare solo istruzioni senza effetti sulla memoria che non sono PHI, e load senza dipendenze
+// in memoria. Un valore usato dopo il loop deve essere calcolato nell'ultima partizione, che resta
+// nel loop originale. Ritorna false se una di queste condizioni non è rispettata
+static bool computePartitionSets(Loop *L, const StatementGraph &G, ArrayRef<Partition> partitions,
+                                 SmallVectorImpl<SmallPtrSet<Instruction*, 16>> &sets) {
+  SmallVector<unsigned, 32> owner(G.nodes.size());
+  for (unsigned p = 0; p < partitions.size(); ++p)
+    for (unsigned node : partitions[p].nodes)
+      owner[node] = p;
+
+  // Un'istruzione che non scrive in memoria può scendere fino alla prima partizione che la usa, se tutti
+  // i suoi successori nel grafo sono in quella partizione o dopo: i load usati solo da una ricorrenza
+  // successiva restano così nel suo loop invece di dover passare da un loop all'altro
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (unsigned node = G.nodes.size(); node-- > 0;) {
+      if (G.nodes[node]->mayWriteToMemory() || G.edges[node].empty())
+        continue;
+      unsigned first = partitions.size();
+      for (unsigned succ : G.edges[node])
+        first = std::min(first, owner[succ]);
+      if (first > owner[node] && first < partitions.size()) {
+        owner[node] = first;
+        changed = true;
+      }
+    }
+  }
+
+  // Le radici di ogni partizione sono le sue store e i valori usati dopo il loop; il resto serve solo se
+  // una radice lo usa, così nessun loop tiene calcoli che non gli servono
+  SmallVector<SmallVector<unsigned, 8>, 4> roots(partitions.size());
+  for (unsigned node = 0; node < G.nodes.size(); ++node) {
+    Instruction *I = G.nodes[node];
+    bool usedOutside = llvm::any_of(I->users(), [&](User *U) { return !L->contains(cast<Instruction>(U)); });
+    if (usedOutside && owner[node] != partitions.size() - 1)
+      return false;
+    if (usedOutside || I->mayWriteToMemory())
+      roots[owner[node]].push_back(node);
+  }
+
+  sets.resize(partitions.size());
+  for (unsigned p = 0; p < partitions.size(); ++p) {
+    SmallVector<unsigned, 16> worklist(roots[p].begin(), roots[p].end());
+    while (!worklist.empty()) {
+      unsigned node = worklist.pop_back_val();
+      Instruction *I = G.nodes[node];
+      if (!sets[p].insert(I).second)
+        continue;
+      if (owner[node] != p) {
+        bool canRecompute = isa<LoadInst>(I) ? !G.hasMemoryDependence[node]
+                                             : !isa<PHINode>(I) && !I->mayReadOrWriteMemory();
+        if (!canRecompute)
+          return false;
+      }
+      for (Value *op : I->operands()) {
+        auto operand = G.index.find(dyn_cast<Instruction>(op));
+        if (operand != G.index.end())
+          worklist.push_back(operand->second);
+      }
+    }
+  }
+  return true;
+}
+
+// Funzione di supporto che elimina da un loop le istruzioni che non appartengono alla sua partizione.
+// Le istruzioni vengono eliminate al contrario; un uso rimasto (solo da istruzioni eliminate in seguito
+// o da PHI) viene sostituito con poison
+static void removeOtherPartitions(ArrayRef<Instruction*> toRemove) {
+  for (Instruction *I : llvm::reverse(toRemove)) {
+    I->replaceAllUsesWith(PoisonValue::get(I->getType()));
+    I->eraseFromParent();
+  }
+}
+
+// Distribuisce il loop L: le partizioni tranne l'ultima diventano copie del loop inserite prima di L,
+// in ordine; l'ultima partizione resta in L. Ogni loop tiene il controllo e le istruzioni della sua partizione.
+// Le informazioni di debug restano solo in L: nelle copie descriverebbero due volte le stesse variabili.
+// DominatorTree e LoopInfo vengono aggiornate, ScalarEvolution dimentica L e le disposizioni
+static void distributeLoop(Loop *L, const StatementGraph &G, ArrayRef<SmallPtrSet<Instruction*, 16>> sets,
+                           LoopInfo &LI, DominatorTree &DT, ScalarEvolution &SE) {
+  SE.forgetLoop(L);
+
+  // Per inserire le copie serve un preheader vuoto con un solo predecessore
+  BasicBlock *preHeader = L->getLoopPreheader();
+  if (!preHeader->getSinglePredecessor() || &preHeader->front() != preHeader->getTerminator())
+    preHeader = SplitBlock(preHeader, preHeader->getTerminator(), &DT, &LI);
+  BasicBlock *pred = preHeader->getSinglePredecessor();
+  BasicBlock *exitBlock = L->getExitBlock();
+
+  // Le copie vengono create dall'ultima alla prima, ognuna prima del preheader della successiva
+  unsigned numLoops = sets.size();
+  SmallVector<Loop*, 4> loops(numLoops, nullptr);
+  SmallVector<std::unique_ptr<ValueToValueMapTy>, 4> maps;
+  for (unsigned p = 0; p + 1 < numLoops; ++p)
+    maps.push_back(std::make_unique<ValueToValueMapTy>());
+  loops[numLoops - 1] = L;
+  BasicBlock *topPreHeader = preHeader;
+  for (int p = numLoops - 2; p >= 0; --p) {
+    SmallVector<BasicBlock*, 8> blocks;
+    loops[p] = cloneLoopWithPreheader(topPreHeader, pred, L, *maps[p], ".ldist" + Twine(p), &LI, &DT, blocks);
+    (*maps[p])[exitBlock] = topPreHeader;
+    remapInstructionsInBlocks(blocks, *maps[p]);
+    for (BasicBlock *BB : blocks)
+      for (Instruction &I : llvm::make_early_inc_range(*BB))
+        if (isa<DbgInfoIntrinsic>(I))
+          I.eraseFromParent();
+    loops[p]->getLoopLatch()->getTerminator()->setMetadata(LLVMContext::MD_loop, nullptr);
+    topPreHeader = loops[p]->getLoopPreheader();
+  }
+  pred->getTerminator()->replaceUsesOfWith(preHeader, topPreHeader);
+  for (unsigned p = 0; p + 1 < numLoops; ++p)
+    DT.changeImmediateDominator(loops[p + 1]->getLoopPreheader(), loops[p]->getExitingBlock());
+
+  // Prima le copie (che usano la mappa dalle istruzioni originali), poi il loop originale
+  for (unsigned p = 0; p < numLoops; ++p) {
+    SmallVector<Instruction*, 16> toRemove;
+    for (Instruction *I : G.nodes)
+      if (!sets[p].count(I))
+        toRemove.push_back(p + 1 < numLoops ? cast<Instruction>((*maps[p])[I]) : I);
+    removeOtherPartitions(toRemove);
+  }
+
+  // Le copie cambiano i loop in cui si trovano le istruzioni: le disposizioni salvate non valgono più
+  SE.forgetBlockAndLoopDispositions();
+}
+
+PreservedAnalyses LoopDistribution::run(Function &F, FunctionAnalysisManager &FAM) {
+  LoopInfo &LI = FAM.getResult<LoopAnalysis>(F);
+  DominatorTree &DT = FAM.getResult<DominatorTreeAnalysis>(F);
+  ScalarEvolution &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+  DependenceInfo &DI = FAM.getResult<DependenceAnalysis>(F);
+  OptimizationRemarkEmitter &ORE = FAM.getResult<OptimizationRemarkEmitterAnalysis>(F);
+
+  // I loop creati dalla distribuzione non vengono visitati: la lista è presa prima di iniziare
+  SmallVector<Loop*, 8> innermost;
+  for (Loop *L : LI.getLoopsInPreorder())
+    if (L->isInnermost())
+      innermost.push_back(L);
+
+  bool Changed = false;
+  LLVM_DEBUG(dbgs() << "----INIZIO PASSO LOOP DISTRIBUTION " << F.getName() << "----\n");
+  for (Loop *L : innermost) {
+    if (!hasDistributableShape(L, SE)) {
+      emitNotDistributed(ORE, L, "UnsupportedShape", "la forma del loop non è supportata");
+      continue;
+    }
+
+    SmallPtrSet<Instruction*, 8> control;
+    if (!collectLoopControl(L, control)) {
+      emitNotDistributed(ORE, L, "MemoryInControl", "il controllo del loop legge memoria scritta nel loop");
+      continue;
+    }
+
+    StatementGraph G;
+    buildStatementGraph(L, control, LI, DI, G);
+    SCCResult SCC = findSCCs(G);
+    SmallVector<Partition, 4> partitions;
+    buildPartitions(G, SCC, partitions);
+
+    // La distribuzione serve solo a separare le istruzioni vettorizzabili da una ricorrenza
+    bool hasCyclic = llvm::any_of(partitions, [](const Partition &P) { return P.cyclic; });
+    bool hasAcyclic = llvm::any_of(partitions, [](const Partition &P) { return !P.cyclic; });
+    if (partitions.size() < 2 || !hasCyclic || !hasAcyclic) {
+      LLVM_DEBUG(dbgs() << "Il loop " << L->getHeader()->getName() << " non ha parti da separare\n");
+      continue;
+    }
+
+    SmallVector<SmallPtrSet<Instruction*, 16>, 4> sets;
+    if (!computePartitionSets(L, G, partitions, sets)) {
+      emitNotDistributed(ORE, L, "CrossPartitionValue",
+                         "un valore deve passare da un loop all'altro e non può essere ricalcolato");
+      continue;
+    }
+
+    LLVM_DEBUG(dbgs() << "Distribuisco il loop " << L->getHeader()->getName() << " in "
+                      << partitions.size() << " loop\n");
+    std::string loopName = L->getHeader()->getName().str();
+    distributeLoop(L, G, sets, LI, DT, SE);
+    Changed = true;
+    ++NumDistributed;
+    NumCreatedLoops += partitions.size() - 1;
+    ORE.emit([&]() {
+      return OptimizationRemark(DEBUG_TYPE, "Distributed", L->getStartLoc(), L->getHeader())
+             << "loop " << ore::NV("Loop", loopName) << " distribuito in "
+             << ore::NV("NumLoops", (unsigned)partitions.size()) << " loop";
+    });
+  }
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+
+  // DominatorTree e LoopInfo sono aggiornate durante la distribuzione, ScalarEvolution ha dimenticato i loop
+  // distribuiti; la PostDominatorTree non viene aggiornata
+  PreservedAnalyses PA;
+  PA.preserve<DominatorTreeAnalysis>();
+  PA.preserve<LoopAnalysis>();
+  PA.preserve<ScalarEvolutionAnalysis>();
+  return PA;
+}
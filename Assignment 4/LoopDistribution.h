@@ -0,0 +1,14 @@
+#ifndef LLVM_TRANSFORMS_LOOPDISTRIBUTION_H
+#define LLVM_TRANSFORMS_LOOPDISTRIBUTION_H
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/DependenceAnalysis.h"
+
+namespace llvm {
+    class LoopDistribution : public  PassInfoMixin<LoopDistribution> {
+          public : PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM);
+    };
+}
+#endif
@@ -4,197 +4,1009 @@
 #include <llvm/ADT/DepthFirstIterator.h>
 #include "llvm/Analysis/LoopAnalysisManager.h"
 #include "llvm/Transforms/Scalar/LoopPassManager.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/DomTreeUpdater.h"
+#include "llvm/Analysis/IVDescriptors.h"
+#include "llvm/Analysis/LoopAccessAnalysis.h"
+#include "llvm/Analysis/MemorySSA.h"
+#include "llvm/Analysis/MemorySSAUpdater.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/LoopMemoryUtils.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+
+#define DEBUG_TYPE "loopfusion"
+
 using namespace llvm;
 
-// Funzione di supporto che stabilisce se dati due loop Lj e Lk sono ADIACENTI tra loro (supponendo Lj < Lk)
-bool areAdjacent(Loop *Lj, Loop* Lk){
-  BasicBlock *exitBlockL1 = Lj->getExitBlock();
-  BasicBlock *preHeaderL2 = Lk->getLoopPreheader();
+// Contatori del passo, visibili con -stats
+STATISTIC(NumFused, "Numero di coppie di loop fuse");
+STATISTIC(NumNotAdjacent, "Coppie di loop scartate perché non adiacenti");
+STATISTIC(NumDifferentTripCount, "Coppie di loop scartate per trip count diversi");
+STATISTIC(NumIncompatibleIV, "Coppie di loop scartate per variabili di induzione di tipo diverso");
+STATISTIC(NumNotControlFlowEquivalent, "Coppie di loop scartate perché non control flow equivalent");
+STATISTIC(NumNegativeDependence, "Coppie di loop scartate per dipendenze a distanza negativa");
+STATISTIC(NumPeeled, "Iterazioni tolte con il peeling per allineare i trip count");
+STATISTIC(NumMovedInstructions, "Istruzioni tra due loop spostate per renderli adiacenti");
+STATISTIC(NumUnprofitable, "Coppie di loop scartate perché la fusione non è conveniente");
 
-  const Instruction *terminator = exitBlockL1->getTerminator();
+static cl::opt<unsigned> MaxPeelCount(
+    "loopfusion-max-peel", cl::init(4), cl::Hidden,
+    cl::desc("Numero massimo di iterazioni tolte al primo loop con il peeling per fonderlo con il secondo"));
 
-  if (terminator->getSuccessor(0) == preHeaderL2)
-    return true;
+static cl::opt<bool> EnableProfitability(
+    "loopfusion-profitability", cl::init(true), cl::Hidden,
+    cl::desc("Fonde due loop solo se il modello di località stima un risparmio di traffico verso la memoria"));
 
-  return false;
+static cl::opt<unsigned> CacheSize(
+    "loopfusion-cache-size", cl::init(32768), cl::Hidden,
+    cl::desc("Dimensione in byte della cache usata dal modello di profitto della fusione"));
+
+// Funzione di supporto che emette il remark di una coppia di loop non fusa
+static void emitNotFused(OptimizationRemarkEmitter &ORE, Loop *Lj, Loop *Lk, StringRef RemarkName, StringRef Reason) {
+  ORE.emit([&]() {
+    return OptimizationRemarkMissed(DEBUG_TYPE, RemarkName, Lk->getStartLoc(), Lk->getHeader())
+           << "loop " << ore::NV("FirstLoop", Lj->getHeader()->getName()) << " e "
+           << ore::NV("SecondLoop", Lk->getHeader()->getName()) << " non fusi: " << Reason;
+  });
+}
+
+// Decisioni prese durante il controllo di una coppia di loop e applicate dalla fusione
+struct FusionPlan {
+  // Iterazioni da togliere a Lj con il peeling
+  unsigned PeelCount = 0;
+  // Blocchi tra l'exit block di Lj e il preheader di Lk (estremi compresi)
+  SmallVector<BasicBlock*, 4> between;
+  // Istruzioni di questi blocchi da spostare nel preheader di Lj, in ordine di programma
+  SmallVector<Instruction*, 8> hoistBeforeLj;
+  // Istruzioni da spostare all'inizio dell'exit block di Lk, in ordine inverso di programma
+  SmallVector<Instruction*, 8> sinkAfterLk;
+};
+
+// Funzione di supporto che stabilisce se dati due loop Lj e Lk sono ADIACENTI tra loro (supponendo Lj < Lk).
+// Tra l'exit block di Lj e il preheader di Lk può esserci una catena di blocchi senza diramazioni, restituita
+// in between insieme ai due estremi: il codice di questi blocchi dovrà essere spostato prima di Lj o dopo Lk
+bool areAdjacent(Loop *Lj, Loop* Lk, SmallVectorImpl<BasicBlock*> &between){
+  BasicBlock *exitBlockL1 = Lj->getExitBlock();
+  BasicBlock *preHeaderL2 = Lk->getLoopPreheader();
+  if (!exitBlockL1 || !preHeaderL2)
+    return false;
+
+  between.clear();
+  BasicBlock *BB = exitBlockL1;
+  while (true) {
+    between.push_back(BB);
+    if (BB == preHeaderL2)
+      return true;
+    // Il blocco può terminare senza successori (es. con una ret se Lk precede Lj)
+    BasicBlock *next = BB->getSingleSuccessor();
+    if (!next || next == exitBlockL1 || next->getSinglePredecessor() != BB)
+      return false;
+    BB = next;
+  }
 }
 
 // Funzione di supporto per controllare se il loop Lj e Lk siano equivalenti dal punto di vista del flusso di esecuzione
 bool areControlFlowEquivalent(Loop *Lj, Loop *Lk, DominatorTree &DT, PostDominatorTree &PDT) {
   // Verifica se l'header di Lj domina l'header di Lk
   if (!DT.dominates(Lj->getLoopPreheader(), Lk->getLoopPreheader())) {
-    outs() << "Lj non domina Lk\n";
+    LLVM_DEBUG(dbgs() << "Lj non domina Lk\n");
     return false;
   }
     
   // Verifica se l'header di Lk post-domina l'header di Lj
   if (!PDT.dominates(Lk->getLoopPreheader(), Lj->getLoopPreheader())) {
-    outs() << "Lk non post-domina Lj\n";
+    LLVM_DEBUG(dbgs() << "Lk non post-domina Lj\n");
     return false;
   }
 
   return true; // Lj e Lk sono control flow equivalent
 }
 
-// Funzione di supporto che controlla se i due loop hanno lo stesso spazio di iterazione
-bool sameTripCount(Loop *Lj, Loop *Lk, ScalarEvolution &SE){
-  //const SCEV *tripCountJ = SE.getBackedgeTakenCount(Lj);
-  //const SCEV *tripCountK = SE.getBackedgeTakenCount(Lk);
-  const int tripCountJ = SE.getSmallConstantTripCount(Lj);
-  const int tripCountK = SE.getSmallConstantTripCount(Lk);
+// Funzione di supporto che cerca nell'header di L una variabile di induzione intera con passo 1.
+// Non deve essere per forza canonica: dopo il peeling la variabile di Lj non parte più da 0
+static PHINode *getUnitStrideIV(Loop *L, ScalarEvolution &SE) {
+  for (PHINode &PN : L->getHeader()->phis()) {
+    if (!PN.getType()->isIntegerTy())
+      continue;
+    auto *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(&PN));
+    if (AR && AR->getLoop() == L && AR->isAffine() && AR->getStepRecurrence(SE)->isOne())
+      return &PN;
+  }
+  return nullptr;
+}
 
-  outs() << "Trip count Lj: " << tripCountJ << "\n";
-  outs() << "Trip count Lk: " << tripCountK << "\n";
-  
+// Funzione di supporto che controlla se i due loop hanno lo stesso spazio di iterazione.
+// I backedge-taken count sono confrontati come espressioni SCEV, quindi anche loop con limiti noti solo
+// a runtime (n, n-1, ...) possono essere confrontati; un count non calcolabile non è mai uguale a un altro.
+// Se Lj esegue un numero costante di iterazioni in più di Lk (al più -loopfusion-max-peel), in PeelCount
+// viene restituito il numero di iterazioni da togliere a Lj con il peeling perché i due loop siano fusi.
+// Il peeling si fa solo su Lj: se è Lk a eseguire più iterazioni la coppia è scartata e SecondLonger
+// viene messo a true (togliere le prime iterazioni di Lk le lascerebbe tra i due loop)
+bool sameTripCount(Loop *Lj, Loop *Lk, ScalarEvolution &SE, unsigned &PeelCount, bool &SecondLonger){
+  PeelCount = 0;
+  SecondLonger = false;
+  const SCEV *tripCountJ = SE.getBackedgeTakenCount(Lj);
+  const SCEV *tripCountK = SE.getBackedgeTakenCount(Lk);
+
+  LLVM_DEBUG(dbgs() << "Backedge-taken count Lj: " << *tripCountJ << "\n");
+  LLVM_DEBUG(dbgs() << "Backedge-taken count Lk: " << *tripCountK << "\n");
+
+  if (isa<SCEVCouldNotCompute>(tripCountJ) || isa<SCEVCouldNotCompute>(tripCountK))
+    return false;
+
+  // I count sono valori senza segno: se i tipi sono diversi li porto al più largo dei due
+  Type *wideType = SE.getWiderType(tripCountJ->getType(), tripCountK->getType());
+  tripCountJ = SE.getNoopOrZeroExtend(tripCountJ, wideType);
+  tripCountK = SE.getNoopOrZeroExtend(tripCountK, wideType);
+
+  // Le espressioni SCEV sono uniche: due count uguali sono lo stesso oggetto
   if (tripCountJ == tripCountK)
     return true;
 
+  // La differenza può diventare costante solo usando le condizioni che proteggono l'ingresso nel loop
+  // (es. smax(0, n) e smax(0, n - 1) quando n > 0)
+  auto *difference = dyn_cast<SCEVConstant>(SE.getMinusSCEV(tripCountJ, tripCountK));
+  if (!difference) {
+    tripCountJ = SE.applyLoopGuards(tripCountJ, Lj);
+    tripCountK = SE.applyLoopGuards(tripCountK, Lj);
+    difference = dyn_cast<SCEVConstant>(SE.getMinusSCEV(tripCountJ, tripCountK));
+  }
+  if (!difference)
+    return false;
+
+  LLVM_DEBUG(dbgs() << "Differenza tra i trip count: " << *difference << "\n");
+
+  // Il peeling è fatto solo sul primo loop: le iterazioni tolte restano prima di Lj e i due loop restano adiacenti.
+  // Lj deve eseguire almeno PeelCount iterazioni, cioè la differenza non deve derivare da un overflow del count
+  const APInt &extra = difference->getAPInt();
+  if (extra.isNegative()) {
+    SecondLonger = true;
+    return false;
+  }
+  if (extra.ugt(MaxPeelCount) || !Lj->isInnermost())
+    return false;
+  if (!SE.isKnownPredicate(ICmpInst::ICMP_UGE, tripCountJ, difference) &&
+      !SE.isLoopEntryGuardedByCond(Lj, ICmpInst::ICMP_UGE, tripCountJ, difference))
+    return false;
+
+  PeelCount = extra.getZExtValue();
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// DIPENDENZE TRA I DUE LOOP
+// Solo le istruzioni che accedono alla memoria possono creare una dipendenza tra
+// i due loop. Per ogni loop si costruisce un indice dei suoi accessi raggruppati
+// per oggetto sottostante, e vengono confrontate solo le coppie di gruppi che
+// possono riferirsi alla stessa memoria. Gli indici restano validi finché il loop
+// non viene fuso, quindi l'indice di un loop viene costruito una volta sola anche
+// se il loop è provato con il precedente e con il successivo.
+// ---------------------------------------------------------------------------
+
+// Accessi in memoria di un loop, raggruppati per oggetto sottostante. Le istruzioni
+// senza un puntatore (es. le chiamate) sono raggruppate con chiave nullptr
+using MemoryAccessIndex = MapVector<const Value*, SmallVector<Instruction*, 4>>;
+
+class FusionDependenceChecker {
+  DependenceInfo &DI;
+  ScalarEvolution &SE;
+  const DataLayout &DL;
+  DenseMap<Loop*, MemoryAccessIndex> indices;
+
+  bool isReversedByFusion(Instruction *Ij, Loop *Lj, Instruction *Ik, Loop *Lk, unsigned PeelCount);
+
+public:
+  FusionDependenceChecker(DependenceInfo &DI, ScalarEvolution &SE, const DataLayout &DL) : DI(DI), SE(SE), DL(DL) {}
+
+  // Indice degli accessi in memoria di L, costruito alla prima richiesta
+  const MemoryAccessIndex &getIndex(Loop *L);
+
+  // Ritorna true se la fusione di Lj e Lk inverte l'ordine di due accessi dipendenti
+  bool hasNegativeDependencies(Loop *Lj, Loop *Lk, unsigned PeelCount);
+
+  // Ritorna true se c'è una dipendenza tra Src e Dst, eseguite in quest'ordine
+  bool mayDepend(Instruction *Src, Instruction *Dst);
+
+  // Ritorna true se l'istruzione I, eseguita dopo (LoopFirst) o prima di L, non ha dipendenze con L
+  bool isIndependentOfLoop(Instruction *I, Loop *L, bool LoopFirst);
+
+  // Da chiamare quando il loop è stato modificato dalla fusione
+  void forgetLoop(Loop *L) { indices.erase(L); }
+};
+
+const MemoryAccessIndex &FusionDependenceChecker::getIndex(Loop *L) {
+  auto cached = indices.find(L);
+  if (cached != indices.end())
+    return cached->second;
+
+  MemoryAccessIndex &index = indices[L];
+  for (BasicBlock *BB : L->blocks())
+    for (Instruction &I : *BB) {
+      if (!I.mayReadOrWriteMemory())
+        continue;
+      index[getAccessedObject(&I)].push_back(&I);
+    }
+  return index;
+}
+
+// Funzione di supporto che ritorna true se la dipendenza è portata da uno dei loop che contengono
+// entrambi i loop: la prima direzione diversa da = è <, quindi la fusione non ne cambia l'ordine
+static bool isCarriedByOuterLoop(const Dependence &Dep) {
+  for (unsigned level = 1; level <= Dep.getLevels(); ++level) {
+    unsigned direction = Dep.getDirection(level);
+    if (direction == Dependence::DVEntry::EQ)
+      continue;
+    return direction == Dependence::DVEntry::LT;
+  }
   return false;
 }
 
-bool hasNegativeDependencies(Loop *Lj, Loop *Lk, DependenceInfo &DA){
-  // Itero per tutti i Basic Block del loop Lj
-  for (auto *BBj : Lj->getBlocks()){
-    // Itero per tutte le istruzioni nel Basic Block del loop Lj
-    for (auto &Ij : *BBj){
-      // Itero per tutti i Basic Block del loop Lk
-      for (auto *BBk : Lk->getBlocks()){
-        // Itero per tutte le istruzioni nel Basic Block del loop Lk
-        for (auto &Ik : *BBk){
-          // Verifico se esiste una dipendenza tra le due istruzioni
-          if (auto dep = DA.depends(&Ij, &Ik, true)){ // se non vi è dipendenza, allora ritornerà null
-            // Verifichiamo se vi è una DIPENDENZA NEGATIVA
-            outs() << "C'è una dipendenza tra l'istruzione ij: "<< Ij << " e l'istruzione ik: "<< Ik << "\n";
-
-            // Verifico se è una dipendenza negativa
-            if (dep->isAnti()){
-              outs() << "La dipendenza è negativa\n";
-              return true;
-            }
+// Ij (in Lj) e Ik (in Lk) vengono eseguiti in quest'ordine prima della fusione. Dopo la fusione l'iterazione x
+// di Lj e l'iterazione y di Lk sono eseguite nell'iterazione x - PeelCount e y del loop fuso. Se i due
+// accessi hanno lo stesso passo S, toccano lo stesso indirizzo quando x - y = (inizioK - inizioJ) / S:
+// questa distanza deve essere al più PeelCount, altrimenti Ik verrebbe eseguito prima di Ij
+bool FusionDependenceChecker::isReversedByFusion(Instruction *Ij, Loop *Lj, Instruction *Ik, Loop *Lk,
+                                                 unsigned PeelCount) {
+  // Due letture non sono mai in dipendenza
+  if (!Ij->mayWriteToMemory() && !Ik->mayWriteToMemory())
+    return false;
 
-          }
+  Value *ptrJ = getLoadStorePointerOperand(Ij);
+  Value *ptrK = getLoadStorePointerOperand(Ik);
+  if (ptrJ && ptrK &&
+      DL.getTypeStoreSize(getLoadStoreType(Ij)) == DL.getTypeStoreSize(getLoadStoreType(Ik))) {
+    TypeSize size = DL.getTypeStoreSize(getLoadStoreType(Ij));
+    auto *accessJ = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(ptrJ));
+    auto *accessK = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(ptrK));
+    if (accessJ && accessK && accessJ->getLoop() == Lj && accessK->getLoop() == Lk &&
+        accessJ->isAffine() && accessK->isAffine() &&
+        accessJ->getStepRecurrence(SE) == accessK->getStepRecurrence(SE)) {
+      auto *step = dyn_cast<SCEVConstant>(accessJ->getStepRecurrence(SE));
+      auto *offset = dyn_cast<SCEVConstant>(SE.getMinusSCEV(accessK->getStart(), accessJ->getStart()));
+      if (step && offset && !step->isZero()) {
+        APInt S = step->getAPInt().sextOrTrunc(64);
+        APInt D = offset->getAPInt().sextOrTrunc(64);
+        // Con un offset che non è multiplo del passo gli accessi (della stessa dimensione) possono
+        // sovrapporsi solo in parte, e con un passo più piccolo dell'accesso si sovrappongono anche a
+        // distanze vicine a D / S, alcune negative: entrambi i casi restano all'analisi delle dipendenze
+        if (D.srem(S).isZero() && !size.isScalable() && S.abs().uge(size.getFixedValue())) {
+          int64_t distance = D.sdiv(S).getSExtValue();
+          LLVM_DEBUG(dbgs() << "Distanza tra " << *Ij << " e " << *Ik << ": " << distance << "\n");
+          return distance > (int64_t)PeelCount;
         }
       }
     }
   }
 
+  // Senza una distanza nota la dipendenza è accettata solo se non esiste o se è portata da un loop esterno
+  std::unique_ptr<Dependence> dep = DI.depends(Ij, Ik, true);
+  if (!dep)
+    return false;
+  LLVM_DEBUG(dbgs() << "C'è una dipendenza tra l'istruzione ij: " << *Ij << " e l'istruzione ik: " << *Ik << "\n");
+  return !isCarriedByOuterLoop(*dep);
+}
+
+bool FusionDependenceChecker::mayDepend(Instruction *Src, Instruction *Dst) {
+  if (!Src->mayReadOrWriteMemory() || !Dst->mayReadOrWriteMemory())
+    return false;
+  if (!Src->mayWriteToMemory() && !Dst->mayWriteToMemory())
+    return false;
+  return DI.depends(Src, Dst, true) != nullptr;
+}
+
+bool FusionDependenceChecker::isIndependentOfLoop(Instruction *I, Loop *L, bool LoopFirst) {
+  if (!I->mayReadOrWriteMemory())
+    return true;
+  const Value *object = getAccessedObject(I);
+  for (auto &group : getIndex(L)) {
+    if (!mayShareMemory(object, group.first))
+      continue;
+    for (Instruction *X : group.second)
+      if (LoopFirst ? mayDepend(X, I) : mayDepend(I, X))
+        return false;
+  }
+  return true;
+}
+
+bool FusionDependenceChecker::hasNegativeDependencies(Loop *Lj, Loop *Lk, unsigned PeelCount) {
+  const MemoryAccessIndex &accessesJ = getIndex(Lj);
+  const MemoryAccessIndex &accessesK = getIndex(Lk);
+
+  for (auto &groupJ : accessesJ)
+    for (auto &groupK : accessesK) {
+      if (!mayShareMemory(groupJ.first, groupK.first))
+        continue;
+      for (Instruction *Ij : groupJ.second)
+        for (Instruction *Ik : groupK.second)
+          if (isReversedByFusion(Ij, Lj, Ik, Lk, PeelCount)) {
+            LLVM_DEBUG(dbgs() << "La fusione inverte la dipendenza tra " << *Ij << " e " << *Ik << "\n");
+            return true;
+          }
+    }
+
   return false; // Nessuna dipendenza a distanza negativa trovata
 }
 
+// ---------------------------------------------------------------------------
+// MODELLO DI PROFITTO
+// Ogni accesso affine di un loop è un flusso di dati che attraversa la cache:
+// a ogni iterazione porta in cache min(|passo|, linea) byte nuovi. Quando i due
+// loop leggono lo stesso array con lo stesso passo, senza fusione il secondo
+// loop ritrova i dati in cache solo se tutto quello che i due loop toccano nel
+// frattempo (la distanza di riuso) sta nella cache; dopo la fusione la distanza
+// di riuso si riduce a poche iterazioni. Il risparmio è confrontato, in byte per
+// iterazione, con i costi della fusione: un working set del loop fuso più grande
+// della cache e la perdita della vettorizzazione di uno dei due loop. La fusione
+// elimina comunque il controllo di uno dei due loop, quindi a parità di traffico
+// (per esempio due loop indipendenti o con pochi dati) conviene fondere: si
+// rinuncia solo quando i costi superano il risparmio.
+// ---------------------------------------------------------------------------
+
+// Flusso di dati di un loop: gli accessi a uno stesso oggetto con lo stesso passo
+// e inizi che distano meno di una linea di cache
+struct AccessStream {
+  const Value *object;
+  const SCEV *start;
+  int64_t stride;
+  uint64_t bytesPerIteration;
+};
+
+// Informazioni di un loop usate dal modello, calcolate una volta per loop
+struct LoopProfile {
+  SmallVector<AccessStream, 8> streams;
+  uint64_t bytesPerIteration = 0;
+  bool vectorizable = false;
+  unsigned runtimeChecks = 0;
+};
+
+class FusionProfitabilityModel {
+  ScalarEvolution &SE;
+  LoopAccessInfoManager &LAIs;
+  FusionDependenceChecker &Deps;
+  uint64_t lineSize;
+  DenseMap<Loop*, LoopProfile> profiles;
+
+  const LoopProfile &getProfile(Loop *L);
+  bool isVectorizable(Loop *L);
+  const AccessStream *findSharedStream(const LoopProfile &profile, const AccessStream &stream, uint64_t &distance);
+
+public:
+  FusionProfitabilityModel(ScalarEvolution &SE, LoopAccessInfoManager &LAIs, FusionDependenceChecker &Deps,
+                           TargetTransformInfo &TTI)
+      : SE(SE), LAIs(LAIs), Deps(Deps), lineSize(TTI.getCacheLineSize() ? TTI.getCacheLineSize() : 64) {}
+
+  // Ritorna false solo se i costi della fusione superano il traffico verso la memoria che risparmia
+  bool isProfitable(Loop *Lj, Loop *Lk);
+
+  // Da chiamare quando il loop è stato modificato dalla fusione
+  void forgetLoop(Loop *L) {
+    profiles.erase(L);
+    LAIs.clear();
+  }
+};
+
+// Un loop resta vettorizzabile se gli accessi in memoria lo permettono (gli stessi controlli del loop vectorizer)
+// e se ogni PHI dell'header è una variabile di induzione o una riduzione
+bool FusionProfitabilityModel::isVectorizable(Loop *L) {
+  if (!L->isInnermost() || !L->getLoopPreheader() || !L->getExitingBlock())
+    return false;
+  for (PHINode &PN : L->getHeader()->phis()) {
+    InductionDescriptor ID;
+    RecurrenceDescriptor RD;
+    if (!InductionDescriptor::isInductionPHI(&PN, L, &SE, ID) && !RecurrenceDescriptor::isReductionPHI(&PN, L, RD))
+      return false;
+  }
+  return LAIs.getInfo(*L).canVectorizeMemory();
+}
+
+const LoopProfile &FusionProfitabilityModel::getProfile(Loop *L) {
+  auto cached = profiles.find(L);
+  if (cached != profiles.end())
+    return cached->second;
+
+  LoopProfile &profile = profiles[L];
+  for (auto &group : Deps.getIndex(L))
+    for (Instruction *I : group.second) {
+      Value *ptr = getLoadStorePointerOperand(I);
+      auto *access = ptr ? dyn_cast<SCEVAddRecExpr>(SE.getSCEV(ptr)) : nullptr;
+      if (!access || access->getLoop() != L || !access->isAffine())
+        continue;
+      auto *step = dyn_cast<SCEVConstant>(access->getStepRecurrence(SE));
+      if (!step || step->isZero())
+        continue;
+
+      AccessStream stream{group.first, access->getStart(), step->getAPInt().getSExtValue(), 0};
+      stream.bytesPerIteration = std::min<uint64_t>(std::abs(stream.stride), lineSize);
+      bool known = llvm::any_of(profile.streams, [&](const AccessStream &other) {
+        if (other.object != stream.object || other.stride != stream.stride)
+          return false;
+        auto *offset = dyn_cast<SCEVConstant>(SE.getMinusSCEV(stream.start, other.start));
+        return offset && offset->getAPInt().abs().ult(lineSize);
+      });
+      if (!known) {
+        profile.streams.push_back(stream);
+        profile.bytesPerIteration += stream.bytesPerIteration;
+      }
+    }
+
+  profile.vectorizable = isVectorizable(L);
+  if (profile.vectorizable)
+    profile.runtimeChecks = LAIs.getInfo(*L).getNumRuntimePointerChecks();
+  return profile;
+}
+
+// Cerca in profile un flusso sullo stesso oggetto e con lo stesso passo di stream, a una distanza costante
+// (in iterazioni), che viene restituita in distance
+const AccessStream *FusionProfitabilityModel::findSharedStream(const LoopProfile &profile, const AccessStream &stream,
+                                                               uint64_t &distance) {
+  for (const AccessStream &other : profile.streams) {
+    if (!other.object || other.object != stream.object || other.stride != stream.stride)
+      continue;
+    auto *offset = dyn_cast<SCEVConstant>(SE.getMinusSCEV(stream.start, other.start));
+    if (!offset)
+      continue;
+    distance = offset->getAPInt().abs().getZExtValue() / std::abs(stream.stride);
+    return &other;
+  }
+  return nullptr;
+}
+
+bool FusionProfitabilityModel::isProfitable(Loop *Lj, Loop *Lk) {
+  const LoopProfile &profileJ = getProfile(Lj);
+  const LoopProfile &profileK = getProfile(Lk);
+
+  // Distanza di riuso senza fusione: i dati toccati dai due loop tra i due accessi allo stesso elemento.
+  // Con un trip count sconosciuto si assume che superi la cache
+  unsigned tripCount = SE.getSmallConstantMaxTripCount(Lj);
+  uint64_t unfusedReuse = tripCount ? tripCount * (profileJ.bytesPerIteration + profileK.bytesPerIteration) / 2
+                                    : std::numeric_limits<uint64_t>::max();
+
+  uint64_t fusedBytes = profileJ.bytesPerIteration;
+  uint64_t fusedStreams = profileJ.streams.size();
+  uint64_t maxDistance = 0;
+  uint64_t saved = 0;
+  for (const AccessStream &stream : profileK.streams) {
+    uint64_t distance = 0;
+    if (!findSharedStream(profileJ, stream, distance)) {
+      fusedBytes += stream.bytesPerIteration;
+      ++fusedStreams;
+      continue;
+    }
+    maxDistance = std::max(maxDistance, distance);
+    if (unfusedReuse > CacheSize)
+      saved += stream.bytesPerIteration;
+  }
+
+  // Il loop fuso tiene in cache una linea per flusso più i dati riusati a distanza maxDistance iterazioni:
+  // se non ci stanno, ogni flusso del loop fuso torna a leggere dalla memoria
+  uint64_t cost = 0;
+  uint64_t fusedWorkingSet = fusedStreams * lineSize + maxDistance * fusedBytes;
+  if (fusedWorkingSet > CacheSize) {
+    cost += fusedBytes;
+    saved = 0;
+  }
+
+  // Un loop vettorizzabile che perde la vettorizzazione costa almeno quanto il suo traffico verso la memoria
+  bool fusedVectorizable = profileJ.vectorizable && profileK.vectorizable &&
+                           profileJ.runtimeChecks + profileK.runtimeChecks <= VectorizerParams::RuntimeMemoryCheckThreshold;
+  if (!fusedVectorizable) {
+    if (profileJ.vectorizable)
+      cost += profileJ.bytesPerIteration;
+    if (profileK.vectorizable)
+      cost += profileK.bytesPerIteration;
+  }
+
+  LLVM_DEBUG(dbgs() << "Risparmio stimato: " << saved << " byte/iterazione, costo stimato: " << cost
+                    << " byte/iterazione, working set del loop fuso: " << fusedWorkingSet << " byte\n");
+  // A parità il loop fuso è comunque migliore: esegue il controllo di un solo loop per iterazione
+  return saved >= cost;
+}
+
+// Funzione di supporto che ritorna true se ogni istruzione del loop passa sempre il controllo alla successiva
+// (nessuna eccezione, nessuna chiamata che può non ritornare): solo allora un'istruzione con effetti
+// collaterali può essere spostata dall'altra parte del loop
+static bool alwaysTransfersExecution(Loop *L) {
+  for (BasicBlock *BB : L->blocks())
+    for (Instruction &I : *BB)
+      if (!isGuaranteedToTransferExecutionToSuccessor(&I))
+        return false;
+  return true;
+}
+
+// Funzione di supporto che decide dove spostare le istruzioni che si trovano tra i due loop.
+// Un'istruzione viene spostata nel preheader di Lj se non usa valori di Lj né valori che restano tra i loop,
+// e se non ha dipendenze in memoria con Lj o con le istruzioni precedenti che restano tra i loop.
+// Le altre vengono spostate all'inizio dell'exit block di Lk se Lk non le usa e non ha dipendenze con loro.
+// Ritorna false se qualche istruzione non può essere spostata: in quel caso l'IR non viene modificato
+static bool planInterveningCodeMotion(Loop *Lj, Loop *Lk, FusionDependenceChecker &Deps, FusionPlan &Plan) {
+  SmallPtrSet<BasicBlock*, 4> betweenSet(Plan.between.begin(), Plan.between.end());
+  SmallPtrSet<Instruction*, 8> hoisted;
+  SmallVector<Instruction*, 8> remaining;
+  bool ljTransfers = alwaysTransfersExecution(Lj);
+  bool remainingTransfer = true;
+
+  for (BasicBlock *BB : Plan.between)
+    for (Instruction &I : *BB) {
+      if (I.isTerminator())
+        continue;
+      if (isa<PHINode>(I) || I.isEHPad())
+        return false;
+
+      bool canHoist = (ljTransfers && remainingTransfer) || isSafeToSpeculativelyExecute(&I);
+      for (Value *op : I.operands()) {
+        auto *opInst = dyn_cast<Instruction>(op);
+        if (opInst && (Lj->contains(opInst) || (betweenSet.count(opInst->getParent()) && !hoisted.count(opInst))))
+          canHoist = false;
+      }
+      canHoist = canHoist && Deps.isIndependentOfLoop(&I, Lj, true) &&
+                 llvm::none_of(remaining, [&](Instruction *R) { return Deps.mayDepend(R, &I); });
+
+      if (canHoist) {
+        hoisted.insert(&I);
+        Plan.hoistBeforeLj.push_back(&I);
+      } else {
+        remaining.push_back(&I);
+        remainingTransfer &= isGuaranteedToTransferExecutionToSuccessor(&I);
+      }
+    }
+
+  if (remaining.empty())
+    return true;
+
+  // Dopo Lk il codice viene eseguito per ultimo, quindi le istruzioni vengono visitate al contrario:
+  // quando si arriva a un'istruzione, i suoi user tra i due loop sono già stati decisi
+  // Le istruzioni affondate devono essere eseguite solo all'uscita da Lk: l'exit block non deve essere
+  // raggiungibile da altri percorsi che non le avrebbero eseguite
+  BasicBlock *exitBlockL2 = Lk->getExitBlock();
+  if (!exitBlockL2 || exitBlockL2->getSinglePredecessor() != Lk->getHeader())
+    return false;
+  bool lkTransfers = alwaysTransfersExecution(Lk);
+  SmallPtrSet<Instruction*, 8> sunk;
+  for (Instruction *I : llvm::reverse(remaining)) {
+    if (!lkTransfers && !isSafeToSpeculativelyExecute(I))
+      return false;
+    for (User *U : I->users()) {
+      auto *userInst = cast<Instruction>(U);
+      if (Lk->contains(userInst) || (isa<PHINode>(userInst) && userInst->getParent() == exitBlockL2) ||
+          (betweenSet.count(userInst->getParent()) && !sunk.count(userInst)))
+        return false;
+    }
+    if (!Deps.isIndependentOfLoop(I, Lk, false))
+      return false;
+    sunk.insert(I);
+    Plan.sinkAfterLk.push_back(I);
+  }
+  return true;
+}
+
 // Funzione di supporto che verifica se tutte le condizioni per la loop fusion siano garantite
-bool canFuseLoops(Loop *Lj, Loop *Lk, LoopInfo &LI, DominatorTree &DT, PostDominatorTree &PDT, ScalarEvolution &SE, DependenceInfo &DI) {
-  // Condizione 1: Lj e Lk devono essere adiacenti
-  if (!areAdjacent(Lj, Lk)) {
-    outs() << "Non sono adiacenti\n";
+// In Plan vengono restituiti il peeling e gli spostamenti di codice da fare prima della fusione
+// Se Profitability è nullptr la convenienza della fusione non viene valutata
+bool canFuseLoops(Loop *Lj, Loop *Lk, LoopInfo &LI, DominatorTree &DT, PostDominatorTree &PDT, ScalarEvolution &SE,
+                  FusionDependenceChecker &Deps, FusionProfitabilityModel *Profitability,
+                  OptimizationRemarkEmitter &ORE, FusionPlan &Plan) {
+  // Condizione 1: Lj e Lk devono essere adiacenti, a meno di codice senza diramazioni tra i due
+  if (!areAdjacent(Lj, Lk, Plan.between)) {
+    LLVM_DEBUG(dbgs() << "Non sono adiacenti\n");
+    ++NumNotAdjacent;
+    emitNotFused(ORE, Lj, Lk, "NotAdjacent", "non sono adiacenti");
     return false;
   }
 
   // Condizione 2: Lj e Lk devono iterare lo stesso numero di volte
-  if (!sameTripCount(Lj, Lk, SE)) {
-    outs() << "Non hanno lo stesso numero di iterazioni\n";
+  bool secondLonger = false;
+  if (!sameTripCount(Lj, Lk, SE, Plan.PeelCount, secondLonger)) {
+    LLVM_DEBUG(dbgs() << "Non hanno lo stesso numero di iterazioni\n");
+    ++NumDifferentTripCount;
+    if (secondLonger)
+      emitNotFused(ORE, Lj, Lk, "SecondLoopLonger",
+                   "il secondo loop esegue più iterazioni del primo e il peeling si applica solo al primo");
+    else
+      emitNotFused(ORE, Lj, Lk, "DifferentTripCount", "non hanno lo stesso numero di iterazioni");
+    return false;
+  }
+
+  // Nel loop fuso la variabile di Lk è ricalcolata da quella di Lj, quindi devono avere lo stesso tipo:
+  // il confronto dei trip count estende il più stretto e accetta anche un loop i32 e uno i64
+  PHINode *IVj = getUnitStrideIV(Lj, SE);
+  PHINode *IVk = getUnitStrideIV(Lk, SE);
+  if (!IVj || !IVk || IVj->getType() != IVk->getType()) {
+    LLVM_DEBUG(dbgs() << "Le variabili di induzione mancano o hanno tipi diversi\n");
+    ++NumIncompatibleIV;
+    emitNotFused(ORE, Lj, Lk, "IncompatibleIV", "non hanno variabili di induzione con passo 1 dello stesso tipo");
     return false;
   }
 
   // Condizione 3: Lj e Lk devono essere equivalenti nel flusso di controllo
   if (!areControlFlowEquivalent(Lj, Lk, DT, PDT)){
-    outs() << "Non sono control flow equivalent\n";
+    LLVM_DEBUG(dbgs() << "Non sono control flow equivalent\n");
+    ++NumNotControlFlowEquivalent;
+    emitNotFused(ORE, Lj, Lk, "NotControlFlowEquivalent", "non sono control flow equivalent");
     return false;
   }
   
   // Condizione 4: Non ci devono essere dipendenze a distanza negativa
-  if (hasNegativeDependencies(Lj, Lk, DI)) return false;
+  if (Deps.hasNegativeDependencies(Lj, Lk, Plan.PeelCount)) {
+    ++NumNegativeDependence;
+    emitNotFused(ORE, Lj, Lk, "NegativeDependence", "c'è una dipendenza a distanza negativa");
+    return false;
+  }
 
+  // Condizione 5: il codice tra i due loop deve poter essere spostato prima di Lj o dopo Lk
+  if (!planInterveningCodeMotion(Lj, Lk, Deps, Plan)) {
+    LLVM_DEBUG(dbgs() << "Il codice tra i due loop non può essere spostato\n");
+    ++NumNotAdjacent;
+    emitNotFused(ORE, Lj, Lk, "NotAdjacent", "il codice tra i due loop non può essere spostato");
+    return false;
+  }
+
+  // Condizione 6: la fusione non deve aumentare il traffico verso la memoria più di quanto lo riduce
+  if (Profitability && !Profitability->isProfitable(Lj, Lk)) {
+    LLVM_DEBUG(dbgs() << "La fusione non è conveniente\n");
+    ++NumUnprofitable;
+    emitNotFused(ORE, Lj, Lk, "Unprofitable", "la fusione aumenta il traffico verso la memoria");
+    return false;
+  }
+
+  return true;
+}
+
+// Funzione di supporto che controlla se le istruzioni di un blocco eliminato dalla fusione possono
+// sparire insieme al blocco: niente effetti collaterali e nessun uso fuori dai blocchi eliminati.
+// La variabile di induzione IV è esclusa perché i suoi usi passano alla variabile del primo loop
+static bool isRemovableWithBlocks(BasicBlock *BB, const SmallSetVector<BasicBlock*, 8> &deadBlocks, PHINode *IV) {
+  for (Instruction &I : *BB) {
+    if (&I == IV || I.isTerminator())
+      continue;
+    if (I.mayHaveSideEffects())
+      return false;
+    for (User *U : I.users())
+      if (!deadBlocks.count(cast<Instruction>(U)->getParent()))
+        return false;
+  }
   return true;
 }
 
-void fuseLoops(Loop *Lj, Loop *Lk, LoopInfo &LI, ScalarEvolution &SE, DominatorTree &DT){
-  outs() << "----INIZIO LA FUSIONE DEI DUE LOOP----\n";
+// Funzione di supporto che sposta in Lj i blocchi e i sotto-loop rimasti di Lk ed elimina Lk da LoopInfo.
+// I blocchi in deadBlocks vengono tolti da tutti i loop (Lk e i loop che lo contengono)
+static void mergeLoopInfo(Loop *Lj, Loop *Lk, LoopInfo &LI, const SmallSetVector<BasicBlock*, 8> &deadBlocks) {
+  for (BasicBlock *BB : deadBlocks)
+    LI.removeBlock(BB);
+
+  // Lj e Lk hanno lo stesso loop padre, che contiene già tutti i blocchi di Lk
+  SmallVector<BasicBlock*, 8> blocks(Lk->blocks());
+  for (BasicBlock *BB : blocks) {
+    Lj->addBlockEntry(BB);
+    Lk->removeBlockFromLoop(BB);
+    if (LI.getLoopFor(BB) == Lk)
+      LI.changeLoopFor(BB, Lj);
+  }
+
+  while (!Lk->isInnermost())
+    Lj->addChildLoop(Lk->removeChildLoop(std::prev(Lk->end())));
+
+  if (Loop *parent = Lk->getParentLoop())
+    parent->removeChildLoop(Lk);
+  else
+    LI.removeLoop(llvm::find(LI, Lk));
+  LI.destroy(Lk);
+}
+
+// Funzione di supporto che toglie a L le prime PeelCount iterazioni copiandone i blocchi prima dell'header.
+// L deve essere innermost, con l'uscita nell'header, ed eseguire almeno PeelCount iterazioni: nelle copie
+// l'header non esce mai dal loop e il suo branch diventa incondizionato, quindi l'exit block non cambia.
+// L'ultimo latch copiato diventa il nuovo preheader di L
+static void peelFirstIterations(Loop *L, unsigned PeelCount, LoopInfo &LI, DominatorTree &DT, PostDominatorTree &PDT) {
+  BasicBlock *preHeader = L->getLoopPreheader();
+  BasicBlock *header = L->getHeader();
+  BasicBlock *latch = L->getLoopLatch();
+  Function *F = header->getParent();
+
+  // Valore di ogni PHI dell'header all'inizio dell'iterazione che viene copiata
+  DenseMap<PHINode*, Value*> entryValues;
+  for (PHINode &PN : header->phis())
+    entryValues[&PN] = PN.getIncomingValueForBlock(preHeader);
+
+  SmallVector<BasicBlock*, 16> allClones;
+  BasicBlock *pred = preHeader;
+  for (unsigned iter = 0; iter < PeelCount; ++iter) {
+    ValueToValueMapTy VMap;
+    SmallVector<BasicBlock*, 8> clones;
+    for (BasicBlock *BB : L->blocks()) {
+      BasicBlock *clone = CloneBasicBlock(BB, VMap, ".peel" + Twine(iter), F);
+      clone->moveBefore(header);
+      VMap[BB] = clone;
+      clones.push_back(clone);
+      if (Loop *parent = L->getParentLoop())
+        parent->addBasicBlockToLoop(clone, LI);
+    }
+
+    // Nella copia le PHI dell'header sono sostituite dal loro valore all'ingresso nell'iterazione
+    for (PHINode &PN : header->phis()) {
+      Instruction *phiClone = cast<Instruction>(VMap[&PN]);
+      VMap[&PN] = entryValues[&PN];
+      phiClone->eraseFromParent();
+    }
+    remapInstructionsInBlocks(clones, VMap);
+
+    BasicBlock *headerClone = cast<BasicBlock>(VMap[header]);
+    BasicBlock *latchClone = cast<BasicBlock>(VMap[latch]);
+
+    auto *exitBranch = cast<BranchInst>(headerClone->getTerminator());
+    Value *exitCond = exitBranch->getCondition();
+    BranchInst::Create(exitBranch->getSuccessor(0), exitBranch);
+    exitBranch->eraseFromParent();
+    RecursivelyDeleteTriviallyDeadInstructions(exitCond);
+
+    // La copia è raggiunta dal blocco precedente e prosegue verso l'header di L
+    Instruction *latchTerm = latchClone->getTerminator();
+    latchTerm->replaceSuccessorWith(headerClone, header);
+    latchTerm->setMetadata(LLVMContext::MD_loop, nullptr);
+    pred->getTerminator()->replaceSuccessorWith(header, headerClone);
+    pred = latchClone;
+
+    for (PHINode &PN : header->phis()) {
+      Value *next = PN.getIncomingValueForBlock(latch);
+      if (Value *mapped = VMap.lookup(next))
+        next = mapped;
+      entryValues[&PN] = next;
+    }
+    allClones.append(clones.begin(), clones.end());
+  }
+
+  for (PHINode &PN : header->phis()) {
+    int idx = PN.getBasicBlockIndex(preHeader);
+    PN.setIncomingBlock(idx, pred);
+    PN.setIncomingValue(idx, entryValues[&PN]);
+  }
+
+  SmallVector<DominatorTree::UpdateType, 16> updates = {
+      {DominatorTree::Delete, preHeader, header},
+      {DominatorTree::Insert, preHeader, preHeader->getTerminator()->getSuccessor(0)}};
+  for (BasicBlock *clone : allClones)
+    for (BasicBlock *succ : successors(clone))
+      updates.push_back({DominatorTree::Insert, clone, succ});
+
+  DomTreeUpdater DTU(DT, PDT, DomTreeUpdater::UpdateStrategy::Eager);
+  DTU.applyUpdates(updates);
+}
+
+// Funzione di supporto che divide dei loop fratelli (con lo stesso loop padre) in insiemi di candidati
+// alla fusione. I loop di un insieme sono control flow equivalent tra loro e ordinati come nel programma:
+// visitandoli nell'ordine DFS del dominator tree, un loop che ne domina un altro viene sempre prima.
+// Basta confrontare ogni loop con l'ultimo di ogni insieme, perché la relazione è transitiva
+static void collectFusionCandidates(ArrayRef<Loop*> siblings, DominatorTree &DT, PostDominatorTree &PDT,
+                                    SmallVectorImpl<SmallVector<Loop*, 4>> &candidateSets) {
+  DT.updateDFSNumbers();
+  SmallVector<Loop*, 8> ordered;
+  for (Loop *L : siblings)
+    if (L->getLoopPreheader())
+      ordered.push_back(L);
+  llvm::sort(ordered, [&](Loop *A, Loop *B) {
+    return DT.getNode(A->getHeader())->getDFSNumIn() < DT.getNode(B->getHeader())->getDFSNumIn();
+  });
+
+  for (Loop *L : ordered) {
+    auto candidates = llvm::find_if(candidateSets, [&](const SmallVector<Loop*, 4> &set) {
+      return areControlFlowEquivalent(set.back(), L, DT, PDT);
+    });
+    if (candidates == candidateSets.end())
+      candidateSets.emplace_back(1, L);
+    else
+      candidates->push_back(L);
+  }
+}
+
+// Ritorna false se la fusione non è stata effettuata (in quel caso l'IR non viene modificato).
+// DominatorTree, PostDominatorTree, LoopInfo e, se presente, MemorySSA vengono aggiornate
+// in modo incrementale; ScalarEvolution dimentica le informazioni dei due loop e le disposizioni.
+// Prima della fusione il codice tra i due loop viene spostato come deciso in Plan e, se Plan.PeelCount
+// non è zero, vengono tolte a Lj le sue prime PeelCount iterazioni (in quel caso MemorySSA non deve
+// essere passata, perché le copie non vi vengono aggiunte)
+bool fuseLoops(Loop *Lj, Loop *Lk, LoopInfo &LI, ScalarEvolution &SE, DominatorTree &DT,
+               PostDominatorTree &PDT, MemorySSA *MSSA, const FusionPlan &Plan){
+  LLVM_DEBUG(dbgs() << "----INIZIO LA FUSIONE DEI DUE LOOP----\n");
 
   // PASSO 1: modificare gli usi delle induction varaible nel body del loop 2 con quelli
   // della induction variable del loop 1
 
   // Cerco le variabili di induzione dei due loop
-  PHINode *IV1 = Lj->getCanonicalInductionVariable(); 
-  PHINode *IV2 = Lk->getCanonicalInductionVariable();
+  PHINode *IV1 = getUnitStrideIV(Lj, SE);
+  PHINode *IV2 = getUnitStrideIV(Lk, SE);
 
-  outs() << "1. Cerco le variabili di induzione...\n";
+  LLVM_DEBUG(dbgs() << "1. Cerco le variabili di induzione...\n");
 
   if (!IV1) {
-    outs() << "Impossibile trovare la variabile di induzione di lj.\n";
-    return;
+    LLVM_DEBUG(dbgs() << "Impossibile trovare la variabile di induzione di lj.\n");
+    return false;
   }
   if (!IV2) {
-    outs() << "Impossibile trovare la variabile di induzione di lk.\n";
-    return;
+    LLVM_DEBUG(dbgs() << "Impossibile trovare la variabile di induzione di lk.\n");
+    return false;
   }
 
-  outs() << "Variabili di induzione trovate\n";
+  LLVM_DEBUG(dbgs() << "Variabili di induzione trovate\n");
 
-  outs() << "2. Modifico gli usi delle variabili di induzione del secondo ciclo con quelle del primo ciclo...\n";
-
-  // Sostituire gli usi della variabile di induzione del loop k (il secondo loop)
-  for (auto *BB : Lk->blocks()) {
-    for (auto &I : *BB) {
-      // Per tutti gli operandi dell'istruzione nel Basic Block considerato
-      for (auto &Op : I.operands()) { 
-        // Se l'operando coincide con la induction var. del loop 2, allora sostituisco l'uso con quella del primo loop
-        if (Op == IV2)  
-          Op.set(IV1); // Sostituisco l'uso di IV2 con IV1
-        }
-      }
+  // Nel loop fuso la variabile di Lk vale quella di Lj più la differenza tra i valori iniziali,
+  // che deve essere costante; il peeling fa partire Lj da PeelCount iterazioni più avanti
+  if (IV1->getType() != IV2->getType()) {
+    LLVM_DEBUG(dbgs() << "Le variabili di induzione hanno tipi diversi\n");
+    return false;
   }
-  
-  outs() << "Variabili di induzione cambiate\n";
-
-  // PASSO 2: modifico il Control Flow Graph
-  outs() << "3. Inizio modifica del Control Flow Graph...\n";
+  const SCEV *startOffset = SE.getMinusSCEV(cast<SCEVAddRecExpr>(SE.getSCEV(IV2))->getStart(),
+                                            cast<SCEVAddRecExpr>(SE.getSCEV(IV1))->getStart());
+  if (!isa<SCEVConstant>(startOffset)) {
+    LLVM_DEBUG(dbgs() << "Le variabili di induzione non differiscono di una costante\n");
+    return false;
+  }
+  APInt ivOffset = cast<SCEVConstant>(startOffset)->getAPInt() - Plan.PeelCount;
 
   // Prelevo i Basic Block di cui ho bisogno per il passo 2
   // Loop 1
-  BasicBlock *latchL1 = (*Lj).getLoopLatch();
-  BasicBlock *endBodyL1 = (*latchL1).getPrevNode();
-  Instruction *bodyTerminatorL1 = (*endBodyL1).getTerminator();
-  BasicBlock *headerL1 = (*Lj).getHeader();
-  Instruction *headerTerminatorL1 = (*headerL1).getTerminator();
+  BasicBlock *latchL1 = Lj->getLoopLatch();
+  BasicBlock *endBodyL1 = latchL1 ? latchL1->getSinglePredecessor() : nullptr;
+  BasicBlock *headerL1 = Lj->getHeader();
+  BasicBlock *exitBlockL1 = Lj->getExitBlock();
+  BasicBlock *preHeaderL1 = Lj->getLoopPreheader();
 
   // Loop 2
-  BasicBlock *latchL2 = (*Lk).getLoopLatch();
-  BasicBlock *endBodyL2 = (*latchL2).getPrevNode();
-  Instruction *bodyTerminatorL2 = (*endBodyL2).getTerminator();
-  BasicBlock *headerL2 = (*Lk).getHeader();
-  BasicBlock *beginBodyL2 = (*headerL2).getNextNode();
-  BasicBlock *exitBlockL2 = (*Lk).getExitBlock();
-  Instruction *headerTerminatorL2 = (*headerL2).getTerminator();
+  BasicBlock *preHeaderL2 = Lk->getLoopPreheader();
+  BasicBlock *latchL2 = Lk->getLoopLatch();
+  BasicBlock *endBodyL2 = latchL2 ? latchL2->getSinglePredecessor() : nullptr;
+  BasicBlock *headerL2 = Lk->getHeader();
+  BasicBlock *exitBlockL2 = Lk->getExitBlock();
+
+  // La fusione riscrive solo loop nella forma header -> body -> latch con l'uscita nell'header:
+  // prima di toccare l'IR controllo che la forma sia questa
+  auto *headerBranchL1 = dyn_cast<BranchInst>(headerL1->getTerminator());
+  auto *headerBranchL2 = dyn_cast<BranchInst>(headerL2->getTerminator());
+  if (!endBodyL1 || !endBodyL2 || !exitBlockL1 || !exitBlockL2 || !preHeaderL1 || !preHeaderL2 ||
+      Lj->getExitingBlock() != headerL1 || Lk->getExitingBlock() != headerL2 ||
+      Lj->getParentLoop() != Lk->getParentLoop() ||
+      !headerBranchL1 || !headerBranchL1->isConditional() || headerBranchL1->getSuccessor(1) != exitBlockL1 ||
+      !headerBranchL2 || !headerBranchL2->isConditional() || headerBranchL2->getSuccessor(1) != exitBlockL2 ||
+      endBodyL1 == headerL1 || endBodyL2 == headerL2 ||
+      !endBodyL1->getSingleSuccessor() || !endBodyL2->getSingleSuccessor()) {
+    LLVM_DEBUG(dbgs() << "La forma dei loop non è supportata dalla fusione\n");
+    return false;
+  }
+  BasicBlock *beginBodyL2 = headerBranchL2->getSuccessor(0);
+  if (isa<PHINode>(beginBodyL2->front())) {
+    LLVM_DEBUG(dbgs() << "Il primo blocco del body di lk ha delle PHI\n");
+    return false;
+  }
+
+  // Dopo la fusione i blocchi tra i due loop (dall'exit block di Lj al preheader di Lk), l'header e il latch
+  // di Lk non sono più raggiungibili: il codice tra i due loop viene spostato e il controllo di Lk deve
+  // servire solo a Lk
+  SmallSetVector<BasicBlock*, 8> deadBlocks;
+  deadBlocks.insert(Plan.between.begin(), Plan.between.end());
+  deadBlocks.insert(headerL2);
+  deadBlocks.insert(latchL2);
+  if (Plan.between.front() != exitBlockL1 || Plan.between.back() != preHeaderL2 ||
+      exitBlockL1->getSinglePredecessor() != headerL1 ||
+      !isRemovableWithBlocks(headerL2, deadBlocks, IV2) || !isRemovableWithBlocks(latchL2, deadBlocks, IV2)) {
+    LLVM_DEBUG(dbgs() << "I blocchi eliminati dalla fusione contengono codice ancora necessario\n");
+    return false;
+  }
+
+  // Le espressioni dei due loop (trip count, AddRec, disposizioni) non saranno più valide
+  SE.forgetLoop(Lj);
+  SE.forgetLoop(Lk);
+
+  // Il codice tra i due loop viene spostato prima di Lj o dopo Lk, così i due loop diventano adiacenti
+  Instruction *hoistPoint = preHeaderL1->getTerminator();
+  for (Instruction *I : Plan.hoistBeforeLj) {
+    I->moveBefore(hoistPoint);
+    if (MSSA)
+      if (MemoryUseOrDef *MA = MSSA->getMemoryAccess(I))
+        MemorySSAUpdater(MSSA).moveToPlace(MA, preHeaderL1, MemorySSA::End);
+  }
+  for (Instruction *I : Plan.sinkAfterLk) {
+    I->moveBefore(&*exitBlockL2->getFirstInsertionPt());
+    if (MSSA)
+      if (MemoryUseOrDef *MA = MSSA->getMemoryAccess(I))
+        MemorySSAUpdater(MSSA).moveToPlace(MA, exitBlockL2, MemorySSA::Beginning);
+  }
+  NumMovedInstructions += Plan.hoistBeforeLj.size() + Plan.sinkAfterLk.size();
+
+  if (Plan.PeelCount) {
+    LLVM_DEBUG(dbgs() << "Tolgo a lj le sue prime " << Plan.PeelCount << " iterazioni...\n");
+    peelFirstIterations(Lj, Plan.PeelCount, LI, DT, PDT);
+    NumPeeled += Plan.PeelCount;
+  }
+
+  LLVM_DEBUG(dbgs() << "2. Modifico gli usi delle variabili di induzione del secondo ciclo con quelle del primo ciclo...\n");
+
+  // Sostituire gli usi della variabile di induzione del loop k (il secondo loop). Anche gli usi dopo il
+  // loop sono corretti: all'uscita le due variabili hanno fatto lo stesso numero di passi
+  Value *newIV = IV1;
+  if (!ivOffset.isZero())
+    newIV = BinaryOperator::CreateAdd(IV1, ConstantInt::get(IV1->getType(), ivOffset), "fused.iv",
+                                      &*headerL1->getFirstInsertionPt());
+  IV2->replaceAllUsesWith(newIV);
+
+  LLVM_DEBUG(dbgs() << "Variabili di induzione cambiate\n");
+
+  // Il latch di Lj sarà raggiunto dalla fine del body di Lk, l'exit block di Lk dall'header di Lj
+  for (PHINode &PN : latchL1->phis())
+    PN.replaceIncomingBlockWith(endBodyL1, endBodyL2);
+  for (PHINode &PN : exitBlockL2->phis())
+    PN.addIncoming(PN.getIncomingValueForBlock(headerL2), headerL1);
+
+  // PASSO 2: modifico il Control Flow Graph
+  LLVM_DEBUG(dbgs() << "3. Inizio modifica del Control Flow Graph...\n");
 
   // PASSO 2.1: connetto il body del loop Lj con il body del loop Lk
-  outs() << "3.1. Connetto il body del loop 1 con il body del loop 2...\n";
+  LLVM_DEBUG(dbgs() << "3.1. Connetto il body del loop 1 con il body del loop 2...\n");
 
-  (*bodyTerminatorL1).setSuccessor(0, beginBodyL2);
+  endBodyL1->getTerminator()->setSuccessor(0, beginBodyL2);
 
-  outs() << "Aggancio dei due body effettuato\n";
+  LLVM_DEBUG(dbgs() << "Aggancio dei due body effettuato\n");
 
   // PASSO 2.2: connetto il body del loop Lk con il latch del loop Lj
-  outs() << "3.2. Connetto il body del loop 2 con il latch del loop 1...\n";
+  LLVM_DEBUG(dbgs() << "3.2. Connetto il body del loop 2 con il latch del loop 1...\n");
 
-  (*bodyTerminatorL2).setSuccessor(0, latchL1);
+  endBodyL2->getTerminator()->setSuccessor(0, latchL1);
 
-  outs() << "Aggancio body l2 e latch l1 effettuato\n";
+  LLVM_DEBUG(dbgs() << "Aggancio body l2 e latch l1 effettuato\n");
 
   // PASSO 2.3: l'exit block del loop 1 diventa l'exit block del loop 2
-  outs() << "3.3. Sostituisco l'exit block del loop 2 con l'exit block del loop 1...\n";
+  LLVM_DEBUG(dbgs() << "3.3. Sostituisco l'exit block del loop 2 con l'exit block del loop 1...\n");
 
-  (*headerTerminatorL1).setSuccessor(1, exitBlockL2);
+  headerBranchL1->setSuccessor(1, exitBlockL2);
 
-  outs() << "Modifica dell'exit block effettuata\n";
+  LLVM_DEBUG(dbgs() << "Modifica dell'exit block effettuata\n");
 
   // PASSO 2.4: l'header del loop 2 viene connesso al latch del loop 2
-  outs() << "3.4. Aggancio dell'header del loop 2 con il latch del loop 2...\n";
+  LLVM_DEBUG(dbgs() << "3.4. Aggancio dell'header del loop 2 con il latch del loop 2...\n");
+
+  headerBranchL2->setSuccessor(0, latchL2);
 
-  (*headerTerminatorL2).setSuccessor(0, latchL2);
+  LLVM_DEBUG(dbgs() << "Aggancio dell'header effetuato\n");
 
-  outs() << "Aggancio dell'header effetuato\n";
+  // PASSO 3: aggiorno le analisi e rimuovo i blocchi non più raggiungibili
+  LLVM_DEBUG(dbgs() << "4. Aggiorno le analisi ed elimino i blocchi irraggiungibili...\n");
 
-  outs() << "----FINE DELLA FUSIONE DEI DUE LOOP----\n";
+  SmallVector<DominatorTree::UpdateType, 8> updates = {
+      {DominatorTree::Delete, endBodyL1, latchL1},   {DominatorTree::Insert, endBodyL1, beginBodyL2},
+      {DominatorTree::Delete, endBodyL2, latchL2},   {DominatorTree::Insert, endBodyL2, latchL1},
+      {DominatorTree::Delete, headerL1, exitBlockL1}, {DominatorTree::Insert, headerL1, exitBlockL2},
+      {DominatorTree::Delete, headerL2, beginBodyL2}, {DominatorTree::Insert, headerL2, latchL2}};
+
+  DomTreeUpdater DTU(DT, PDT, DomTreeUpdater::UpdateStrategy::Eager);
+  DTU.applyUpdates(updates);
+
+  if (MSSA) {
+    MemorySSAUpdater MSSAU(MSSA);
+    MSSAU.applyUpdates(updates, DT);
+    MSSAU.removeBlocks(deadBlocks);
+  }
+
+  mergeLoopInfo(Lj, Lk, LI, deadBlocks);
+  DeleteDeadBlocks(deadBlocks.getArrayRef(), &DTU);
+
+  // Il codice spostato tra i blocchi e i blocchi eliminati rendono vecchie le disposizioni (in quale blocco
+  // o loop un valore è definito) salvate anche per valori fuori dai due loop
+  SE.forgetBlockAndLoopDispositions();
+
+  LLVM_DEBUG(dbgs() << "----FINE DELLA FUSIONE DEI DUE LOOP----\n");
+  return true;
 }
 
 PreservedAnalyses LoopFusion::run(Function &F, FunctionAnalysisManager &FAM) {
@@ -203,23 +1015,94 @@ PreservedAnalyses LoopFusion::run(Function &F, FunctionAnalysisManager &FAM) {
   PostDominatorTree &PDT = FAM.getResult<PostDominatorTreeAnalysis>(F);
   ScalarEvolution &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
   DependenceInfo &DI = FAM.getResult<DependenceAnalysis>(F);
+  OptimizationRemarkEmitter &ORE = FAM.getResult<OptimizationRemarkEmitterAnalysis>(F);
 
-  // SmalVector contenente tutti i loop della funzione
-  SmallVector<Loop*> loops = LI.getLoopsInPreorder();
-
-  outs() << "----INIZIO PASSO LOOP FUSION----\n";
-  for (auto &iterLoop1 : loops){
-    for (auto &iterLoop2 : loops) {
-      if (iterLoop1 != iterLoop2){
-        Loop *L1 = iterLoop1;
-        Loop *L2 = iterLoop2;
-        if (canFuseLoops(L1, L2, LI, DT, PDT, SE, DI))
-          fuseLoops(L1, L2, LI, SE, DT);
+  // MemorySSA non serve alla fusione: se è già calcolata viene aggiornata, altrimenti ignorata
+  auto *MSSAResult = FAM.getCachedResult<MemorySSAAnalysis>(F);
+  MemorySSA *MSSA = MSSAResult ? &MSSAResult->getMSSA() : nullptr;
+
+  FusionDependenceChecker Deps(DI, SE, F.getParent()->getDataLayout());
+
+  // Il modello di profitto usa le stesse informazioni del loop vectorizer sugli accessi in memoria
+  std::optional<FusionProfitabilityModel> Profitability;
+  if (EnableProfitability)
+    Profitability.emplace(SE, FAM.getResult<LoopAccessAnalysis>(F), Deps, FAM.getResult<TargetIRAnalysis>(F));
+
+  // Loop eliminati da LoopInfo perché fusi in un altro: il puntatore resta valido solo come chiave
+  SmallPtrSet<Loop*, 8> fusedAway;
+  bool Changed = false;
+
+  LLVM_DEBUG(dbgs() << "----INIZIO PASSO LOOP FUSION " << F.getName() << "----\n");
+
+  // I loop sono visitati un livello di annidamento alla volta, partendo dai loop più esterni:
+  // i sotto-loop di due loop fusi diventano fratelli e possono essere fusi al livello successivo
+  SmallVector<Loop*, 8> level(LI.begin(), LI.end());
+  while (!level.empty()) {
+    SmallVector<SmallVector<Loop*, 4>, 4> candidateSets;
+    collectFusionCandidates(level, DT, PDT, candidateSets);
+
+    for (SmallVector<Loop*, 4> &candidates : candidateSets) {
+      // Ogni loop viene provato solo con il successivo nell'insieme. Dopo una fusione il loop
+      // risultante viene provato con il loop seguente, così una catena di N loop diventa un solo loop
+      unsigned i = 0;
+      while (i + 1 < candidates.size()) {
+        Loop *L1 = candidates[i];
+        Loop *L2 = candidates[i + 1];
+        // Il nome del loop fuso serve al remark, dopo la fusione il suo header non esiste più
+        std::string secondLoopName = L2->getHeader()->getName().str();
+        FusionPlan Plan;
+        if (!canFuseLoops(L1, L2, LI, DT, PDT, SE, Deps, Profitability ? &*Profitability : nullptr, ORE, Plan)) {
+          ++i;
+          continue;
+        }
+        // Le iterazioni copiate dal peeling non sono in MemorySSA, che non va aggiornata durante una
+        // fusione con peeling. fuseLoops non modifica l'IR quando rinuncia, quindi MemorySSA smette di
+        // essere valida solo se la fusione avviene davvero
+        if (!fuseLoops(L1, L2, LI, SE, DT, PDT, Plan.PeelCount ? nullptr : MSSA, Plan)) {
+          ++i;
+          continue;
+        }
+        if (Plan.PeelCount)
+          MSSA = nullptr;
+
+        fusedAway.insert(L2);
+        Deps.forgetLoop(L1);
+        Deps.forgetLoop(L2);
+        if (Profitability) {
+          Profitability->forgetLoop(L1);
+          Profitability->forgetLoop(L2);
+        }
+        candidates.erase(candidates.begin() + i + 1);
+        Changed = true;
+        ++NumFused;
+        ORE.emit([&]() {
+          return OptimizationRemark(DEBUG_TYPE, "Fused", L1->getStartLoc(), L1->getHeader())
+                 << "loop " << ore::NV("SecondLoop", secondLoopName) << " fuso con il loop "
+                 << ore::NV("FirstLoop", L1->getHeader()->getName());
+        });
       }
     }
+
+    // Il livello successivo contiene i sotto-loop dei loop rimasti, letti da LoopInfo già aggiornata
+    SmallVector<Loop*, 8> nextLevel;
+    for (Loop *L : level)
+      if (!fusedAway.count(L))
+        nextLevel.append(L->begin(), L->end());
+    level = std::move(nextLevel);
   }
- 
-  return PreservedAnalyses::all();
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+
+  // Le analisi aggiornate durante la fusione restano valide, tutte le altre vanno ricalcolate
+  PreservedAnalyses PA;
+  PA.preserve<DominatorTreeAnalysis>();
+  PA.preserve<PostDominatorTreeAnalysis>();
+  PA.preserve<LoopAnalysis>();
+  PA.preserve<ScalarEvolutionAnalysis>();
+  if (MSSA)
+    PA.preserve<MemorySSAAnalysis>();
+  return PA;
 }
 
 
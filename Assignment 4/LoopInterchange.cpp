@@ -0,0 +1,660 @@
+#include "llvm/Transforms/Utils/LoopInterchange.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/LoopMemoryUtils.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <optional>
+
+#define DEBUG_TYPE "loopinterchange"
+
+using namespace llvm;
+
+// Contatori del passo, visibili con -stats
+STATISTIC(NumInterchanged, "Numero di coppie di loop scambiate");
+STATISTIC(NumTiled, "Numero di nidi di loop divisi in blocchi");
+STATISTIC(NumTileLoops, "Numero di loop creati dalla divisione in blocchi");
+
+static cl::list<unsigned> TileSizes(
+    "loopinterchange-tile-sizes", cl::CommaSeparated, cl::Hidden,
+    cl::desc("Dimensioni dei blocchi per i loop di un nido, dal più esterno al più interno: l'ultima vale per "
+             "i loop restanti, 0 o 1 lascia il loop intero. Senza dimensioni i nidi non vengono divisi in blocchi"));
+
+// Funzione di supporto che emette il remark di un nido di loop non trasformato
+static void emitMissed(OptimizationRemarkEmitter &ORE, Loop *L, StringRef RemarkName, StringRef Reason) {
+  ORE.emit([&]() {
+    return OptimizationRemarkMissed(DEBUG_TYPE, RemarkName, L->getStartLoc(), L->getHeader())
+           << "nido del loop " << ore::NV("Loop", L->getHeader()->getName()) << ": " << Reason;
+  });
+}
+
+// ---------------------------------------------------------------------------
+// CONTROLLO DEI LOOP DEL NIDO
+// Ogni loop del nido è governato da una variabile di induzione con un valore
+// iniziale, un passo e un limite che non dipendono dal nido (nido rettangolare).
+// Scambiare due loop equivale allora a scambiare questi tre valori (e il
+// predicato del confronto) tra i due loop, e gli usi delle due variabili di
+// induzione nel corpo: i blocchi restano dove sono e DominatorTree e LoopInfo
+// non cambiano.
+// ---------------------------------------------------------------------------
+
+struct NestLevel {
+  Loop *L = nullptr;
+  PHINode *IV = nullptr;
+  // Incremento della variabile di induzione, valore che arriva dal latch
+  BinaryOperator *Next = nullptr;
+  // Confronto che decide l'uscita, usato solo dal branch dell'exiting block
+  ICmpInst *Cmp = nullptr;
+  unsigned startIndex = 0; // Indice del valore iniziale tra gli incoming della PHI
+  unsigned stepIndex = 0;  // Indice del passo tra gli operandi dell'incremento
+  unsigned ivOperand = 0;  // Indice di IV (o Next) tra gli operandi del confronto
+  bool exitsFromHeader = false;
+  bool cmpOnNext = false;
+  bool stayOnTrue = false;
+
+  Value *getStart() const { return IV->getIncomingValue(startIndex); }
+  Value *getStep() const { return Next->getOperand(stepIndex); }
+  Value *getBound() const { return Cmp->getOperand(1 - ivOperand); }
+  bool isControl(const Value *V) const { return V == IV || V == Next || V == Cmp; }
+
+  // Predicato che, con la variabile di induzione a sinistra, è vero quando il loop continua
+  CmpInst::Predicate getStayPredicate() const {
+    CmpInst::Predicate P = Cmp->getPredicate();
+    if (!stayOnTrue)
+      P = CmpInst::getInversePredicate(P);
+    return ivOperand ? CmpInst::getSwappedPredicate(P) : P;
+  }
+  void setStayPredicate(CmpInst::Predicate P) {
+    if (ivOperand)
+      P = CmpInst::getSwappedPredicate(P);
+    Cmp->setPredicate(stayOnTrue ? P : CmpInst::getInversePredicate(P));
+  }
+  // Il loop visita l'intervallo [inizio, limite) con passo 1, controllato prima o dopo il corpo
+  bool isCanonical() const {
+    auto *step = dyn_cast<ConstantInt>(getStep());
+    CmpInst::Predicate P = getStayPredicate();
+    return step && step->isOne() && (P == CmpInst::ICMP_SLT || P == CmpInst::ICMP_ULT) &&
+           exitsFromHeader != cmpOnNext;
+  }
+};
+
+// Funzione di supporto che riconosce il controllo di un loop: un solo exiting block (l'header o il latch)
+// con un branch condizionato dal confronto tra la variabile di induzione (o il suo incremento) e un limite
+static bool analyzeLevel(Loop *L, NestLevel &Lv) {
+  BasicBlock *header = L->getHeader();
+  BasicBlock *latch = L->getLoopLatch();
+  BasicBlock *exiting = L->getExitingBlock();
+  if (!L->getLoopPreheader() || !latch || !exiting || !L->getExitBlock() || !L->hasDedicatedExits())
+    return false;
+  if (exiting != header && exiting != latch)
+    return false;
+
+  // La sola PHI dell'header è la variabile di induzione: ogni altra ricorrenza dipende dall'ordine delle iterazioni
+  auto phis = header->phis();
+  if (std::distance(phis.begin(), phis.end()) != 1)
+    return false;
+  Lv.L = L;
+  Lv.IV = &*phis.begin();
+  if (Lv.IV->getNumIncomingValues() != 2)
+    return false;
+  Lv.startIndex = Lv.IV->getIncomingBlock(0) == latch ? 1 : 0;
+
+  Lv.Next = dyn_cast<BinaryOperator>(Lv.IV->getIncomingValue(1 - Lv.startIndex));
+  if (!Lv.Next || Lv.Next->getOpcode() != Instruction::Add || !L->contains(Lv.Next))
+    return false;
+  if (Lv.Next->getOperand(0) == Lv.IV)
+    Lv.stepIndex = 1;
+  else if (Lv.Next->getOperand(1) == Lv.IV)
+    Lv.stepIndex = 0;
+  else
+    return false;
+
+  auto *Br = dyn_cast<BranchInst>(exiting->getTerminator());
+  if (!Br || !Br->isConditional())
+    return false;
+  Lv.Cmp = dyn_cast<ICmpInst>(Br->getCondition());
+  if (!Lv.Cmp || !Lv.Cmp->hasOneUse())
+    return false;
+  Value *lhs = Lv.Cmp->getOperand(0);
+  Value *rhs = Lv.Cmp->getOperand(1);
+  if (lhs == Lv.IV || lhs == Lv.Next)
+    Lv.ivOperand = 0;
+  else if (rhs == Lv.IV || rhs == Lv.Next)
+    Lv.ivOperand = 1;
+  else
+    return false;
+  Lv.cmpOnNext = Lv.Cmp->getOperand(Lv.ivOperand) == Lv.Next;
+  // Un loop di un solo blocco controlla l'uscita dopo il corpo, come un loop ruotato
+  Lv.exitsFromHeader = exiting != latch;
+  Lv.stayOnTrue = L->contains(Br->getSuccessor(0));
+  return true;
+}
+
+// Funzione di supporto che stabilisce se un loop esegue almeno un'iterazione quando viene raggiunto.
+// Un loop che controlla l'uscita nel latch esegue sempre il corpo una volta, mentre il loop sui blocchi che
+// lo avvolge controlla inizio < limite prima di entrare: la divisione in blocchi è corretta solo se il
+// confronto è dimostrabile
+static bool runsAtLeastOnce(const NestLevel &Lv, ScalarEvolution &SE) {
+  if (Lv.exitsFromHeader)
+    return true;
+  CmpInst::Predicate P = Lv.getStayPredicate();
+  const SCEV *start = SE.getSCEV(Lv.getStart());
+  const SCEV *bound = SE.getSCEV(Lv.getBound());
+  return SE.isKnownPredicate(P, start, bound) || SE.isLoopEntryGuardedByCond(Lv.L, P, start, bound);
+}
+
+// Funzione di supporto che stabilisce se un valore è definito fuori dal nido
+static bool isNestInvariant(const Value *V, Loop *Outer) {
+  auto *I = dyn_cast<Instruction>(V);
+  return !I || !Outer->contains(I);
+}
+
+// Nido perfetto e rettangolare: tra un loop e il suo unico sotto-loop ci sono solo il controllo del loop
+// e calcoli invarianti senza effetti; il corpo è nel loop più interno, accede alla memoria solo con load
+// e store semplici e non produce valori usati fuori. Riempie levels e le istruzioni del corpo che
+// accedono alla memoria; ritorna false con il motivo se il nido non ha questa forma
+static bool analyzeNest(ArrayRef<Loop*> loops, SmallVectorImpl<NestLevel> &levels,
+                        SmallVectorImpl<Instruction*> &accesses, StringRef &reason) {
+  Loop *outer = loops.front();
+  Loop *innermost = loops.back();
+  levels.resize(loops.size());
+  for (unsigned k = 0; k < loops.size(); ++k) {
+    if (!analyzeLevel(loops[k], levels[k])) {
+      reason = "il controllo di un loop non ha la forma di un ciclo for";
+      return false;
+    }
+    if (!isNestInvariant(levels[k].getStart(), outer) || !isNestInvariant(levels[k].getStep(), outer) ||
+        !isNestInvariant(levels[k].getBound(), outer)) {
+      reason = "il nido non è rettangolare";
+      return false;
+    }
+  }
+
+  auto isControl = [&](const Value *V) {
+    return llvm::any_of(levels, [&](const NestLevel &Lv) { return Lv.isControl(V); });
+  };
+
+  // Blocchi tra un loop e il suo sotto-loop
+  for (unsigned k = 0; k + 1 < loops.size(); ++k)
+    for (BasicBlock *BB : loops[k]->blocks()) {
+      if (loops[k + 1]->contains(BB))
+        continue;
+      for (Instruction &I : *BB) {
+        if (levels[k].isControl(&I) || I.isTerminator()) {
+          if (auto *Br = dyn_cast<BranchInst>(&I))
+            if (Br->isConditional() && !levels[k].isControl(Br->getCondition()) && isControl(Br->getCondition())) {
+              reason = "il nido non è perfetto";
+              return false;
+            }
+          continue;
+        }
+        bool invariant = !isa<PHINode>(I) && !I.mayHaveSideEffects() && !I.mayReadFromMemory() &&
+                         llvm::none_of(I.operands(), [&](Value *op) {
+                           return isControl(op) || (isa<Instruction>(op) && innermost->contains(cast<Instruction>(op)));
+                         });
+        if (!invariant) {
+          reason = "il nido non è perfetto";
+          return false;
+        }
+        // Dopo la divisione in blocchi l'uscita del nido è raggiunta dall'header del loop sui blocchi,
+        // che non è dominato dai blocchi tra i loop
+        for (User *U : I.users())
+          if (!outer->contains(cast<Instruction>(U))) {
+            reason = "un valore calcolato tra i loop del nido è usato fuori dal nido";
+            return false;
+          }
+      }
+    }
+
+  // Le variabili di induzione servono solo al controllo e al corpo
+  for (NestLevel &Lv : levels)
+    for (Instruction *I : {cast<Instruction>(Lv.IV), cast<Instruction>(Lv.Next)})
+      for (User *U : I->users())
+        if (!Lv.isControl(U) && !innermost->contains(cast<Instruction>(U))) {
+          reason = "una variabile di induzione è usata fuori dal corpo del nido";
+          return false;
+        }
+
+  for (BasicBlock *BB : innermost->blocks())
+    for (Instruction &I : *BB) {
+      if (levels.back().isControl(&I) || I.isTerminator())
+        continue;
+      if (auto *load = dyn_cast<LoadInst>(&I)) {
+        if (!load->isSimple()) {
+          reason = "il corpo contiene accessi volatili o atomici";
+          return false;
+        }
+        accesses.push_back(&I);
+      } else if (auto *store = dyn_cast<StoreInst>(&I)) {
+        if (!store->isSimple()) {
+          reason = "il corpo contiene accessi volatili o atomici";
+          return false;
+        }
+        accesses.push_back(&I);
+      } else if (I.mayReadOrWriteMemory() || I.mayHaveSideEffects()) {
+        reason = "il corpo contiene chiamate o istruzioni con effetti";
+        return false;
+      }
+      for (User *U : I.users())
+        if (!innermost->contains(cast<Instruction>(U))) {
+          reason = "un valore del corpo è usato fuori dal nido";
+          return false;
+        }
+    }
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+// LEGALITÀ
+// Una dipendenza tra due accessi del corpo è un insieme di vettori di direzione,
+// un elemento per ogni loop che contiene i due accessi. Ogni vettore concreto,
+// orientato in modo che la prima direzione diversa da = sia <, descrive un
+// ordine che la trasformazione deve rispettare: dopo aver permutato i livelli
+// del nido la prima direzione diversa da = deve restare <. I vettori di una
+// dipendenza non analizzabile contengono ogni direzione.
+// ---------------------------------------------------------------------------
+
+class NestDependences {
+public:
+  NestDependences(unsigned firstLevel) : firstLevel(firstLevel) {}
+
+  void addDependence(const Dependence &Dep, unsigned numLevels) {
+    SmallVector<unsigned, 4> directions(numLevels, Dependence::DVEntry::ALL);
+    if (!Dep.isConfused() && Dep.getLevels() == numLevels)
+      for (unsigned level = 1; level <= numLevels; ++level)
+        directions[level - 1] = Dep.getDirection(level);
+    dependences.push_back(std::move(directions));
+  }
+
+  // I loop ai livelli del nido a e a+1 possono essere scambiati
+  bool canSwap(unsigned a) const {
+    return allOrientedVectors([&](SmallVectorImpl<unsigned> &w) {
+      std::swap(w[firstLevel + a], w[firstLevel + a + 1]);
+      return isLexicographicallyPositive(w);
+    });
+  }
+  void swap(unsigned a) {
+    for (SmallVector<unsigned, 4> &directions : dependences)
+      std::swap(directions[firstLevel + a], directions[firstLevel + a + 1]);
+  }
+
+  // Ogni dipendenza non portata da un loop fuori dal nido va in avanti in tutti i loop del nido,
+  // che possono quindi essere permutati liberamente (condizione per dividerli in blocchi)
+  bool isFullyPermutable() const {
+    return allOrientedVectors([&](SmallVectorImpl<unsigned> &w) {
+      for (unsigned level = 0; level < firstLevel; ++level)
+        if (w[level] != Dependence::DVEntry::EQ)
+          return true;
+      return llvm::none_of(llvm::drop_begin(w, firstLevel),
+                           [](unsigned d) { return d == Dependence::DVEntry::GT; });
+    });
+  }
+
+private:
+  // Indice del loop più esterno del nido tra i livelli delle dipendenze
+  unsigned firstLevel;
+  SmallVector<SmallVector<unsigned, 4>, 16> dependences;
+
+  static bool isLexicographicallyPositive(ArrayRef<unsigned> w) {
+    for (unsigned d : w)
+      if (d != Dependence::DVEntry::EQ)
+        return d == Dependence::DVEntry::LT;
+    return true;
+  }
+
+  // Chiama check su ogni vettore concreto (una sola direzione per livello) orientato; i vettori
+  // con tutte le direzioni = legano due accessi della stessa iterazione e non vincolano l'ordine dei loop
+  template <typename CheckT> bool allOrientedVectors(CheckT check) const {
+    SmallVector<unsigned, 4> w;
+    for (const SmallVector<unsigned, 4> &directions : dependences) {
+      w.assign(directions.size(), 0);
+      if (!enumerate(directions, 0, w, check))
+        return false;
+    }
+    return true;
+  }
+
+  template <typename CheckT>
+  static bool enumerate(ArrayRef<unsigned> directions, unsigned level, SmallVectorImpl<unsigned> &w, CheckT &check) {
+    if (level == directions.size()) {
+      auto first = llvm::find_if(w, [](unsigned d) { return d != Dependence::DVEntry::EQ; });
+      if (first == w.end())
+        return true;
+      SmallVector<unsigned, 4> oriented(w.begin(), w.end());
+      if (*first == Dependence::DVEntry::GT)
+        for (unsigned &d : oriented) {
+          if (d == Dependence::DVEntry::LT)
+            d = Dependence::DVEntry::GT;
+          else if (d == Dependence::DVEntry::GT)
+            d = Dependence::DVEntry::LT;
+        }
+      return check(oriented);
+    }
+    for (unsigned d : {Dependence::DVEntry::LT, Dependence::DVEntry::EQ, Dependence::DVEntry::GT})
+      if (directions[level] & d) {
+        w[level] = d;
+        if (!enumerate(directions, level + 1, w, check))
+          return false;
+      }
+    return true;
+  }
+};
+
+static void collectDependences(ArrayRef<Instruction*> accesses, Loop *innermost, DependenceInfo &DI,
+                               NestDependences &Deps) {
+  unsigned numLevels = innermost->getLoopDepth();
+  for (unsigned i = 0; i < accesses.size(); ++i)
+    for (unsigned j = i; j < accesses.size(); ++j) {
+      Instruction *A = accesses[i];
+      Instruction *B = accesses[j];
+      if (!A->mayWriteToMemory() && !B->mayWriteToMemory())
+        continue;
+      if (!mayShareMemory(A, B))
+        continue;
+      if (std::unique_ptr<Dependence> Dep = DI.depends(A, B, true))
+        Deps.addDependence(*Dep, numLevels);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// PROFITTO
+// Il passo di un accesso rispetto a un loop è il coefficiente del suo AddRec
+// nell'espressione SCEV dell'indirizzo. Un accesso con passo nullo o minore di
+// una linea di cache riusa la linea caricata all'iterazione precedente: il loop
+// con più accessi di questo tipo deve essere il più interno.
+// ---------------------------------------------------------------------------
+
+// Funzione di supporto che ritorna il passo in byte dell'indirizzo S rispetto al loop L, se è costante
+static std::optional<int64_t> getConstantStride(const SCEV *S, Loop *L, ScalarEvolution &SE) {
+  // Gli AddRec dei loop interni a L sono annidati fuori da quello di L: si scende verso il valore iniziale
+  while (!SE.isLoopInvariant(S, L)) {
+    auto *AR = dyn_cast<SCEVAddRecExpr>(S);
+    if (!AR || !AR->isAffine())
+      return std::nullopt;
+    if (AR->getLoop() == L) {
+      if (auto *step = dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE)))
+        return step->getAPInt().getSExtValue();
+      return std::nullopt;
+    }
+    S = AR->getStart();
+  }
+  return 0;
+}
+
+// Numero di accessi del corpo che, con il loop L più interno, restano nella stessa linea di cache
+static unsigned countLocalAccesses(ArrayRef<Instruction*> accesses, Loop *L, ScalarEvolution &SE, unsigned lineSize) {
+  unsigned count = 0;
+  for (Instruction *I : accesses) {
+    std::optional<int64_t> stride = getConstantStride(SE.getSCEV(getLoadStorePointerOperand(I)), L, SE);
+    if (stride && std::abs(*stride) < (int64_t)lineSize)
+      ++count;
+  }
+  return count;
+}
+
+// ---------------------------------------------------------------------------
+// TRASFORMAZIONI
+// ---------------------------------------------------------------------------
+
+// Scambia i loop A (esterno) e B (suo sotto-loop nel nido). I due loop devono avere la stessa forma
+static void swapLoopControls(NestLevel &A, NestLevel &B) {
+  // Usi delle variabili di induzione nel corpo, da scambiare
+  SmallVector<std::pair<Use*, Value*>, 16> bodyUses;
+  auto collect = [&](Instruction *from, Value *to) {
+    for (Use &U : from->uses())
+      if (!A.isControl(U.getUser()) && !B.isControl(U.getUser()))
+        bodyUses.push_back({&U, to});
+  };
+  collect(A.IV, B.IV);
+  collect(B.IV, A.IV);
+  collect(A.Next, B.Next);
+  collect(B.Next, A.Next);
+
+  Value *startA = A.getStart(), *stepA = A.getStep(), *boundA = A.getBound();
+  CmpInst::Predicate predA = A.getStayPredicate();
+  A.IV->setIncomingValue(A.startIndex, B.getStart());
+  A.Next->setOperand(A.stepIndex, B.getStep());
+  A.Cmp->setOperand(1 - A.ivOperand, B.getBound());
+  A.setStayPredicate(B.getStayPredicate());
+  B.IV->setIncomingValue(B.startIndex, startA);
+  B.Next->setOperand(B.stepIndex, stepA);
+  B.Cmp->setOperand(1 - B.ivOperand, boundA);
+  B.setStayPredicate(predA);
+
+  // nuw e nsw valevano per l'intervallo precedente della variabile di induzione
+  A.Next->dropPoisonGeneratingFlags();
+  B.Next->dropPoisonGeneratingFlags();
+  for (auto &use : bodyUses)
+    use.first->set(use.second);
+}
+
+// Avvolge il loop X in un loop che visita l'intervallo del livello Lv a blocchi di tileSize iterazioni.
+// Il loop di Lv visita poi solo le iterazioni del blocco corrente, [tile.iv, tile.end). L'header del nuovo loop
+// prende il posto del preheader di X, il suo latch si trova tra l'uscita di X e il vecchio exit block.
+// DominatorTree e LoopInfo vengono aggiornate; ritorna il nuovo loop
+static Loop *wrapWithTileLoop(Loop *X, NestLevel &Lv, unsigned tileSize, LoopInfo &LI, DominatorTree &DT) {
+  BasicBlock *preHeader = X->getLoopPreheader();
+  BasicBlock *exiting = X->getExitingBlock();
+  BasicBlock *exitBlock = X->getExitBlock();
+  std::string name = Lv.L->getHeader()->getName().str();
+
+  BasicBlock *tileHeader = SplitBlock(preHeader, preHeader->getTerminator(), &DT, &LI, nullptr, name + ".tile");
+  BasicBlock *tileBody = SplitBlock(tileHeader, tileHeader->getTerminator(), &DT, &LI, nullptr, name + ".tile.body");
+  BasicBlock *tileLatch = BasicBlock::Create(tileHeader->getContext(), name + ".tile.latch", tileHeader->getParent(),
+                                             exitBlock);
+  BranchInst::Create(tileHeader, tileLatch);
+  exiting->getTerminator()->replaceUsesOfWith(exitBlock, tileLatch);
+  for (PHINode &phi : exitBlock->phis())
+    phi.replaceIncomingBlockWith(exiting, tileHeader);
+
+  // tile.end = tile.iv + min(limite - tile.iv, tileSize): non supera il limite e non va in overflow
+  Value *start = Lv.getStart();
+  Value *bound = Lv.getBound();
+  Type *type = Lv.IV->getType();
+  PHINode *tileIV = PHINode::Create(type, 2, name + ".tile.iv", &tileHeader->front());
+  IRBuilder<> B(tileHeader->getTerminator());
+  Value *remaining = B.CreateSub(bound, tileIV, name + ".tile.remaining");
+  Value *size = ConstantInt::get(type, tileSize);
+  Value *take = B.CreateSelect(B.CreateICmpULT(remaining, size), remaining, size, name + ".tile.take");
+  Value *tileEnd = B.CreateAdd(tileIV, take, name + ".tile.end");
+  Value *cond = B.CreateICmp(Lv.getStayPredicate(), tileIV, bound, name + ".tile.cond");
+  B.CreateCondBr(cond, tileBody, exitBlock);
+  tileHeader->getTerminator()->eraseFromParent();
+  tileIV->addIncoming(start, preHeader);
+  tileIV->addIncoming(tileEnd, tileLatch);
+
+  Lv.IV->setIncomingValue(Lv.startIndex, tileIV);
+  Lv.Cmp->setOperand(1 - Lv.ivOperand, tileEnd);
+
+  // Il nuovo loop prende il posto di X tra i loop fratelli e lo contiene
+  Loop *Tile = LI.AllocateLoop();
+  if (Loop *parent = X->getParentLoop())
+    parent->replaceChildLoopWith(X, Tile);
+  else
+    LI.changeTopLevelLoop(X, Tile);
+  Tile->addChildLoop(X);
+  for (BasicBlock *BB : {tileHeader, tileBody}) {
+    LI.changeLoopFor(BB, Tile);
+    Tile->addBlockEntry(BB);
+  }
+  Tile->addBasicBlockToLoop(tileLatch, LI);
+  for (BasicBlock *BB : X->blocks())
+    Tile->addBlockEntry(BB);
+
+  // L'exit block ora è raggiunto dall'header del nuovo loop al posto dell'exiting block di X
+  DT.addNewBlock(tileLatch, exiting);
+  BasicBlock *idom = nullptr;
+  for (BasicBlock *pred : predecessors(exitBlock))
+    idom = idom ? DT.findNearestCommonDominator(idom, pred) : pred;
+  DT.changeImmediateDominator(exitBlock, idom);
+  return Tile;
+}
+
+// Divide il nido in blocchi: per ogni livello con una dimensione di blocco viene creato un loop sui blocchi,
+// e tutti questi loop sono messi fuori dal nido nello stesso ordine dei livelli. Ritorna il numero di loop creati
+static unsigned tileNest(SmallVectorImpl<NestLevel> &levels, ArrayRef<unsigned> sizes, LoopInfo &LI,
+                         DominatorTree &DT) {
+  Loop *outermost = levels.front().L;
+  unsigned created = 0;
+  for (unsigned k = levels.size(); k-- > 0;) {
+    if (sizes[k] <= 1)
+      continue;
+    outermost = wrapWithTileLoop(outermost, levels[k], sizes[k], LI, DT);
+    ++created;
+  }
+  return created;
+}
+
+// Funzione di supporto che raccoglie i nidi perfetti di almeno due loop: catene di loop che hanno un solo
+// sotto-loop fino a un loop innermost. Il primo loop della catena non è l'unico sotto-loop del padre
+static void collectNests(LoopInfo &LI, SmallVectorImpl<SmallVector<Loop*, 4>> &nests) {
+  for (Loop *L : LI.getLoopsInPreorder()) {
+    Loop *parent = L->getParentLoop();
+    if (parent && parent->getSubLoops().size() == 1)
+      continue;
+    SmallVector<Loop*, 4> chain = {L};
+    while (chain.back()->getSubLoops().size() == 1)
+      chain.push_back(chain.back()->getSubLoops().front());
+    if (chain.size() >= 2 && chain.back()->isInnermost())
+      nests.push_back(std::move(chain));
+  }
+}
+
+PreservedAnalyses LoopInterchange::run(Function &F, FunctionAnalysisManager &FAM) {
+  LoopInfo &LI = FAM.getResult<LoopAnalysis>(F);
+  DominatorTree &DT = FAM.getResult<DominatorTreeAnalysis>(F);
+  ScalarEvolution &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+  DependenceInfo &DI = FAM.getResult<DependenceAnalysis>(F);
+  OptimizationRemarkEmitter &ORE = FAM.getResult<OptimizationRemarkEmitterAnalysis>(F);
+  TargetTransformInfo &TTI = FAM.getResult<TargetIRAnalysis>(F);
+  unsigned lineSize = TTI.getCacheLineSize() ? TTI.getCacheLineSize() : 64;
+
+  // I loop creati dalla divisione in blocchi non vengono visitati: i nidi sono raccolti prima di iniziare
+  SmallVector<SmallVector<Loop*, 4>, 4> nests;
+  collectNests(LI, nests);
+
+  bool Changed = false;
+  LLVM_DEBUG(dbgs() << "----INIZIO PASSO LOOP INTERCHANGE " << F.getName() << "----\n");
+  for (SmallVector<Loop*, 4> &loops : nests) {
+    Loop *outer = loops.front();
+    SmallVector<NestLevel, 4> levels;
+    SmallVector<Instruction*, 16> accesses;
+    StringRef reason;
+    if (!analyzeNest(loops, levels, accesses, reason)) {
+      emitMissed(ORE, outer, "UnsupportedNest", reason);
+      continue;
+    }
+
+    NestDependences Deps(outer->getLoopDepth() - 1);
+    collectDependences(accesses, loops.back(), DI, Deps);
+
+    // Il loop con più accessi locali scende verso l'interno con scambi di loop adiacenti, se legali
+    SmallVector<unsigned, 4> score;
+    for (Loop *L : loops)
+      score.push_back(countLocalAccesses(accesses, L, SE, lineSize));
+    bool swapped = true;
+    for (unsigned round = 0; round < levels.size() && swapped; ++round) {
+      swapped = false;
+      for (unsigned a = 0; a + 1 < levels.size(); ++a) {
+        if (score[a] <= score[a + 1])
+          continue;
+        NestLevel &A = levels[a];
+        NestLevel &B = levels[a + 1];
+        if (A.exitsFromHeader != B.exitsFromHeader || A.cmpOnNext != B.cmpOnNext ||
+            A.IV->getType() != B.IV->getType()) {
+          emitMissed(ORE, A.L, "DifferentShape", "i loop da scambiare hanno forme diverse");
+          continue;
+        }
+        if (!Deps.canSwap(a)) {
+          emitMissed(ORE, A.L, "Dependence", "lo scambio invertirebbe una dipendenza");
+          continue;
+        }
+
+        LLVM_DEBUG(dbgs() << "Scambio i loop " << A.L->getHeader()->getName() << " e "
+                          << B.L->getHeader()->getName() << "\n");
+        swapLoopControls(A, B);
+        Deps.swap(a);
+        std::swap(score[a], score[a + 1]);
+        SE.forgetLoop(outer);
+        swapped = Changed = true;
+        ++NumInterchanged;
+        ORE.emit([&]() {
+          return OptimizationRemark(DEBUG_TYPE, "Interchanged", A.L->getStartLoc(), A.L->getHeader())
+                 << "loop " << ore::NV("Outer", A.L->getHeader()->getName()) << " scambiato con il loop "
+                 << ore::NV("Inner", B.L->getHeader()->getName());
+        });
+      }
+    }
+
+    if (TileSizes.empty())
+      continue;
+    SmallVector<unsigned, 4> sizes;
+    for (unsigned k = 0; k < levels.size(); ++k)
+      sizes.push_back(TileSizes[std::min<size_t>(k, TileSizes.size() - 1)]);
+    bool anyTiled = false;
+    bool canonical = true;
+    bool runsOnce = true;
+    for (unsigned k = 0; k < levels.size(); ++k)
+      if (sizes[k] > 1) {
+        anyTiled = true;
+        canonical &= levels[k].isCanonical();
+        runsOnce &= runsAtLeastOnce(levels[k], SE);
+      }
+    if (!anyTiled)
+      continue;
+    if (!canonical) {
+      emitMissed(ORE, outer, "NotCanonical", "un loop da dividere in blocchi non visita [inizio, limite) con passo 1");
+      continue;
+    }
+    if (!runsOnce) {
+      emitMissed(ORE, outer, "MayNotRun",
+                 "un loop da dividere in blocchi controlla l'uscita nel latch e non è dimostrato che inizio < limite");
+      continue;
+    }
+    if (!Deps.isFullyPermutable()) {
+      emitMissed(ORE, outer, "NotPermutable", "i loop del nido non si possono permutare liberamente");
+      continue;
+    }
+
+    LLVM_DEBUG(dbgs() << "Divido in blocchi il nido del loop " << outer->getHeader()->getName() << "\n");
+    Loop *topmost = outer;
+    while (topmost->getParentLoop())
+      topmost = topmost->getParentLoop();
+    SE.forgetLoop(topmost);
+    unsigned created = tileNest(levels, sizes, LI, DT);
+    // I nuovi loop sui blocchi contengono il nido: le disposizioni salvate per i suoi valori non valgono più
+    SE.forgetBlockAndLoopDispositions();
+    Changed = true;
+    ++NumTiled;
+    NumTileLoops += created;
+    ORE.emit([&]() {
+      return OptimizationRemark(DEBUG_TYPE, "Tiled", outer->getStartLoc(), outer->getHeader())
+             << "nido del loop " << ore::NV("Loop", outer->getHeader()->getName()) << " diviso in blocchi con "
+             << ore::NV("TileLoops", created) << " loop sui blocchi";
+    });
+  }
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+
+  // Lo scambio non modifica il CFG; la divisione in blocchi aggiorna DominatorTree e LoopInfo,
+  // e ScalarEvolution ha dimenticato i nidi trasformati e le disposizioni dei nidi divisi in blocchi
+  PreservedAnalyses PA;
+  PA.preserve<DominatorTreeAnalysis>();
+  PA.preserve<LoopAnalysis>();
+  PA.preserve<ScalarEvolutionAnalysis>();
+  return PA;
+}
@@ -0,0 +1,14 @@
+#ifndef LLVM_TRANSFORMS_LOOPINTERCHANGE_H
+#define LLVM_TRANSFORMS_LOOPINTERCHANGE_H
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/DependenceAnalysis.h"
+
+namespace llvm {
+    class LoopInterchange : public  PassInfoMixin<LoopInterchange> {
+          public : PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM);
+    };
+}
+#endif
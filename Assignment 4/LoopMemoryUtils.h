@@ -0,0 +1,30 @@
+#ifndef LLVM_TRANSFORMS_LOOPMEMORYUTILS_H
+#define LLVM_TRANSFORMS_LOOPMEMORYUTILS_H
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Instructions.h"
+
+// Funzioni di supporto sugli accessi in memoria condivise da LoopFusion, LoopDistribution e LoopInterchange
+namespace llvm {
+
+    // Oggetto a cui accede un load o uno store, nullptr se I non è un accesso semplice
+    inline const Value *getAccessedObject(const Instruction *I) {
+        const Value *ptr = getLoadStorePointerOperand(I);
+        return ptr ? getUnderlyingObject(ptr) : nullptr;
+    }
+
+    // Stabilisce se due oggetti possono riferirsi alla stessa memoria: due oggetti diversi sono distinti
+    // solo se entrambi sono identificati (alloca, globali, argomenti noalias); nullptr è un oggetto sconosciuto
+    inline bool mayShareMemory(const Value *objectA, const Value *objectB) {
+        if (objectA == objectB || !objectA || !objectB)
+            return true;
+        return !isIdentifiedObject(objectA) || !isIdentifiedObject(objectB);
+    }
+
+    inline bool mayShareMemory(const Instruction *A, const Instruction *B) {
+        return mayShareMemory(getAccessedObject(A), getAccessedObject(B));
+    }
+
+} // namespace llvm
+#endif